@@ -0,0 +1,442 @@
+#pragma once
+
+//   Copyright 2022 Kevin Godden
+//
+//   Licensed under the Apache License, Version 2.0 (the "License");
+//   you may not use this file except in compliance with the License.
+//   You may obtain a copy of the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+//   Unless required by applicable law or agreed to in writing, software
+//   distributed under the License is distributed on an "AS IS" BASIS,
+//   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//   See the License for the specific language governing permissions and
+//   limitations under the License.
+
+#include "boost_udp_receive_rar.h"
+
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <vector>
+
+#include <openssl/crypto.h>
+#include <openssl/evp.h>
+
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+#include <openssl/core_names.h>
+#else
+#include <openssl/hmac.h>
+#endif
+
+//
+// Checks feeds that are signed or encrypted with a per session key,
+// using OpenSSL (link with -lcrypto), which uses AES-NI and the SHA
+// extensions where the CPU has them.
+//
+// hmac_sha256: each datagram ends with an HMAC-SHA256 of everything
+// before it (optionally truncated to tag_size bytes), good datagrams
+// are handed on without it.
+//
+// aes_gcm: each datagram is aad_size bytes sent in the clear (and
+// authenticated), a 12 byte IV, the AES-GCM encrypted payload and a 16
+// byte tag. A view's payload is decrypted into a buffer the
+// authenticator owns, as views can be of memory that mustn't be written
+// (a shared memory or broadcast ring, a replay or a journal), and handed
+// on as a view of the plain text, valid until the next push() or
+// validate(). Given a buffer of your own, e.g. one filled with
+// try_receive_into(), push() and open() decrypt in place instead.
+//
+// The key schedule and the OpenSSL contexts are set up once and reused
+// for every datagram, so per datagram there's no allocation or key
+// expansion. validate() checks a batch of datagrams in one go.
+//
+// Single threaded, use one authenticator per thread.
+//
+// Synopsis:
+//
+/*
+	boost_udp_auth_options options;
+	options.mode = boost_udp_auth_options::aes_gcm;
+	options.key = session_key;   // 16 or 32 bytes
+
+	boost_udp_authenticator authenticator(options, [](const datagram_view& plain) {
+		process(plain);
+	});
+
+	if (authenticator.setup_error())
+		...
+
+	boost_udp_receive_thread thread(rar, [&](const datagram_view& datagram) {
+		authenticator.push(datagram);
+	});
+*/
+
+struct boost_udp_auth_options {
+	enum mode_type {
+		hmac_sha256,
+		aes_gcm
+	};
+
+	mode_type mode = hmac_sha256;
+
+	// Any length for HMAC, 16 or 32 bytes (AES-128 or
+	// AES-256) for GCM.
+	std::vector<unsigned char> key;
+
+	// Bytes of the HMAC sent, the first tag_size (at most 32)
+	std::size_t tag_size = 32;
+
+	// With GCM, how many bytes at the start of each
+	// datagram are sent in the clear.
+	std::size_t aad_size = 0;
+};
+
+struct boost_udp_auth_stats {
+	// Datagrams handed on, and the bytes checked
+	uint64_t authentic = 0;
+	uint64_t bytes = 0;
+
+	// Dropped because the tag didn't match, or
+	// too short to have one.
+	uint64_t rejected = 0;
+	uint64_t malformed = 0;
+};
+
+class boost_udp_authenticator {
+public:
+	using handler_type = std::function<void(const datagram_view&)>;
+
+	// GCM's IV and tag
+	static const std::size_t iv_size = 12;
+	static const std::size_t gcm_tag_size = 16;
+
+private:
+	boost_udp_auth_options options;
+	handler_type handler;
+
+	boost::system::error_code setup_ec;
+
+	// Set up once with the key, and reused
+	EVP_CIPHER_CTX* cipher = nullptr;
+
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+	EVP_MAC* mac = nullptr;
+	EVP_MAC_CTX* mac_ctx = nullptr;
+#else
+	HMAC_CTX* mac_ctx = nullptr;
+#endif
+
+	boost_udp_auth_stats counters;
+
+	// Where views are decrypted to, it only grows
+	std::vector<unsigned char> plain_text;
+
+	// Space for the tag at the end (and the IV for GCM)
+	std::size_t overhead() const {
+		return options.mode == boost_udp_auth_options::hmac_sha256 ? options.tag_size : options.aad_size + iv_size + gcm_tag_size;
+	}
+
+	bool hmac(const unsigned char* data, const std::size_t size, unsigned char (&out)[32]) {
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+		std::size_t n = 0;
+
+		// A null key starts again with the key we already have
+		return EVP_MAC_init(mac_ctx, nullptr, 0, nullptr) == 1
+			&& EVP_MAC_update(mac_ctx, data, size) == 1
+			&& EVP_MAC_final(mac_ctx, out, &n, sizeof(out)) == 1;
+#else
+		unsigned int n = 0;
+
+		return HMAC_Init_ex(mac_ctx, nullptr, 0, nullptr, nullptr) == 1
+			&& HMAC_Update(mac_ctx, data, size) == 1
+			&& HMAC_Final(mac_ctx, out, &n) == 1;
+#endif
+	}
+
+	boost::system::error_code setup() {
+		if (options.mode == boost_udp_auth_options::hmac_sha256) {
+			if (options.tag_size < 1 || options.tag_size > 32)
+				return boost::asio::error::invalid_argument;
+
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+			mac = EVP_MAC_fetch(nullptr, "HMAC", nullptr);
+			mac_ctx = mac ? EVP_MAC_CTX_new(mac) : nullptr;
+
+			char digest[] = "SHA256";
+			const OSSL_PARAM params[] = {
+				OSSL_PARAM_construct_utf8_string(OSSL_MAC_PARAM_DIGEST, digest, 0),
+				OSSL_PARAM_construct_end() };
+
+			if (!mac_ctx || EVP_MAC_init(mac_ctx, options.key.data(), options.key.size(), params) != 1)
+				return boost::asio::error::operation_not_supported;
+#else
+			mac_ctx = HMAC_CTX_new();
+
+			if (!mac_ctx || HMAC_Init_ex(mac_ctx, options.key.data(), static_cast<int>(options.key.size()), EVP_sha256(), nullptr) != 1)
+				return boost::asio::error::operation_not_supported;
+#endif
+			return{};
+		}
+
+		const EVP_CIPHER* aes = options.key.size() == 16 ? EVP_aes_128_gcm() : options.key.size() == 32 ? EVP_aes_256_gcm() : nullptr;
+
+		if (!aes)
+			return boost::asio::error::invalid_argument;
+
+		cipher = EVP_CIPHER_CTX_new();
+
+		// The key is expanded here, once, each datagram
+		// only sets its IV.
+		if (!cipher || EVP_DecryptInit_ex(cipher, aes, nullptr, options.key.data(), nullptr) != 1)
+			return boost::asio::error::operation_not_supported;
+
+		return{};
+	}
+
+	// Check the HMAC on the end, plain is set to
+	// the size of what it covers.
+	bool verify_hmac(const unsigned char* data, const std::size_t size, std::size_t& plain) {
+		plain = size - options.tag_size;
+
+		unsigned char tag[32];
+
+		if (!hmac(data, plain, tag))
+			return false;
+
+		return CRYPTO_memcmp(tag, data + plain, options.tag_size) == 0;
+	}
+
+	// Decrypt to out, which can be where the
+	// cipher text is to decrypt in place.
+	bool decrypt(const unsigned char* data, const std::size_t size, unsigned char* out, std::size_t& plain) {
+		const unsigned char* iv = data + options.aad_size;
+		const unsigned char* text = data + options.aad_size + iv_size;
+		plain = size - overhead();
+
+		// The tag is only read by OpenSSL, it wants it non-const
+		unsigned char tag[gcm_tag_size];
+		std::memcpy(tag, text + plain, gcm_tag_size);
+
+		int n = 0;
+
+		// Tag must be set before the final call
+		return EVP_DecryptInit_ex(cipher, nullptr, nullptr, nullptr, iv) == 1
+			&& (options.aad_size == 0 || EVP_DecryptUpdate(cipher, nullptr, &n, data, static_cast<int>(options.aad_size)) == 1)
+			&& EVP_DecryptUpdate(cipher, out, &n, text, static_cast<int>(plain)) == 1
+			&& EVP_CIPHER_CTX_ctrl(cipher, EVP_CTRL_GCM_SET_TAG, static_cast<int>(gcm_tag_size), tag) == 1
+			&& EVP_DecryptFinal_ex(cipher, out + n, &n) == 1;
+	}
+
+	// Check a datagram and, for GCM, decrypt it to out. Returns
+	// the payload, or an empty view with a null data pointer if
+	// it isn't authentic.
+	datagram_view authenticate(const unsigned char* data, const std::size_t size, const boost::asio::ip::udp::endpoint& sender, unsigned char* out) {
+		if (setup_ec || size < overhead()) {
+			counters.malformed++;
+			return{};
+		}
+
+		std::size_t plain = 0;
+		const unsigned char* payload = data;
+
+		bool authentic = false;
+
+		if (options.mode == boost_udp_auth_options::hmac_sha256) {
+			authentic = verify_hmac(data, size, plain);
+		}
+		else {
+			authentic = decrypt(data, size, out, plain);
+			payload = out;
+		}
+
+		counters.bytes += size;
+
+		if (!authentic) {
+			counters.rejected++;
+			return{};
+		}
+
+		counters.authentic++;
+
+		return datagram_view(payload, plain, sender);
+	}
+
+	// Room to decrypt bytes of views
+	unsigned char* plain_text_for(const std::size_t bytes) {
+		if (options.mode == boost_udp_auth_options::hmac_sha256)
+			return nullptr;
+
+		if (plain_text.size() < bytes)
+			plain_text.resize(bytes);
+
+		return plain_text.data();
+	}
+
+public:
+	boost_udp_authenticator(const boost_udp_auth_options& options, handler_type handler = handler_type())
+		: options(options), handler(std::move(handler)) {
+
+		if (this->options.mode == boost_udp_auth_options::aes_gcm)
+			this->options.tag_size = gcm_tag_size;
+
+		setup_ec = setup();
+	}
+
+	boost_udp_authenticator(const boost_udp_authenticator&) = delete;
+	boost_udp_authenticator& operator=(const boost_udp_authenticator&) = delete;
+
+	~boost_udp_authenticator() {
+		EVP_CIPHER_CTX_free(cipher);
+
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+		EVP_MAC_CTX_free(mac_ctx);
+		EVP_MAC_free(mac);
+#else
+		HMAC_CTX_free(mac_ctx);
+#endif
+
+		// Don't leave the key lying around
+		OPENSSL_cleanse(options.key.data(), options.key.size());
+	}
+
+	//
+	// Why the key couldn't be set up (invalid_argument for
+	// the wrong size key), nothing is authentic if it's set.
+	//
+	const boost::system::error_code& setup_error() const noexcept {
+		return setup_ec;
+	}
+
+	//
+	// Check (and for GCM decrypt in place) a datagram in a buffer
+	// of your own, data is written to. Returns a view of the
+	// payload, the plain text for GCM, or an empty view with a null
+	// data pointer if it isn't authentic.
+	//
+	datagram_view open(unsigned char* data, const std::size_t size, const boost::asio::ip::udp::endpoint& sender = boost::asio::ip::udp::endpoint()) {
+		// The plain text goes where the cipher text is
+		const bool gcm = options.mode == boost_udp_auth_options::aes_gcm && size >= overhead();
+		return authenticate(data, size, sender, gcm ? data + options.aad_size + iv_size : nullptr);
+	}
+
+	//
+	// Hand the datagram's payload to the handler if it's authentic,
+	// returns true if it was. The datagram isn't written to, for GCM
+	// the plain text is valid until the next push() or validate().
+	//
+	bool push(const datagram_view& datagram) {
+		const datagram_view payload = authenticate(datagram.data, datagram.size, datagram.sender, plain_text_for(datagram.size));
+
+		if (!payload.data)
+			return false;
+
+		if (handler)
+			handler(payload);
+
+		return true;
+	}
+
+	//
+	// As above for a datagram in a buffer of your own,
+	// which for GCM is decrypted in place.
+	//
+	bool push(unsigned char* data, const std::size_t size, const boost::asio::ip::udp::endpoint& sender = boost::asio::ip::udp::endpoint()) {
+		const datagram_view payload = open(data, size, sender);
+
+		if (!payload.data)
+			return false;
+
+		if (handler)
+			handler(payload);
+
+		return true;
+	}
+
+	//
+	// Check a batch of datagrams, the payloads of the authentic
+	// ones are moved to the front and their number returned.
+	// The handler isn't called, the datagrams aren't written to
+	// and for GCM the plain text is valid until the next push()
+	// or validate().
+	//
+	std::size_t validate(datagram_view* datagrams, const std::size_t count) {
+		std::size_t bytes = 0;
+
+		for (std::size_t i = 0; i != count; i++)
+			bytes += datagrams[i].size;
+
+		unsigned char* out = plain_text_for(bytes);
+		std::size_t kept = 0;
+
+		for (std::size_t i = 0; i != count; i++) {
+			const datagram_view payload = authenticate(datagrams[i].data, datagrams[i].size, datagrams[i].sender, out);
+
+			if (out)
+				out += datagrams[i].size;
+
+			if (payload.data)
+				datagrams[kept++] = payload;
+		}
+
+		return kept;
+	}
+
+	//
+	// Sign or encrypt a payload the way a sender would, for tests
+	// and replaying. For GCM iv is 12 bytes that must never be
+	// used twice with the same key, and the first aad_size bytes
+	// of the payload are sent in the clear.
+	//
+	std::vector<unsigned char> seal(const void* payload, const std::size_t size, const unsigned char* iv = nullptr) {
+		const unsigned char* p = static_cast<const unsigned char*>(payload);
+		std::vector<unsigned char> out;
+
+		if (setup_ec)
+			return out;
+
+		if (options.mode == boost_udp_auth_options::hmac_sha256) {
+			unsigned char tag[32];
+
+			if (!hmac(p, size, tag))
+				return out;
+
+			out.assign(p, p + size);
+			out.insert(out.end(), tag, tag + options.tag_size);
+			return out;
+		}
+
+		if (!iv || size < options.aad_size)
+			return out;
+
+		const std::size_t text = size - options.aad_size;
+		out.resize(options.aad_size + iv_size + text + gcm_tag_size);
+
+		std::memcpy(out.data(), p, options.aad_size);
+		std::memcpy(out.data() + options.aad_size, iv, iv_size);
+
+		EVP_CIPHER_CTX* encrypt = EVP_CIPHER_CTX_new();
+		const EVP_CIPHER* aes = options.key.size() == 16 ? EVP_aes_128_gcm() : EVP_aes_256_gcm();
+		unsigned char* cipher_text = out.data() + options.aad_size + iv_size;
+		int n = 0;
+
+		const bool ok = encrypt
+			&& EVP_EncryptInit_ex(encrypt, aes, nullptr, options.key.data(), iv) == 1
+			&& (options.aad_size == 0 || EVP_EncryptUpdate(encrypt, nullptr, &n, p, static_cast<int>(options.aad_size)) == 1)
+			&& EVP_EncryptUpdate(encrypt, cipher_text, &n, p + options.aad_size, static_cast<int>(text)) == 1
+			&& EVP_EncryptFinal_ex(encrypt, cipher_text + n, &n) == 1
+			&& EVP_CIPHER_CTX_ctrl(encrypt, EVP_CTRL_GCM_GET_TAG, static_cast<int>(gcm_tag_size), cipher_text + text) == 1;
+
+		EVP_CIPHER_CTX_free(encrypt);
+
+		if (!ok)
+			out.clear();
+
+		return out;
+	}
+
+	boost_udp_auth_stats stats() const noexcept {
+		return counters;
+	}
+};
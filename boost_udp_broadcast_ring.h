@@ -0,0 +1,588 @@
+#pragma once
+
+//   Copyright 2022 Kevin Godden
+//
+//   Licensed under the Apache License, Version 2.0 (the "License");
+//   you may not use this file except in compliance with the License.
+//   You may obtain a copy of the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+//   Unless required by applicable law or agreed to in writing, software
+//   distributed under the License is distributed on an "AS IS" BASIS,
+//   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//   See the License for the specific language governing permissions and
+//   limitations under the License.
+
+#include "boost_udp_datagram_ring.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+//
+// Hands every datagram received to several consumers (a logger, a strategy,
+// a monitor...) without copying it for each of them. There's one producer
+// and a ring of slots, each consumer has its own cursor into the ring and
+// reads the slots in place, in the style of the LMAX Disruptor.
+//
+// The producer can receive from a boost_udp_receive_rar straight into the
+// next slot with receive(), so a datagram is written once, by the kernel,
+// and never copied again.
+//
+// What happens when the slowest consumer is a whole ring behind is up to
+// the overflow policy:
+//
+//   block       - the producer waits for it (nothing is lost, but the
+//                 socket backs up behind the slow consumer), the default.
+//   drop_newest - new datagrams are dropped (and counted) until there's
+//                 room, every consumer misses them.
+//   drop_oldest - the producer carries on regardless, the slow consumer
+//                 skips what it missed and counts it as lost, everyone
+//                 else is unaffected.
+//   conflate    - new datagrams are held back by the producer until
+//                 there's room, only the newest for each key.
+//
+// With drop_oldest a slot can be written while a slow consumer is reading
+// it, release() tells the consumer if that happened so that it can throw
+// away whatever it made of the datagram.
+//
+// receive(), publish() and flush() must only be called from one thread,
+// each consumer must only be used from one thread. With conflate call
+// flush() whenever the socket is drained.
+//
+// Synopsis:
+//
+/*
+	boost_udp_broadcast_options options;
+	options.overflow.policy = boost_udp_overflow_options::drop_oldest;
+
+	boost_udp_broadcast_ring ring(options);
+
+	// Consumer threads
+	auto consumer = ring.join();
+	datagram_view datagram;
+
+	if (consumer.next(datagram)) {
+		process(datagram);
+
+		if (!consumer.release())
+			; // overwritten while we looked at it
+	}
+
+	// Producer thread
+	boost::system::error_code ec;
+
+	while (rar.wait(100, ec)) {
+		do
+			ring.receive(rar, ec);
+		while (!ec);
+	}
+*/
+
+struct boost_udp_broadcast_options {
+	// Slots in the ring (rounded up to a power of two),
+	// and the biggest datagram a slot can hold.
+	std::size_t capacity = 1024;
+	std::size_t slot_size = 2048;
+
+	// How the slots' memory is allocated
+	boost_udp_buffer_memory memory;
+
+	// What to do when the slowest consumer is a whole ring behind
+	boost_udp_overflow_options overflow;
+
+	// Consumers that can be joined at once
+	std::size_t max_consumers = 16;
+
+	boost_udp_broadcast_options() {
+		overflow.policy = boost_udp_overflow_options::block;
+	}
+};
+
+struct boost_udp_broadcast_stats {
+	// Datagrams put in the ring, dropped because a consumer
+	// was a whole ring behind, or too big for a slot.
+	uint64_t published = 0;
+	uint64_t dropped = 0;
+	uint64_t oversize = 0;
+
+	// Times the producer had to wait for a consumer
+	uint64_t blocked = 0;
+
+	// Held back datagrams replaced by newer ones with the
+	// same key, and how many are held back now (conflate).
+	uint64_t conflated = 0;
+	std::size_t held = 0;
+
+	struct consumer {
+		uint64_t consumed = 0;
+
+		// Datagrams overwritten before this consumer got to them
+		uint64_t lost = 0;
+
+		// How far behind the producer it is
+		uint64_t lag = 0;
+	};
+
+	// The consumers joined now
+	std::vector<consumer> consumers;
+};
+
+class boost_udp_broadcast_ring {
+	struct slot {
+		// The sequence number + 1 of the datagram
+		// in the slot, 0 while it's being written.
+		std::atomic<uint64_t> sequence{ 0 };
+
+		unsigned char* data = nullptr;
+		std::size_t size = 0;
+		boost::asio::ip::udp::endpoint sender;
+	};
+
+	// One per consumer, on a cache line of its own
+	struct alignas(64) cursor {
+		// The next sequence number the consumer will read
+		std::atomic<uint64_t> next{ 0 };
+		std::atomic<bool> active{ false };
+
+		std::atomic<uint64_t> consumed{ 0 };
+		std::atomic<uint64_t> lost{ 0 };
+	};
+
+	boost_udp_broadcast_options options;
+
+	std::shared_ptr<boost_udp_buffer_pool> pool;
+	std::unique_ptr<slot[]> slots;
+	std::size_t count = 0;
+	std::size_t mask = 0;
+
+	std::unique_ptr<cursor[]> cursors;
+	std::mutex join_mutex;
+
+	// Sequence number of the next datagram, everything
+	// before it has been published.
+	alignas(64) std::atomic<uint64_t> published{ 0 };
+
+	// Producer side counters
+	std::atomic<uint64_t> dropped{ 0 };
+	std::atomic<uint64_t> oversize{ 0 };
+	std::atomic<uint64_t> blocked{ 0 };
+	std::atomic<uint64_t> conflated{ 0 };
+	std::atomic<std::size_t> held_count{ 0 };
+
+	// Held back by the conflate policy
+	std::unique_ptr<boost_udp_held_datagrams> held;
+
+	static std::size_t round_up_power_of_two(std::size_t n) {
+		std::size_t p = 1;
+
+		while (p < n)
+			p <<= 1;
+
+		return p;
+	}
+
+	// The oldest sequence number a consumer still wants
+	uint64_t slowest() const noexcept {
+		uint64_t oldest = published.load(std::memory_order_relaxed);
+
+		for (std::size_t i = 0; i != options.max_consumers; i++) {
+			if (cursors[i].active.load(std::memory_order_acquire))
+				oldest = std::min(oldest, cursors[i].next.load(std::memory_order_acquire));
+		}
+
+		return oldest;
+	}
+
+	// Can sequence s go in the ring? Waits for
+	// room if the policy is to block.
+	bool claim(const uint64_t s) noexcept {
+		if (!count)
+			return false;
+
+		if (options.overflow.policy == boost_udp_overflow_options::drop_oldest || s - slowest() < count)
+			return true;
+
+		if (options.overflow.policy != boost_udp_overflow_options::block)
+			return false;
+
+		blocked.fetch_add(1, std::memory_order_relaxed);
+		boost_udp_backoff backoff;
+
+		while (s - slowest() >= count)
+			backoff.pause();
+
+		return true;
+	}
+
+	// Mark a slot as being written, any consumer still reading it
+	// will find out when it releases it. Returns what the slot held.
+	uint64_t begin_write(slot& sl) noexcept {
+		const uint64_t previous = sl.sequence.load(std::memory_order_relaxed);
+
+		sl.sequence.store(0, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+
+		return previous;
+	}
+
+	void end_write(slot& sl, const uint64_t s) noexcept {
+		sl.sequence.store(s + 1, std::memory_order_release);
+		published.store(s + 1, std::memory_order_release);
+	}
+
+	// Copy a datagram into the next slot, false if there's no room
+	bool copy_in(const datagram_view& datagram) noexcept {
+		const uint64_t s = published.load(std::memory_order_relaxed);
+
+		if (!claim(s))
+			return false;
+
+		slot& sl = slots[s & mask];
+		begin_write(sl);
+
+		std::memcpy(sl.data, datagram.data, datagram.size);
+		sl.size = datagram.size;
+		sl.sender = datagram.sender;
+
+		end_write(sl, s);
+
+		return true;
+	}
+
+	// Hold a datagram back (conflate), false if it had to be
+	// dropped, or drop it for the other policies.
+	bool hold_or_drop(const datagram_view& datagram) {
+		if (held) {
+			switch (held->hold(options.overflow.key(datagram), datagram)) {
+			case boost_udp_held_datagrams::held:
+				held_count.store(held->size(), std::memory_order_relaxed);
+				return true;
+
+			case boost_udp_held_datagrams::replaced:
+				conflated.fetch_add(1, std::memory_order_relaxed);
+				return true;
+
+			case boost_udp_held_datagrams::full:
+				break;
+			}
+		}
+
+		dropped.fetch_add(1, std::memory_order_relaxed);
+
+		return false;
+	}
+
+	// Anything held back has to go first, false
+	// if there's still some left.
+	bool flush_held() {
+		if (!held)
+			return true;
+
+		while (!held->empty() && copy_in(held->front()))
+			held->pop();
+
+		held_count.store(held->size(), std::memory_order_relaxed);
+
+		return held->empty();
+	}
+
+public:
+	//
+	// A consumer's view of the ring, from join(). Move only, leaves
+	// the ring when destroyed.
+	//
+	class consumer {
+		friend class boost_udp_broadcast_ring;
+
+		boost_udp_broadcast_ring* ring = nullptr;
+		cursor* position = nullptr;
+
+		// The sequence number being read, between
+		// next() and release().
+		uint64_t held = 0;
+
+		consumer(boost_udp_broadcast_ring* ring, cursor* position)
+			: ring(ring), position(position) {
+		}
+
+		void skip(const uint64_t to, const uint64_t missed) noexcept {
+			position->lost.fetch_add(missed, std::memory_order_relaxed);
+			position->next.store(to, std::memory_order_release);
+		}
+
+	public:
+		consumer() = default;
+
+		consumer(consumer&& other) noexcept
+			: ring(other.ring), position(other.position), held(other.held) {
+			other.position = nullptr;
+		}
+
+		consumer& operator=(consumer&& other) noexcept {
+			if (this != &other) {
+				leave();
+				ring = other.ring;
+				position = other.position;
+				held = other.held;
+				other.position = nullptr;
+			}
+
+			return *this;
+		}
+
+		~consumer() {
+			leave();
+		}
+
+		//
+		// False if the ring already had max_consumers
+		//
+		bool joined() const noexcept {
+			return position != nullptr;
+		}
+
+		//
+		// Look at the next datagram in place, false if there isn't one
+		// yet. The view is valid until release(), which must be called
+		// before the next call to next().
+		//
+		bool next(datagram_view& datagram) noexcept {
+			if (!position)
+				return false;
+
+			for (;;) {
+				uint64_t n = position->next.load(std::memory_order_relaxed);
+				const uint64_t p = ring->published.load(std::memory_order_acquire);
+
+				if (n == p)
+					return false;
+
+				// Lapped, jump to the oldest datagram still there
+				if (p - n > ring->count) {
+					skip(p - ring->count, p - ring->count - n);
+					n = p - ring->count;
+				}
+
+				const slot& sl = ring->slots[n & ring->mask];
+
+				// Overwritten, or being overwritten, since we looked
+				if (sl.sequence.load(std::memory_order_acquire) != n + 1) {
+					skip(n + 1, 1);
+					continue;
+				}
+
+				datagram = datagram_view(sl.data, sl.size, sl.sender);
+				held = n;
+
+				return true;
+			}
+		}
+
+		//
+		// Done with the datagram from next(). Returns false if it was
+		// overwritten while we had it (only with drop_oldest),
+		// anything made of it should be thrown away.
+		//
+		bool release() noexcept {
+			if (!position)
+				return false;
+
+			const slot& sl = ring->slots[held & ring->mask];
+
+			std::atomic_thread_fence(std::memory_order_acquire);
+			const bool intact = sl.sequence.load(std::memory_order_relaxed) == held + 1;
+
+			if (intact)
+				position->consumed.fetch_add(1, std::memory_order_relaxed);
+			else
+				position->lost.fetch_add(1, std::memory_order_relaxed);
+
+			position->next.store(held + 1, std::memory_order_release);
+
+			return intact;
+		}
+
+		//
+		// Datagrams this consumer has missed
+		//
+		uint64_t lost() const noexcept {
+			return position ? position->lost.load(std::memory_order_relaxed) : 0;
+		}
+
+		//
+		// Stop consuming, the producer no longer waits for us
+		//
+		void leave() noexcept {
+			if (position) {
+				position->active.store(false, std::memory_order_release);
+				position = nullptr;
+			}
+		}
+	};
+
+	//
+	// If there's not enough memory for the slots,
+	// every publish and receive fails.
+	//
+	explicit boost_udp_broadcast_ring(const boost_udp_broadcast_options& options = boost_udp_broadcast_options())
+		: options(options) {
+
+		if (options.overflow.policy == boost_udp_overflow_options::conflate) {
+			held.reset(new boost_udp_held_datagrams(options.overflow.max_held));
+
+			if (!this->options.overflow.key)
+				this->options.overflow.key = boost_udp_sender_key;
+		}
+
+		const std::size_t n = round_up_power_of_two(options.capacity ? options.capacity : 1);
+
+		cursors.reset(new cursor[options.max_consumers]);
+		slots.reset(new slot[n]);
+		pool = std::make_shared<boost_udp_buffer_pool>(options.slot_size, n, options.memory);
+
+		for (std::size_t i = 0; i != n; i++) {
+			slots[i].data = pool->acquire();
+
+			if (!slots[i].data)
+				return;
+		}
+
+		count = n;
+		mask = n - 1;
+	}
+
+	boost_udp_broadcast_ring(const boost_udp_broadcast_ring&) = delete;
+	boost_udp_broadcast_ring& operator=(const boost_udp_broadcast_ring&) = delete;
+
+	//
+	// Start consuming, from the next datagram published. Check
+	// joined() on what comes back, there's a limit on consumers.
+	//
+	consumer join() {
+		std::lock_guard<std::mutex> lock(join_mutex);
+
+		for (std::size_t i = 0; i != options.max_consumers; i++) {
+			cursor& c = cursors[i];
+
+			if (c.active.load(std::memory_order_acquire))
+				continue;
+
+			c.next.store(published.load(std::memory_order_acquire), std::memory_order_relaxed);
+			c.consumed.store(0, std::memory_order_relaxed);
+			c.lost.store(0, std::memory_order_relaxed);
+			c.active.store(true, std::memory_order_release);
+
+			return consumer(this, &c);
+		}
+
+		return consumer();
+	}
+
+	//
+	// Copy a datagram into the ring, producer thread only. Returns
+	// false if it was dropped (too big, or by the overflow policy).
+	//
+	bool publish(const datagram_view& datagram) {
+		if (datagram.size > pool->size()) {
+			oversize.fetch_add(1, std::memory_order_relaxed);
+			return false;
+		}
+
+		if (flush_held() && copy_in(datagram))
+			return true;
+
+		return hold_or_drop(datagram);
+	}
+
+	//
+	// Receive a datagram from the socket straight into the next slot,
+	// producer thread only, never blocks on the socket. ec is
+	// boost::asio::error::would_block once there's nothing waiting.
+	// Returns false if nothing was published, including when the
+	// datagram was too big for a slot, dropped or held back (it's
+	// still taken off the socket).
+	//
+	bool receive(boost_udp_receive_rar& rar, boost::system::error_code& ec) {
+		const bool room = flush_held() && claim(published.load(std::memory_order_relaxed));
+		const uint64_t s = published.load(std::memory_order_relaxed);
+
+		if (!room) {
+			const datagram_view datagram = rar.try_receive_view(ec);
+
+			if (!ec)
+				hold_or_drop(datagram);
+
+			return false;
+		}
+
+		slot& sl = slots[s & mask];
+		const uint64_t previous = begin_write(sl);
+
+		const std::size_t size = rar.try_receive_into(sl.data, pool->size(), sl.sender, ec);
+
+		if (ec) {
+			// Nothing written, the slot still holds what it did
+			sl.sequence.store(previous, std::memory_order_release);
+			return false;
+		}
+
+		// Too big for a slot, what did fit has overwritten the slot
+		// so it stays marked as empty and nothing is published.
+		if (size > pool->size()) {
+			oversize.fetch_add(1, std::memory_order_relaxed);
+			return false;
+		}
+
+		sl.size = size;
+		end_write(sl, s);
+
+		return true;
+	}
+
+	//
+	// Move anything held back by the conflate policy
+	// into the ring while there's room.
+	//
+	void flush() {
+		flush_held();
+	}
+
+	std::size_t capacity() const noexcept {
+		return count;
+	}
+
+	//
+	// Counters, safe to call from any thread
+	//
+	boost_udp_broadcast_stats stats() const {
+		boost_udp_broadcast_stats out;
+		out.published = published.load(std::memory_order_acquire);
+		out.dropped = dropped.load(std::memory_order_relaxed);
+		out.oversize = oversize.load(std::memory_order_relaxed);
+		out.blocked = blocked.load(std::memory_order_relaxed);
+		out.conflated = conflated.load(std::memory_order_relaxed);
+		out.held = held_count.load(std::memory_order_relaxed);
+
+		for (std::size_t i = 0; i != options.max_consumers; i++) {
+			const cursor& c = cursors[i];
+
+			if (!c.active.load(std::memory_order_acquire))
+				continue;
+
+			boost_udp_broadcast_stats::consumer cs;
+			cs.consumed = c.consumed.load(std::memory_order_relaxed);
+			cs.lost = c.lost.load(std::memory_order_relaxed);
+			cs.lag = out.published - std::min(out.published, c.next.load(std::memory_order_acquire));
+
+			out.consumers.push_back(cs);
+		}
+
+		return out;
+	}
+};
@@ -0,0 +1,417 @@
+#pragma once
+
+//   Copyright 2022 Kevin Godden
+//
+//   Licensed under the Apache License, Version 2.0 (the "License");
+//   you may not use this file except in compliance with the License.
+//   You may obtain a copy of the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+//   Unless required by applicable law or agreed to in writing, software
+//   distributed under the License is distributed on an "AS IS" BASIS,
+//   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//   See the License for the specific language governing permissions and
+//   limitations under the License.
+
+#include <cstddef>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <string>
+#include <vector>
+
+#ifdef __linux__
+#include <linux/mempolicy.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+//
+// A simple pool of fixed size receive buffers. Memory is grabbed from
+// the system a chunk (lots of buffers) at a time and never given back
+// until the pool goes away, buffers released by one receiver are handed
+// out again to the next one that asks.
+//
+// Receivers that are given a shared pool (see boost_udp_receive_rar_options)
+// take their buffers from it, otherwise each receiver makes a little
+// private pool for itself.
+//
+// acquire() and release() are thread safe, they are only called when
+// a receiver sets up or goes away, never per datagram.
+//
+// On Linux the pool's memory can be backed by 2MB huge pages, pre-faulted
+// and locked into RAM (see boost_udp_buffer_memory) so that the first
+// datagrams don't pay for page faults and TLB misses. Anything that can't
+// be done (no huge pages reserved, mlock limit too low...) is quietly
+// skipped, placement() tells you what you actually got.
+//
+// The memory can also be put on a particular NUMA node, for instance the
+// node of the CPU that first receives into the pool (use lazy_buffers so
+// that's the receive thread) or the node the network card hangs off.
+//
+// Synopsis:
+//
+/*
+	auto pool = std::make_shared<boost_udp_buffer_pool>();
+
+	// Or, to have the pool's memory backed by huge pages,
+	// touched up front and locked into RAM:
+	//
+	// boost_udp_buffer_memory memory;
+	// memory.huge_pages = memory.prefault = memory.lock = true;
+	//
+	// auto pool = std::make_shared<boost_udp_buffer_pool>(boost_udp_buffer_pool::max_datagram_size, 64, memory);
+	// pool->reserve();
+
+	boost_udp_receive_rar_options options;
+	options.pool = pool;
+	options.lazy_buffers = true;
+
+	// No buffers are taken from the pool until the
+	// first receive on each port.
+	boost_udp_receive_rar a("127.0.0.1", 8861, options);
+	boost_udp_receive_rar b("127.0.0.1", 8862, options);
+*/
+
+//
+// How the memory behind a pool should be set up
+//
+struct boost_udp_buffer_memory {
+	// Back the buffers with 2MB huge pages, MAP_HUGETLB if there are
+	// huge pages reserved, otherwise transparent huge pages. Chunks
+	// are rounded up to a whole number of huge pages.
+	bool huge_pages = false;
+
+	// Touch every page up front so the hot path never faults
+	bool prefault = false;
+
+	// mlock() the memory so it can't be swapped out
+	bool lock = false;
+
+	enum : int {
+		// Let the kernel decide
+		no_numa_node = -1,
+
+		// The node of the CPU the memory is allocated from
+		local_numa_node = -2
+	};
+
+	// The NUMA node the memory should live on, a node number or
+	// one of the above.
+	int numa_node = no_numa_node;
+
+	// If set, and the kernel knows which node this network
+	// interface (e.g. "eth0") is attached to, use that node
+	// instead of numa_node.
+	std::string numa_interface;
+
+	bool any() const {
+		return huge_pages || prefault || lock || numa_node != no_numa_node || !numa_interface.empty();
+	}
+};
+
+//
+// What a pool's memory actually ended up as, each flag is
+// only set if it's true for all of the pool's memory.
+//
+struct boost_udp_buffer_placement {
+	bool huge_pages = false;
+	bool transparent_huge_pages = false;
+	bool prefaulted = false;
+	bool locked = false;
+
+	// The NUMA node the memory is bound to, or -1 if
+	// it wasn't bound (or the chunks disagree).
+	int numa_node = -1;
+};
+
+#ifdef __linux__
+//
+// The NUMA node of the CPU the calling thread is running on,
+// or -1 if it can't be found.
+//
+inline int boost_udp_current_numa_node() {
+	unsigned cpu = 0, node = 0;
+
+	if (syscall(SYS_getcpu, &cpu, &node, nullptr) != 0)
+		return -1;
+
+	return static_cast<int>(node);
+}
+
+//
+// The NUMA node a network interface is attached to, or -1
+// if there isn't one (loopback, virtual interfaces, single
+// node machines...)
+//
+inline int boost_udp_interface_numa_node(const std::string& interface_name) {
+	std::ifstream in("/sys/class/net/" + interface_name + "/device/numa_node");
+	int node = -1;
+
+	if (!(in >> node))
+		return -1;
+
+	return node;
+}
+#endif
+
+class boost_udp_buffer_pool {
+	// Size of each buffer handed out
+	std::size_t block_size;
+
+	// How many buffers to allocate at a time
+	std::size_t chunk_blocks;
+
+	boost_udp_buffer_memory memory;
+
+	// A lump of memory the buffers are carved from, either
+	// from new[] or mmap() depending on the memory options.
+	struct chunk {
+		unsigned char* data = nullptr;
+		std::size_t length = 0;
+		bool mapped = false;
+		boost_udp_buffer_placement placement;
+
+		chunk() = default;
+		chunk(const chunk&) = delete;
+		chunk& operator=(const chunk&) = delete;
+
+		~chunk() {
+#ifdef __linux__
+			if (mapped) {
+				munmap(data, length);
+				return;
+			}
+#endif
+			delete[] data;
+		}
+	};
+
+	// All the memory we've grabbed, and the
+	// buffers in it nobody is using.
+	std::vector<std::unique_ptr<chunk>> chunks;
+	std::vector<unsigned char*> free_blocks;
+
+	std::size_t total_blocks = 0;
+
+	std::mutex mutex;
+
+	static const std::size_t huge_page_size = 2 * 1024 * 1024;
+
+	// Allocate a chunk the plain way. Deliberately not value
+	// initialised, there's no point zeroing memory we're about
+	// to receive into.
+	static bool allocate(chunk& c, const std::size_t length) {
+		c.data = new (std::nothrow) unsigned char[length];
+		c.length = length;
+
+		return c.data;
+	}
+
+	// Allocate a chunk with mmap(), honouring the memory options
+	// as far as the system lets us.
+	bool map(chunk& c, std::size_t length) {
+#ifdef __linux__
+		if (memory.huge_pages)
+			length = (length + huge_page_size - 1) / huge_page_size * huge_page_size;
+
+		const int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+		void* p = MAP_FAILED;
+
+		// Explicit huge pages first, these only work if
+		// some have been reserved (vm.nr_hugepages)
+		if (memory.huge_pages) {
+			p = mmap(nullptr, length, PROT_READ | PROT_WRITE, flags | MAP_HUGETLB, -1, 0);
+			c.placement.huge_pages = p != MAP_FAILED;
+		}
+
+		if (p == MAP_FAILED) {
+			p = mmap(nullptr, length, PROT_READ | PROT_WRITE, flags, -1, 0);
+
+			if (p == MAP_FAILED)
+				return false;
+
+			// Ask for transparent huge pages instead
+			if (memory.huge_pages)
+				c.placement.transparent_huge_pages = madvise(p, length, MADV_HUGEPAGE) == 0;
+		}
+
+		c.data = static_cast<unsigned char*>(p);
+		c.length = length;
+		c.mapped = true;
+
+		// Has to happen before the pages are touched
+		bind_to_node(c);
+
+		// Write to every page so they're all really there,
+		// a read would just map the shared zero page.
+		if (memory.prefault) {
+			for (std::size_t offset = 0; offset < length; offset += 4096)
+				c.data[offset] = 0;
+
+			c.placement.prefaulted = true;
+		}
+
+		if (memory.lock)
+			c.placement.locked = mlock(c.data, length) == 0;
+
+		return true;
+#else
+		return allocate(c, length);
+#endif
+	}
+
+#ifdef __linux__
+	// Work out which NUMA node (if any) the memory
+	// options ask for.
+	int wanted_numa_node() const {
+		if (!memory.numa_interface.empty()) {
+			const int node = boost_udp_interface_numa_node(memory.numa_interface);
+
+			if (node >= 0)
+				return node;
+		}
+
+		if (memory.numa_node == boost_udp_buffer_memory::local_numa_node)
+			return boost_udp_current_numa_node();
+
+		return memory.numa_node;
+	}
+
+	// Prefer the wanted node for the chunk's pages, we don't
+	// use a strict bind so that a full node doesn't mean
+	// a failed receive.
+	void bind_to_node(chunk& c) {
+		const int node = wanted_numa_node();
+
+		if (node < 0 || node >= static_cast<int>(8 * sizeof(unsigned long)))
+			return;
+
+		const unsigned long mask = 1ul << node;
+
+		if (syscall(SYS_mbind, c.data, c.length, MPOL_PREFERRED, &mask, 8 * sizeof(mask), 0) == 0)
+			c.placement.numa_node = node;
+	}
+#endif
+
+	// Grab another chunk and add its buffers to the free
+	// list, returns false if we're out of memory.
+	bool grow() {
+		std::unique_ptr<chunk> c(new (std::nothrow) chunk);
+
+		if (!c)
+			return false;
+
+		const bool ok = memory.any() ? map(*c, block_size * chunk_blocks) : allocate(*c, block_size * chunk_blocks);
+
+		if (!ok)
+			return false;
+
+		// Rounding up to huge pages may have
+		// left room for more buffers.
+		const std::size_t blocks = c->length / block_size;
+
+		for (std::size_t i = 0; i != blocks; i++)
+			free_blocks.push_back(c->data + i * block_size);
+
+		chunks.push_back(std::move(c));
+		total_blocks += blocks;
+
+		return true;
+	}
+
+public:
+	// The largest UDP datagram is just under 64KB
+	static const std::size_t max_datagram_size = 65536;
+
+	explicit boost_udp_buffer_pool(const std::size_t block_size = max_datagram_size, const std::size_t chunk_blocks = 64,
+		const boost_udp_buffer_memory& memory = boost_udp_buffer_memory())
+		: block_size(block_size), chunk_blocks(chunk_blocks ? chunk_blocks : 1), memory(memory) {
+	}
+
+	boost_udp_buffer_pool(const boost_udp_buffer_pool&) = delete;
+	boost_udp_buffer_pool& operator=(const boost_udp_buffer_pool&) = delete;
+
+	//
+	// Allocate the first chunk now rather than on the first
+	// acquire(), so that any pre-faulting and locking is done
+	// before the traffic starts.
+	//
+	bool reserve() noexcept {
+		std::lock_guard<std::mutex> lock(mutex);
+		return !chunks.empty() || grow();
+	}
+
+	//
+	// Take a buffer of block_size() bytes from the pool,
+	// returns nullptr if no memory could be found.
+	//
+	unsigned char* acquire() noexcept {
+		std::lock_guard<std::mutex> lock(mutex);
+
+		if (free_blocks.empty() && !grow())
+			return nullptr;
+
+		unsigned char* block = free_blocks.back();
+		free_blocks.pop_back();
+
+		return block;
+	}
+
+	//
+	// Give a buffer back to the pool
+	//
+	void release(unsigned char* block) noexcept {
+		if (!block)
+			return;
+
+		std::lock_guard<std::mutex> lock(mutex);
+		free_blocks.push_back(block);
+	}
+
+	std::size_t size() const noexcept {
+		return block_size;
+	}
+
+	// How many buffers the pool has allocated,
+	// and how many of those are handed out.
+	std::size_t allocated() {
+		std::lock_guard<std::mutex> lock(mutex);
+		return total_blocks;
+	}
+
+	std::size_t in_use() {
+		std::lock_guard<std::mutex> lock(mutex);
+		return total_blocks - free_blocks.size();
+	}
+
+	//
+	// What the memory options actually got us
+	//
+	boost_udp_buffer_placement placement() {
+		std::lock_guard<std::mutex> lock(mutex);
+
+		boost_udp_buffer_placement all;
+
+		if (chunks.empty())
+			return all;
+
+		all.huge_pages = all.transparent_huge_pages = all.prefaulted = all.locked = true;
+		all.numa_node = chunks.front()->placement.numa_node;
+
+		for (const auto& c : chunks) {
+			if (c->placement.numa_node != all.numa_node)
+				all.numa_node = -1;
+
+			all.huge_pages = all.huge_pages && c->placement.huge_pages;
+			all.transparent_huge_pages = all.transparent_huge_pages && c->placement.transparent_huge_pages;
+			all.prefaulted = all.prefaulted && c->placement.prefaulted;
+			all.locked = all.locked && c->placement.locked;
+		}
+
+		return all;
+	}
+};
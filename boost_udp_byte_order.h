@@ -0,0 +1,349 @@
+#pragma once
+
+//   Copyright 2022 Kevin Godden
+//
+//   Licensed under the Apache License, Version 2.0 (the "License");
+//   you may not use this file except in compliance with the License.
+//   You may obtain a copy of the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+//   Unless required by applicable law or agreed to in writing, software
+//   distributed under the License is distributed on an "AS IS" BASIS,
+//   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//   See the License for the specific language governing permissions and
+//   limitations under the License.
+
+#include "boost_udp_receive_rar.h"
+
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+#ifdef _MSC_VER
+#include <stdlib.h>
+#endif
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#define BOOST_UDP_X86_SIMD
+#include <immintrin.h>
+#endif
+
+//
+// Byte order helpers: reading big or little endian integers out of a
+// datagram, and converting whole arrays of big endian samples (e.g. a
+// telemetry datagram of 16, 32 or 64 bit values) to host order.
+//
+// The array conversion uses AVX2 or SSSE3 byte shuffles when the CPU has
+// them, picked at run time so that the same binary runs anywhere, and a
+// byte swap a sample at a time otherwise. boost_udp_receive_samples()
+// receives a datagram and converts it straight out of the receive buffer
+// into the caller's array, the conversion is the copy.
+//
+// Synopsis:
+//
+/*
+	uint32_t samples[1024];
+	boost::system::error_code ec;
+
+	const std::size_t n = boost_udp_receive_samples(rar, samples, 1024, ec);
+*/
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#define BOOST_UDP_BIG_ENDIAN_HOST 1
+#else
+#define BOOST_UDP_BIG_ENDIAN_HOST 0
+#endif
+
+inline uint16_t boost_udp_byte_swap(const uint16_t v) noexcept {
+#if defined(_MSC_VER)
+	return _byteswap_ushort(v);
+#else
+	return __builtin_bswap16(v);
+#endif
+}
+
+inline uint32_t boost_udp_byte_swap(const uint32_t v) noexcept {
+#if defined(_MSC_VER)
+	return _byteswap_ulong(v);
+#else
+	return __builtin_bswap32(v);
+#endif
+}
+
+inline uint64_t boost_udp_byte_swap(const uint64_t v) noexcept {
+#if defined(_MSC_VER)
+	return _byteswap_uint64(v);
+#else
+	return __builtin_bswap64(v);
+#endif
+}
+
+// The power of two sizes are a load and (if the
+// order differs from the host's) a byte swap.
+template <bool BigEndian, typename Uint>
+inline uint64_t boost_udp_load_uint(const unsigned char* p) noexcept {
+	Uint value;
+	std::memcpy(&value, p, sizeof(value));
+
+	return BigEndian != BOOST_UDP_BIG_ENDIAN_HOST ? boost_udp_byte_swap(value) : value;
+}
+
+template <bool BigEndian>
+inline uint64_t boost_udp_read_uint(const unsigned char* p, std::integral_constant<std::size_t, 1>) noexcept {
+	return p[0];
+}
+
+template <bool BigEndian>
+inline uint64_t boost_udp_read_uint(const unsigned char* p, std::integral_constant<std::size_t, 2>) noexcept {
+	return boost_udp_load_uint<BigEndian, uint16_t>(p);
+}
+
+template <bool BigEndian>
+inline uint64_t boost_udp_read_uint(const unsigned char* p, std::integral_constant<std::size_t, 4>) noexcept {
+	return boost_udp_load_uint<BigEndian, uint32_t>(p);
+}
+
+template <bool BigEndian>
+inline uint64_t boost_udp_read_uint(const unsigned char* p, std::integral_constant<std::size_t, 8>) noexcept {
+	return boost_udp_load_uint<BigEndian, uint64_t>(p);
+}
+
+// The odd sizes a byte at a time, the loop is
+// unrolled as Size is known at compile time.
+template <bool BigEndian, std::size_t Size>
+inline uint64_t boost_udp_read_uint(const unsigned char* p, std::integral_constant<std::size_t, Size>) noexcept {
+	uint64_t value = 0;
+
+	for (std::size_t i = 0; i != Size; i++) {
+		const std::size_t byte = BigEndian ? i : Size - 1 - i;
+		value = (value << 8) | p[byte];
+	}
+
+	return value;
+}
+
+//
+// Read a Size byte unsigned integer
+//
+template <std::size_t Size, bool BigEndian>
+inline uint64_t boost_udp_read_uint(const unsigned char* p) noexcept {
+	static_assert(Size >= 1 && Size <= 8, "integers are 1 to 8 bytes");
+
+	return boost_udp_read_uint<BigEndian>(p, std::integral_constant<std::size_t, Size>());
+}
+
+//
+// The ways an array of samples can be converted, best
+// is the fastest the CPU we're running on has.
+//
+enum class boost_udp_simd {
+	best,
+	scalar,
+	ssse3,
+	avx2
+};
+
+inline bool boost_udp_simd_supported(const boost_udp_simd simd) noexcept {
+	switch (simd) {
+	case boost_udp_simd::best:
+	case boost_udp_simd::scalar:
+		return true;
+#ifdef BOOST_UDP_X86_SIMD
+	case boost_udp_simd::ssse3:
+		return __builtin_cpu_supports("ssse3");
+	case boost_udp_simd::avx2:
+		return __builtin_cpu_supports("avx2");
+#endif
+	default:
+		return false;
+	}
+}
+
+// Swap each Uint in place a sample at a time, for
+// the odd ones left over after the vector loops too.
+template <typename Uint>
+inline void boost_udp_swap_scalar(unsigned char* dst, const unsigned char* src, const std::size_t count) noexcept {
+	for (std::size_t i = 0; i != count; i++) {
+		Uint value;
+		std::memcpy(&value, src + i * sizeof(Uint), sizeof(value));
+		value = boost_udp_byte_swap(value);
+		std::memcpy(dst + i * sizeof(Uint), &value, sizeof(value));
+	}
+}
+
+inline void boost_udp_swap_scalar(unsigned char* dst, const unsigned char* src, const std::size_t count, const std::size_t width) noexcept {
+	switch (width) {
+	case 2:
+		boost_udp_swap_scalar<uint16_t>(dst, src, count);
+		break;
+	case 4:
+		boost_udp_swap_scalar<uint32_t>(dst, src, count);
+		break;
+	case 8:
+		boost_udp_swap_scalar<uint64_t>(dst, src, count);
+		break;
+	default:
+		std::memmove(dst, src, count * width);
+		break;
+	}
+}
+
+#ifdef BOOST_UDP_X86_SIMD
+// The shuffle that reverses the bytes of each sample in a 16 byte lane
+inline const char* boost_udp_swap_shuffle(const std::size_t width) noexcept {
+	static const char shuffles[3][16] = {
+		{ 1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14 },
+		{ 3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12 },
+		{ 7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8 } };
+
+	return shuffles[width == 2 ? 0 : width == 4 ? 1 : 2];
+}
+
+__attribute__((target("ssse3")))
+inline void boost_udp_swap_ssse3(unsigned char* dst, const unsigned char* src, const std::size_t count, const std::size_t width) noexcept {
+	const __m128i shuffle = _mm_loadu_si128(reinterpret_cast<const __m128i*>(boost_udp_swap_shuffle(width)));
+	const std::size_t bytes = count * width;
+	std::size_t i = 0;
+
+	for (; i + 16 <= bytes; i += 16) {
+		const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_shuffle_epi8(v, shuffle));
+	}
+
+	boost_udp_swap_scalar(dst + i, src + i, (bytes - i) / width, width);
+}
+
+__attribute__((target("avx2")))
+inline void boost_udp_swap_avx2(unsigned char* dst, const unsigned char* src, const std::size_t count, const std::size_t width) noexcept {
+	// The shuffle works within each 16 byte half, so
+	// the same one goes in both.
+	const __m128i lane = _mm_loadu_si128(reinterpret_cast<const __m128i*>(boost_udp_swap_shuffle(width)));
+	const __m256i shuffle = _mm256_broadcastsi128_si256(lane);
+	const std::size_t bytes = count * width;
+	std::size_t i = 0;
+
+	// Two at a time to keep both load ports busy
+	for (; i + 64 <= bytes; i += 64) {
+		const __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+		const __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i + 32));
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), _mm256_shuffle_epi8(a, shuffle));
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i + 32), _mm256_shuffle_epi8(b, shuffle));
+	}
+
+	for (; i + 32 <= bytes; i += 32) {
+		const __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), _mm256_shuffle_epi8(a, shuffle));
+	}
+
+	boost_udp_swap_scalar(dst + i, src + i, (bytes - i) / width, width);
+}
+#endif
+
+//
+// Reverse the bytes of count samples of width bytes (2, 4 or 8) from
+// src into dst, which can be the same. Anything else is just copied.
+//
+inline void boost_udp_swap_bytes(void* dst, const void* src, const std::size_t count, const std::size_t width,
+	boost_udp_simd simd = boost_udp_simd::best) noexcept {
+
+	unsigned char* d = static_cast<unsigned char*>(dst);
+	const unsigned char* s = static_cast<const unsigned char*>(src);
+
+	if (width != 2 && width != 4 && width != 8) {
+		std::memmove(d, s, count * width);
+		return;
+	}
+
+#ifdef BOOST_UDP_X86_SIMD
+	// What the CPU has, looked up once
+	static const boost_udp_simd fastest = boost_udp_simd_supported(boost_udp_simd::avx2) ? boost_udp_simd::avx2
+		: boost_udp_simd_supported(boost_udp_simd::ssse3) ? boost_udp_simd::ssse3 : boost_udp_simd::scalar;
+
+	if (simd == boost_udp_simd::best || !boost_udp_simd_supported(simd))
+		simd = fastest;
+
+	if (simd == boost_udp_simd::avx2) {
+		boost_udp_swap_avx2(d, s, count, width);
+		return;
+	}
+
+	if (simd == boost_udp_simd::ssse3) {
+		boost_udp_swap_ssse3(d, s, count, width);
+		return;
+	}
+#endif
+
+	boost_udp_swap_scalar(d, s, count, width);
+}
+
+//
+// Convert count big endian samples of width bytes to host order,
+// a copy on big endian hosts.
+//
+inline void boost_udp_big_endian_to_host(void* dst, const void* src, const std::size_t count, const std::size_t width,
+	const boost_udp_simd simd = boost_udp_simd::best) noexcept {
+
+	if (BOOST_UDP_BIG_ENDIAN_HOST)
+		std::memmove(dst, src, count * width);
+	else
+		boost_udp_swap_bytes(dst, src, count, width, simd);
+}
+
+//
+// Convert the big endian samples in a datagram to host order into
+// samples, returns how many were converted. Bytes after the last
+// whole sample are ignored. If there are more than max_samples ec
+// is boost::asio::error::message_size and the first max_samples
+// are converted.
+//
+template <typename Sample>
+inline std::size_t boost_udp_samples_to_host(const datagram_view& datagram, Sample* samples, const std::size_t max_samples,
+	boost::system::error_code& ec) noexcept {
+
+	static_assert(std::is_arithmetic<Sample>::value, "samples are numbers");
+
+	std::size_t n = datagram.size / sizeof(Sample);
+
+	if (n > max_samples) {
+		ec = boost::asio::error::message_size;
+		n = max_samples;
+	}
+
+	boost_udp_big_endian_to_host(samples, datagram.data, n, sizeof(Sample));
+
+	return n;
+}
+
+//
+// Receive a datagram of big endian samples synchronously, converting
+// them straight from the receive buffer into samples. Returns how many
+// samples there were.
+//
+template <typename Sample>
+inline std::size_t boost_udp_receive_samples(boost_udp_receive_rar& rar, Sample* samples, const std::size_t max_samples,
+	boost::system::error_code& ec) noexcept {
+
+	const datagram_view datagram = rar.receive_view_sync(ec);
+
+	if (ec)
+		return 0;
+
+	return boost_udp_samples_to_host(datagram, samples, max_samples, ec);
+}
+
+//
+// As above but asynchronously, returns 0 (with ec clear)
+// if nothing has been received.
+//
+template <typename Sample>
+inline std::size_t boost_udp_receive_samples_async(boost_udp_receive_rar& rar, Sample* samples, const std::size_t max_samples,
+	boost::system::error_code& ec) noexcept {
+
+	const datagram_view datagram = rar.receive_view_async(ec);
+
+	if (ec || datagram.empty())
+		return 0;
+
+	return boost_udp_samples_to_host(datagram, samples, max_samples, ec);
+}
@@ -0,0 +1,410 @@
+#pragma once
+
+//   Copyright 2022 Kevin Godden
+//
+//   Licensed under the Apache License, Version 2.0 (the "License");
+//   you may not use this file except in compliance with the License.
+//   You may obtain a copy of the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+//   Unless required by applicable law or agreed to in writing, software
+//   distributed under the License is distributed on an "AS IS" BASIS,
+//   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//   See the License for the specific language governing permissions and
+//   limitations under the License.
+
+#include "boost_udp_receive_rar.h"
+#include "boost_udp_byte_order.h"
+
+#include <cstdint>
+#include <cstring>
+#include <functional>
+
+//
+// Checks the CRC32C or Adler-32 checksum a sender appends to each
+// datagram, handing on the good ones (without the checksum) and dropping
+// and counting the corrupt ones.
+//
+// CRC32C uses the SSE4.2 crc32 instruction when the CPU has it (checked
+// at run time), with three independent streams over longer datagrams so
+// that the instruction's latency is hidden, and a table a byte at a time
+// otherwise. Adler-32 sums 16 bytes per step with SSSE3, and only takes
+// the modulo every few KB.
+//
+// validate() checks a batch of datagrams at once, e.g. those a receive
+// thread has gathered between drained calls, and keeps the good ones.
+//
+// Single threaded.
+//
+// Synopsis:
+//
+/*
+	boost_udp_checksum_options options;
+	options.algorithm = boost_udp_checksum_options::crc32c;
+
+	boost_udp_checksum_validator validator(options, [](const datagram_view& datagram) {
+		process(datagram);
+	});
+
+	boost_udp_receive_thread thread(rar, [&](const datagram_view& datagram) {
+		validator.push(datagram);
+	});
+*/
+
+//
+// CRC32C (Castagnoli) of size bytes, pass a previous result
+// as crc to carry on from where it left off.
+//
+inline uint32_t boost_udp_crc32c_software(const void* data, std::size_t size, uint32_t crc = 0) noexcept {
+	struct table_type {
+		uint32_t entries[256];
+
+		table_type() {
+			for (uint32_t i = 0; i != 256; i++) {
+				uint32_t c = i;
+
+				for (int k = 0; k != 8; k++)
+					c = c & 1 ? (c >> 1) ^ 0x82f63b78 : c >> 1;
+
+				entries[i] = c;
+			}
+		}
+	};
+
+	static const table_type table;
+
+	const unsigned char* p = static_cast<const unsigned char*>(data);
+	crc = ~crc;
+
+	while (size--)
+		crc = table.entries[(crc ^ *p++) & 0xff] ^ (crc >> 8);
+
+	return ~crc;
+}
+
+#ifdef BOOST_UDP_X86_SIMD
+// Bytes in each of the three streams the hardware CRC is split into
+const std::size_t boost_udp_crc32c_part = 256;
+
+//
+// Tables that move a CRC on over one and two parts' worth of zero
+// bytes in a few lookups, rather than running them through the CRC.
+// Moving on over zeroes is linear in the CRC, so each byte of it can
+// be looked up on its own and the results xored together.
+//
+struct boost_udp_crc32c_shifts {
+	uint32_t one[4][256];
+	uint32_t two[4][256];
+
+	static uint32_t apply(const uint32_t (&table)[4][256], const uint32_t crc) noexcept {
+		return table[0][crc & 0xff] ^ table[1][(crc >> 8) & 0xff] ^ table[2][(crc >> 16) & 0xff] ^ table[3][crc >> 24];
+	}
+};
+
+// Fill a table that moves a CRC on over zeroes bytes
+__attribute__((target("sse4.2")))
+inline void boost_udp_fill_crc32c_shift(uint32_t (&table)[4][256], const std::size_t zeroes) noexcept {
+	// Where each bit of the CRC ends up
+	uint32_t bits[32];
+
+	for (int j = 0; j != 32; j++) {
+		uint64_t c = uint32_t(1) << j;
+
+		for (std::size_t i = 0; i != zeroes; i += 8)
+			c = _mm_crc32_u64(c, 0);
+
+		bits[j] = static_cast<uint32_t>(c);
+	}
+
+	for (int k = 0; k != 4; k++) {
+		for (int b = 0; b != 256; b++) {
+			uint32_t v = 0;
+
+			for (int bit = 0; bit != 8; bit++) {
+				if (b & (1 << bit))
+					v ^= bits[8 * k + bit];
+			}
+
+			table[k][b] = v;
+		}
+	}
+}
+
+inline boost_udp_crc32c_shifts boost_udp_make_crc32c_shifts() noexcept {
+	boost_udp_crc32c_shifts shifts;
+
+	boost_udp_fill_crc32c_shift(shifts.one, boost_udp_crc32c_part);
+	boost_udp_fill_crc32c_shift(shifts.two, 2 * boost_udp_crc32c_part);
+
+	return shifts;
+}
+
+__attribute__((target("sse4.2")))
+inline uint32_t boost_udp_crc32c_sse42(const void* data, std::size_t size, uint32_t crc = 0) noexcept {
+	const std::size_t part = boost_udp_crc32c_part;
+
+	const unsigned char* p = static_cast<const unsigned char*>(data);
+	uint64_t c = ~crc;
+
+	auto r8 = [](const unsigned char* q) {
+		uint64_t v;
+		std::memcpy(&v, q, sizeof(v));
+		return v;
+	};
+
+	// Long enough to be worth three streams, each over a third,
+	// so that the crc32 instruction's latency is hidden. The first
+	// two are then moved on over the parts that follow them.
+	if (size >= 3 * part) {
+		static const boost_udp_crc32c_shifts shifts = boost_udp_make_crc32c_shifts();
+
+		do {
+			uint64_t c1 = 0, c2 = 0;
+
+			for (std::size_t i = 0; i != part; i += 8) {
+				c = _mm_crc32_u64(c, r8(p + i));
+				c1 = _mm_crc32_u64(c1, r8(p + part + i));
+				c2 = _mm_crc32_u64(c2, r8(p + 2 * part + i));
+			}
+
+			c = boost_udp_crc32c_shifts::apply(shifts.two, static_cast<uint32_t>(c))
+				^ boost_udp_crc32c_shifts::apply(shifts.one, static_cast<uint32_t>(c1)) ^ c2;
+
+			p += 3 * part;
+			size -= 3 * part;
+		} while (size >= 3 * part);
+	}
+
+	for (; size >= 8; size -= 8, p += 8)
+		c = _mm_crc32_u64(c, r8(p));
+
+	uint32_t c32 = static_cast<uint32_t>(c);
+
+	for (; size; size--)
+		c32 = _mm_crc32_u8(c32, *p++);
+
+	return ~c32;
+}
+#endif
+
+inline uint32_t boost_udp_crc32c(const void* data, const std::size_t size, const uint32_t crc = 0) noexcept {
+#ifdef BOOST_UDP_X86_SIMD
+	static const bool hardware = __builtin_cpu_supports("sse4.2");
+
+	if (hardware)
+		return boost_udp_crc32c_sse42(data, size, crc);
+#endif
+
+	return boost_udp_crc32c_software(data, size, crc);
+}
+
+const uint32_t boost_udp_adler32_base = 65521;
+
+// The most bytes that can be summed before
+// Adler-32's b could overflow 32 bits.
+const std::size_t boost_udp_adler32_nmax = 5552;
+
+//
+// Adler-32 of size bytes, pass a previous result as
+// adler to carry on from where it left off.
+//
+inline uint32_t boost_udp_adler32_software(const void* data, std::size_t size, const uint32_t adler = 1) noexcept {
+	const unsigned char* p = static_cast<const unsigned char*>(data);
+	uint32_t a = adler & 0xffff, b = adler >> 16;
+
+	while (size) {
+		std::size_t n = size < boost_udp_adler32_nmax ? size : boost_udp_adler32_nmax;
+		size -= n;
+
+		while (n--) {
+			a += *p++;
+			b += a;
+		}
+
+		a %= boost_udp_adler32_base;
+		b %= boost_udp_adler32_base;
+	}
+
+	return (b << 16) | a;
+}
+
+#ifdef BOOST_UDP_X86_SIMD
+__attribute__((target("ssse3")))
+inline uint32_t boost_udp_adler32_ssse3(const void* data, std::size_t size, const uint32_t adler = 1) noexcept {
+	const unsigned char* p = static_cast<const unsigned char*>(data);
+	uint32_t a = adler & 0xffff, b = adler >> 16;
+
+	// How much each of 16 bytes adds to b, the
+	// first is added to the running total 16 times.
+	const __m128i weights = _mm_setr_epi8(16, 15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1);
+	const __m128i ones = _mm_set1_epi16(1);
+	const __m128i zero = _mm_setzero_si128();
+
+	auto sum = [](const __m128i v) {
+		uint32_t lanes[4];
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(lanes), v);
+		return lanes[0] + lanes[1] + lanes[2] + lanes[3];
+	};
+
+	while (size >= 16) {
+		std::size_t blocks = (size < boost_udp_adler32_nmax ? size : boost_udp_adler32_nmax) / 16;
+		size -= blocks * 16;
+
+		// b gains a for every byte, then the bytes' running totals
+		b += a * static_cast<uint32_t>(blocks * 16);
+
+		__m128i sums = zero, previous = zero, weighted = zero;
+
+		for (; blocks; blocks--, p += 16) {
+			const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+
+			// Each block adds 16 times the sum of those before it
+			previous = _mm_add_epi32(previous, sums);
+			sums = _mm_add_epi32(sums, _mm_sad_epu8(v, zero));
+			weighted = _mm_add_epi32(weighted, _mm_madd_epi16(_mm_maddubs_epi16(v, weights), ones));
+		}
+
+		a += sum(sums);
+		b += 16 * sum(previous) + sum(weighted);
+
+		a %= boost_udp_adler32_base;
+		b %= boost_udp_adler32_base;
+	}
+
+	return boost_udp_adler32_software(p, size, (b << 16) | a);
+}
+#endif
+
+inline uint32_t boost_udp_adler32(const void* data, const std::size_t size, const uint32_t adler = 1) noexcept {
+#ifdef BOOST_UDP_X86_SIMD
+	static const bool ssse3 = __builtin_cpu_supports("ssse3");
+
+	if (ssse3)
+		return boost_udp_adler32_ssse3(data, size, adler);
+#endif
+
+	return boost_udp_adler32_software(data, size, adler);
+}
+
+struct boost_udp_checksum_options {
+	enum algorithm_type {
+		crc32c,
+		adler32
+	};
+
+	algorithm_type algorithm = crc32c;
+
+	// The checksum is the last 4 bytes of the datagram, over
+	// everything before it, in network order unless this is
+	// cleared.
+	bool big_endian = true;
+
+	// Hand on datagrams without the checksum on the end
+	bool strip = true;
+};
+
+struct boost_udp_checksum_stats {
+	// Good datagrams handed on
+	uint64_t valid = 0;
+
+	// Dropped because the checksum didn't match, or
+	// too short to have one.
+	uint64_t corrupt = 0;
+	uint64_t malformed = 0;
+
+	// Bytes checked
+	uint64_t bytes = 0;
+};
+
+class boost_udp_checksum_validator {
+public:
+	using handler_type = std::function<void(const datagram_view&)>;
+
+private:
+	boost_udp_checksum_options options;
+	handler_type handler;
+
+	boost_udp_checksum_stats counters;
+
+public:
+	explicit boost_udp_checksum_validator(const boost_udp_checksum_options& options, handler_type handler = handler_type())
+		: options(options), handler(std::move(handler)) {
+	}
+
+	//
+	// The checksum of a payload, as the sender would have
+	// appended it.
+	//
+	uint32_t checksum(const void* data, const std::size_t size) const noexcept {
+		return options.algorithm == boost_udp_checksum_options::crc32c ? boost_udp_crc32c(data, size) : boost_udp_adler32(data, size);
+	}
+
+	//
+	// Check a datagram's checksum, if it's good the datagram is
+	// returned (without its checksum if strip is set), otherwise
+	// an empty view is.
+	//
+	datagram_view check(const datagram_view& datagram) noexcept {
+		if (datagram.size < 4) {
+			counters.malformed++;
+			return{};
+		}
+
+		const std::size_t size = datagram.size - 4;
+
+		const uint32_t expected = static_cast<uint32_t>(options.big_endian
+			? boost_udp_read_uint<4, true>(datagram.data + size) : boost_udp_read_uint<4, false>(datagram.data + size));
+
+		counters.bytes += size;
+
+		if (checksum(datagram.data, size) != expected) {
+			counters.corrupt++;
+			return{};
+		}
+
+		counters.valid++;
+
+		return datagram_view(datagram.data, options.strip ? size : datagram.size, datagram.sender);
+	}
+
+	//
+	// Hand the datagram on to the handler if its checksum
+	// is good, returns true if it was.
+	//
+	bool push(const datagram_view& datagram) {
+		const datagram_view good = check(datagram);
+
+		// A good datagram with nothing but a checksum is
+		// still handed on, so look at the data pointer.
+		if (!good.data)
+			return false;
+
+		if (handler)
+			handler(good);
+
+		return true;
+	}
+
+	//
+	// Check a batch of datagrams, the good ones are moved to the
+	// front (stripped if strip is set) and their number returned.
+	// The handler isn't called.
+	//
+	std::size_t validate(datagram_view* datagrams, const std::size_t count) noexcept {
+		std::size_t kept = 0;
+
+		for (std::size_t i = 0; i != count; i++) {
+			const datagram_view good = check(datagrams[i]);
+
+			if (good.data)
+				datagrams[kept++] = good;
+		}
+
+		return kept;
+	}
+
+	boost_udp_checksum_stats stats() const noexcept {
+		return counters;
+	}
+};
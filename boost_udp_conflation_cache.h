@@ -0,0 +1,335 @@
+#pragma once
+
+//   Copyright 2022 Kevin Godden
+//
+//   Licensed under the Apache License, Version 2.0 (the "License");
+//   you may not use this file except in compliance with the License.
+//   You may obtain a copy of the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+//   Unless required by applicable law or agreed to in writing, software
+//   distributed under the License is distributed on an "AS IS" BASIS,
+//   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//   See the License for the specific language governing permissions and
+//   limitations under the License.
+
+#include "boost_udp_datagram_ring.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+//
+// Keeps only the newest datagram for each key (e.g. an instrument id),
+// for feeds where a slow consumer only cares about the latest update.
+// The receive thread calls update() for every datagram, the consumer
+// calls drain() whenever it's ready for more and gets each key that's
+// changed since, once, with its newest datagram. However far behind the
+// consumer gets, memory and the work it's handed are bounded by the
+// number of keys.
+//
+// The key comes from a function, or a big endian integer at a fixed
+// offset in the payload. The table uses open addressing (linear probing)
+// and the changed keys are kept on a dirty list in the order they first
+// changed.
+//
+// update() and drain() can be called from different threads.
+//
+// Synopsis:
+//
+/*
+	boost_udp_conflation_options options;
+	options.key_offset = 0;
+	options.key_size = 4;    // 32 bit instrument id at the start
+
+	boost_udp_conflation_cache cache(options);
+
+	// Receive thread
+	boost_udp_receive_thread thread(rar, [&](const datagram_view& datagram) {
+		cache.update(datagram);
+	});
+
+	// Consumer thread
+	cache.drain([](uint64_t instrument, const datagram_view& latest) {
+		reprice(instrument, latest);
+	});
+*/
+
+struct boost_udp_conflation_options {
+	// Most keys kept, datagrams with new keys are
+	// rejected (and counted) once it's reached.
+	std::size_t max_keys = 4096;
+
+	// The biggest datagram kept
+	std::size_t max_datagram_size = 2048;
+
+	// How the datagrams' memory is allocated
+	boost_udp_buffer_memory memory;
+
+	// Gives the key of a datagram, if not set key_size bytes at
+	// key_offset are read as a big endian integer, if key_size is
+	// 0 too the sender's address & port are used.
+	std::function<uint64_t(const datagram_view&)> key;
+	std::size_t key_offset = 0;
+	std::size_t key_size = 0;
+};
+
+struct boost_udp_conflation_stats {
+	// Datagrams taken in, and those that replaced one
+	// the consumer hadn't seen yet.
+	uint64_t updates = 0;
+	uint64_t conflated = 0;
+
+	// Turned away, because there were already max_keys
+	// keys, or the datagram was too big or too short
+	// for its key.
+	uint64_t rejected = 0;
+
+	// Datagrams handed to the consumer
+	uint64_t drained = 0;
+
+	// Keys in the table, and how many have changed
+	// since the consumer last drained.
+	std::size_t keys = 0;
+	std::size_t dirty = 0;
+};
+
+class boost_udp_conflation_cache {
+	struct entry {
+		uint64_t key = 0;
+		bool used = false;
+		bool dirty = false;
+
+		unsigned char* data = nullptr;
+		std::size_t size = 0;
+		boost::asio::ip::udp::endpoint sender;
+	};
+
+	boost_udp_conflation_options options;
+
+	std::shared_ptr<boost_udp_buffer_pool> pool;
+
+	// The table, twice max_keys rounded up to a power of
+	// two so that probes stay short.
+	std::vector<entry> table;
+	std::size_t mask = 0;
+
+	// Entries changed since the last drain, in the
+	// order they first changed.
+	std::vector<std::size_t> dirty;
+
+	// Guards everything, held just long enough
+	// to copy a datagram in or out.
+	mutable std::mutex mutex;
+
+	boost_udp_conflation_stats counters;
+
+	// Where drain() copies each datagram, so that the
+	// consumer's handler runs without the lock.
+	std::vector<unsigned char> scratch;
+
+	static std::size_t round_up_power_of_two(std::size_t n) {
+		std::size_t p = 1;
+
+		while (p < n)
+			p <<= 1;
+
+		return p;
+	}
+
+	static uint64_t mix(uint64_t key) {
+		key ^= key >> 33;
+		key *= 0xff51afd7ed558ccdull;
+		key ^= key >> 33;
+		key *= 0xc4ceb9fe1a85ec53ull;
+		key ^= key >> 33;
+
+		return key;
+	}
+
+	// The entry for key, or the empty one where it would go
+	std::size_t find(const uint64_t key) const {
+		std::size_t i = mix(key) & mask;
+
+		while (table[i].used && table[i].key != key)
+			i = (i + 1) & mask;
+
+		return i;
+	}
+
+public:
+	explicit boost_udp_conflation_cache(const boost_udp_conflation_options& options = boost_udp_conflation_options())
+		: options(options) {
+
+		const std::size_t keys = options.max_keys ? options.max_keys : 1;
+
+		table.resize(round_up_power_of_two(keys * 2));
+		mask = table.size() - 1;
+		dirty.reserve(keys);
+		scratch.resize(options.max_datagram_size);
+
+		pool = std::make_shared<boost_udp_buffer_pool>(options.max_datagram_size, keys, options.memory);
+	}
+
+	boost_udp_conflation_cache(const boost_udp_conflation_cache&) = delete;
+	boost_udp_conflation_cache& operator=(const boost_udp_conflation_cache&) = delete;
+
+	~boost_udp_conflation_cache() {
+		for (auto& e : table) {
+			if (e.data)
+				pool->release(e.data);
+		}
+	}
+
+	//
+	// The key of a datagram, false if it's too short to have one
+	//
+	bool key_of(const datagram_view& datagram, uint64_t& key) const {
+		if (options.key) {
+			key = options.key(datagram);
+			return true;
+		}
+
+		if (!options.key_size) {
+			key = boost_udp_sender_key(datagram);
+			return true;
+		}
+
+		if (options.key_offset + options.key_size > datagram.size || options.key_size > sizeof(key))
+			return false;
+
+		key = 0;
+
+		for (std::size_t i = 0; i != options.key_size; i++)
+			key = (key << 8) | datagram.data[options.key_offset + i];
+
+		return true;
+	}
+
+	//
+	// Keep a datagram (it's copied) as the newest for its key.
+	// Returns false if it was rejected.
+	//
+	bool update(const datagram_view& datagram) {
+		uint64_t key;
+
+		std::lock_guard<std::mutex> lock(mutex);
+
+		if (datagram.size > pool->size() || !key_of(datagram, key)) {
+			counters.rejected++;
+			return false;
+		}
+
+		const std::size_t i = find(key);
+		entry& e = table[i];
+
+		if (!e.used) {
+			unsigned char* data = counters.keys < options.max_keys ? pool->acquire() : nullptr;
+
+			if (!data) {
+				counters.rejected++;
+				return false;
+			}
+
+			e.used = true;
+			e.key = key;
+			e.data = data;
+			counters.keys++;
+		}
+
+		std::memcpy(e.data, datagram.data, datagram.size);
+		e.size = datagram.size;
+		e.sender = datagram.sender;
+
+		counters.updates++;
+
+		if (e.dirty) {
+			counters.conflated++;
+		}
+		else {
+			e.dirty = true;
+			dirty.push_back(i);
+		}
+
+		return true;
+	}
+
+	//
+	// Hand each key that's changed since the last drain, with its
+	// newest datagram, to handler(uint64_t key, const datagram_view&),
+	// up to max of them. The view is only valid during the call.
+	// Returns how many were handed over.
+	//
+	template<typename Handler>
+	std::size_t drain(Handler handler, const std::size_t max = ~std::size_t(0)) {
+		std::size_t handed = 0;
+
+		// Just what's dirty now, keys that change while
+		// we're at it wait for the next drain.
+		std::size_t limit;
+
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			limit = std::min(max, dirty.size());
+		}
+
+		for (;;) {
+			uint64_t key;
+			std::size_t size;
+			boost::asio::ip::udp::endpoint sender;
+
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+
+				if (handed == limit) {
+					// Keep anything we didn't get to
+					dirty.erase(dirty.begin(), dirty.begin() + handed);
+					counters.drained += handed;
+					return handed;
+				}
+
+				entry& e = table[dirty[handed]];
+				e.dirty = false;
+
+				key = e.key;
+				size = e.size;
+				sender = e.sender;
+				std::memcpy(scratch.data(), e.data, size);
+			}
+
+			handed++;
+			handler(key, datagram_view(scratch.data(), size, sender));
+		}
+	}
+
+	//
+	// Copy out the newest datagram for a key,
+	// false if there isn't one.
+	//
+	bool latest(const uint64_t key, std::vector<unsigned char>& out) const {
+		std::lock_guard<std::mutex> lock(mutex);
+
+		const entry& e = table[find(key)];
+
+		if (!e.used)
+			return false;
+
+		out.assign(e.data, e.data + e.size);
+
+		return true;
+	}
+
+	boost_udp_conflation_stats stats() const {
+		std::lock_guard<std::mutex> lock(mutex);
+
+		boost_udp_conflation_stats out = counters;
+		out.dirty = dirty.size();
+
+		return out;
+	}
+};
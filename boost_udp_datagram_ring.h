@@ -0,0 +1,555 @@
+#pragma once
+
+//   Copyright 2022 Kevin Godden
+//
+//   Licensed under the Apache License, Version 2.0 (the "License");
+//   you may not use this file except in compliance with the License.
+//   You may obtain a copy of the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+//   Unless required by applicable law or agreed to in writing, software
+//   distributed under the License is distributed on an "AS IS" BASIS,
+//   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//   See the License for the specific language governing permissions and
+//   limitations under the License.
+
+#include "boost_udp_receive_rar.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+//
+// A lock-free single producer, single consumer queue of datagrams, for
+// handing datagrams from a receive thread to a processing thread. Each
+// slot holds one datagram of up to slot_size bytes (plus its sender),
+// the datagram is copied in by push() and read in place by the consumer.
+//
+// The slots' memory comes from a boost_udp_buffer_pool, so it can be put
+// on a NUMA node, backed by huge pages etc. with boost_udp_buffer_memory.
+//
+// What push() does when the queue is full is up to the overflow policy
+// (see boost_udp_overflow_options), the same policies are used by all of
+// the queues in the library. With conflate the producer should call
+// flush() whenever it's idle to hand over what it held back.
+//
+// Synopsis:
+//
+/*
+	boost_udp_overflow_options overflow;
+	overflow.policy = boost_udp_overflow_options::drop_oldest;
+
+	boost_udp_datagram_ring ring(1024, 2048, boost_udp_buffer_memory(), overflow);
+
+	// Producer thread
+	if (!ring.push(view))
+		; // dropped (or too big), counted in stats()
+
+	// Consumer thread
+	datagram_view datagram;
+
+	if (ring.peek(datagram)) {
+		process(datagram);
+		ring.pop();
+	}
+*/
+
+//
+// Spin a little, then yield, then sleep, for threads
+// waiting on a queue.
+//
+class boost_udp_backoff {
+	unsigned count = 0;
+
+public:
+	void pause() {
+		if (++count < 64)
+			return;
+
+		if (count < 128)
+			std::this_thread::yield();
+		else
+			std::this_thread::sleep_for(std::chrono::microseconds(50));
+	}
+
+	void reset() {
+		count = 0;
+	}
+};
+
+//
+// The default key for flows and conflation,
+// the sender's address & port.
+//
+inline uint64_t boost_udp_sender_key(const datagram_view& datagram) {
+	const auto address = datagram.sender.address();
+	uint64_t key = datagram.sender.port();
+
+	if (address.is_v4()) {
+		key |= static_cast<uint64_t>(address.to_v4().to_uint()) << 16;
+	}
+	else {
+		for (const auto byte : address.to_v6().to_bytes())
+			key = key * 131 + byte;
+	}
+
+	return key;
+}
+
+//
+// What a queue does with a datagram when it's full, rather
+// than leaving the kernel to drop datagrams behind our back.
+//
+struct boost_udp_overflow_options {
+	enum policy_type {
+		// Turn the new datagram away
+		drop_newest,
+
+		// Drop the oldest one waiting to make room
+		drop_oldest,
+
+		// Wait for the consumer to make room, the socket
+		// backs up (and the kernel drops) instead.
+		block,
+
+		// Hold the new datagram back until there's room, a
+		// newer one with the same key replaces it meanwhile.
+		conflate
+	};
+
+	policy_type policy = drop_newest;
+
+	// For conflate, the key of a datagram (e.g. an instrument
+	// id), if not set the sender's address & port are used.
+	std::function<uint64_t(const datagram_view&)> key;
+
+	// For conflate, the most keys held back at once, datagrams
+	// with any other key are dropped once it's reached.
+	std::size_t max_held = 1024;
+};
+
+//
+// Counters for a datagram queue, one per overflow decision
+//
+struct boost_udp_queue_stats {
+	// Datagrams taken in, and those turned away because
+	// the queue was full or they wouldn't fit in a slot.
+	uint64_t pushed = 0;
+	uint64_t dropped = 0;
+	uint64_t oversize = 0;
+
+	// Waiting datagrams dropped to make room (drop_oldest)
+	uint64_t evicted = 0;
+
+	// Times the producer waited for room (block)
+	uint64_t blocked = 0;
+
+	// Held back datagrams replaced by a newer one with
+	// the same key, and how many are held back now (conflate).
+	uint64_t conflated = 0;
+	std::size_t held = 0;
+
+	// Datagrams waiting now, and the most there have been
+	std::size_t depth = 0;
+	std::size_t max_depth = 0;
+};
+
+//
+// Datagrams held back by a full queue with the conflate policy, in
+// arrival order but only the newest for each key. Single threaded, it
+// belongs to the queue's producer.
+//
+class boost_udp_held_datagrams {
+	struct entry {
+		uint64_t key = 0;
+		std::vector<unsigned char> bytes;
+		boost::asio::ip::udp::endpoint sender;
+	};
+
+	// A circular list in arrival order, and where each key is
+	std::vector<entry> entries;
+	std::size_t first = 0;
+	std::size_t count = 0;
+
+	std::unordered_map<uint64_t, std::size_t> index;
+
+public:
+	explicit boost_udp_held_datagrams(const std::size_t max_held)
+		: entries(max_held ? max_held : 1) {
+
+		index.reserve(entries.size());
+	}
+
+	enum result_type {
+		held,
+		replaced,
+		full
+	};
+
+	//
+	// Copy a datagram in, replacing the one with the same key (in its
+	// place in the order) if there is one.
+	//
+	result_type hold(const uint64_t key, const datagram_view& datagram) {
+		const auto found = index.find(key);
+
+		if (found != index.end()) {
+			entry& e = entries[found->second];
+			e.bytes.assign(datagram.begin(), datagram.end());
+			e.sender = datagram.sender;
+			return replaced;
+		}
+
+		if (count == entries.size())
+			return full;
+
+		const std::size_t i = (first + count++) % entries.size();
+		entry& e = entries[i];
+		e.key = key;
+		e.bytes.assign(datagram.begin(), datagram.end());
+		e.sender = datagram.sender;
+
+		index.emplace(key, i);
+
+		return held;
+	}
+
+	//
+	// The oldest datagram held, valid until pop()
+	//
+	datagram_view front() const {
+		const entry& e = entries[first];
+		return datagram_view(e.bytes.data(), e.bytes.size(), e.sender);
+	}
+
+	void pop() {
+		index.erase(entries[first].key);
+		first = (first + 1) % entries.size();
+		count--;
+	}
+
+	bool empty() const {
+		return count == 0;
+	}
+
+	std::size_t size() const {
+		return count;
+	}
+};
+
+class boost_udp_datagram_ring {
+	struct slot {
+		unsigned char* data = nullptr;
+		std::size_t size = 0;
+		boost::asio::ip::udp::endpoint sender;
+	};
+
+	static const std::size_t not_reading = ~std::size_t(0);
+
+	std::shared_ptr<boost_udp_buffer_pool> pool;
+	std::vector<slot> slots;
+	std::size_t mask = 0;
+
+	boost_udp_overflow_options overflow;
+	std::unique_ptr<boost_udp_held_datagrams> held;
+
+	// The consumer's and producer's positions, kept
+	// apart to avoid false sharing.
+	alignas(64) std::atomic<std::size_t> head{ 0 };
+	alignas(64) std::atomic<std::size_t> tail{ 0 };
+
+	// With drop_oldest the producer moves head too, so the consumer
+	// says which slot it's looking at and the producer leaves it be.
+	alignas(64) mutable std::atomic<std::size_t> reading{ not_reading };
+
+	// Producer side counters
+	std::atomic<uint64_t> pushed{ 0 };
+	std::atomic<uint64_t> dropped{ 0 };
+	std::atomic<uint64_t> oversize{ 0 };
+	std::atomic<uint64_t> evicted{ 0 };
+	std::atomic<uint64_t> blocked{ 0 };
+	std::atomic<uint64_t> conflated{ 0 };
+	std::atomic<std::size_t> held_count{ 0 };
+	std::atomic<std::size_t> max_depth{ 0 };
+
+	static std::size_t round_up_power_of_two(std::size_t n) {
+		std::size_t p = 1;
+
+		while (p < n)
+			p <<= 1;
+
+		return p;
+	}
+
+	// Copy into the next slot if there's room
+	bool try_push(const datagram_view& datagram) noexcept {
+		const std::size_t t = tail.load(std::memory_order_relaxed);
+		const std::size_t depth = t - head.load(std::memory_order_acquire);
+
+		if (depth >= slots.size())
+			return false;
+
+		// The slot of a datagram dropped while the
+		// consumer was still processing it.
+		if (overflow.policy == boost_udp_overflow_options::drop_oldest && t >= slots.size()
+			&& reading.load(std::memory_order_acquire) == t - slots.size())
+			return false;
+
+		slot& s = slots[t & mask];
+		std::memcpy(s.data, datagram.data, datagram.size);
+		s.size = datagram.size;
+		s.sender = datagram.sender;
+
+		tail.store(t + 1, std::memory_order_release);
+
+		pushed.fetch_add(1, std::memory_order_relaxed);
+
+		if (depth + 1 > max_depth.load(std::memory_order_relaxed))
+			max_depth.store(depth + 1, std::memory_order_relaxed);
+
+		return true;
+	}
+
+	// Drop the oldest waiting datagram, unless the consumer is
+	// looking at it. We move head first and then look at what the
+	// consumer is reading, the consumer does the opposite, so one
+	// of us always sees the other.
+	//
+	// Only when full: if there's room and try_push still refused,
+	// the next slot is one the consumer's reading and evicting
+	// wouldn't free it. While the consumer holds the oldest, head
+	// stays put and the push is dropped like drop_newest.
+	bool evict() noexcept {
+		const std::size_t t = tail.load(std::memory_order_relaxed);
+		std::size_t h = head.load(std::memory_order_seq_cst);
+
+		if (t - h < slots.size() || reading.load(std::memory_order_seq_cst) == h
+			|| !head.compare_exchange_strong(h, h + 1, std::memory_order_seq_cst))
+			return false;
+
+		// Being processed, it's not really gone and
+		// its slot isn't free yet.
+		if (reading.load(std::memory_order_seq_cst) == h)
+			return false;
+
+		evicted.fetch_add(1, std::memory_order_relaxed);
+
+		return true;
+	}
+
+	// Anything that doesn't fit goes in held,
+	// false if it had to be dropped.
+	bool hold(const datagram_view& datagram) {
+		switch (held->hold(overflow.key(datagram), datagram)) {
+		case boost_udp_held_datagrams::held:
+			break;
+
+		case boost_udp_held_datagrams::replaced:
+			conflated.fetch_add(1, std::memory_order_relaxed);
+			break;
+
+		case boost_udp_held_datagrams::full:
+			dropped.fetch_add(1, std::memory_order_relaxed);
+			return false;
+		}
+
+		held_count.store(held->size(), std::memory_order_relaxed);
+
+		return true;
+	}
+
+public:
+	//
+	// Capacity is rounded up to a power of two. If there's not enough
+	// memory for the slots, capacity() will be 0 and every push fails.
+	//
+	explicit boost_udp_datagram_ring(const std::size_t capacity, const std::size_t slot_size = 2048,
+		const boost_udp_buffer_memory& memory = boost_udp_buffer_memory(),
+		const boost_udp_overflow_options& overflow = boost_udp_overflow_options())
+		: overflow(overflow) {
+
+		if (overflow.policy == boost_udp_overflow_options::conflate) {
+			held.reset(new boost_udp_held_datagrams(overflow.max_held));
+
+			if (!this->overflow.key)
+				this->overflow.key = boost_udp_sender_key;
+		}
+
+		const std::size_t n = round_up_power_of_two(capacity ? capacity : 1);
+
+		pool = std::make_shared<boost_udp_buffer_pool>(slot_size, n, memory);
+		slots.resize(n);
+
+		for (auto& s : slots) {
+			s.data = pool->acquire();
+
+			if (!s.data) {
+				slots.clear();
+				return;
+			}
+		}
+
+		mask = n - 1;
+	}
+
+	boost_udp_datagram_ring(const boost_udp_datagram_ring&) = delete;
+	boost_udp_datagram_ring& operator=(const boost_udp_datagram_ring&) = delete;
+
+	//
+	// Copy a datagram into the queue, producer thread only. If it's
+	// full the overflow policy decides what happens, returns false if
+	// the datagram was dropped (or is too big).
+	//
+	bool push(const datagram_view& datagram) {
+		if (datagram.size > pool->size()) {
+			oversize.fetch_add(1, std::memory_order_relaxed);
+			return false;
+		}
+
+		if (slots.empty()) {
+			dropped.fetch_add(1, std::memory_order_relaxed);
+			return false;
+		}
+
+		// Anything held back goes first, to keep the order
+		if (held && !held->empty()) {
+			flush();
+
+			if (!held->empty())
+				return hold(datagram);
+		}
+
+		if (try_push(datagram))
+			return true;
+
+		switch (overflow.policy) {
+		case boost_udp_overflow_options::drop_newest:
+			break;
+
+		case boost_udp_overflow_options::drop_oldest:
+			if (evict() && try_push(datagram))
+				return true;
+
+			break;
+
+		case boost_udp_overflow_options::block: {
+			blocked.fetch_add(1, std::memory_order_relaxed);
+			boost_udp_backoff backoff;
+
+			while (!try_push(datagram))
+				backoff.pause();
+
+			return true;
+		}
+
+		case boost_udp_overflow_options::conflate:
+			return hold(datagram);
+		}
+
+		dropped.fetch_add(1, std::memory_order_relaxed);
+
+		return false;
+	}
+
+	//
+	// Move held back datagrams (conflate only) into the queue
+	// while there's room, producer thread only.
+	//
+	void flush() {
+		if (!held)
+			return;
+
+		while (!held->empty() && try_push(held->front()))
+			held->pop();
+
+		held_count.store(held->size(), std::memory_order_relaxed);
+	}
+
+	//
+	// Look at the oldest datagram without removing it, consumer
+	// thread only. The view is valid until pop().
+	//
+	bool peek(datagram_view& datagram) const noexcept {
+		std::size_t h = head.load(std::memory_order_acquire);
+
+		if (h == tail.load(std::memory_order_acquire))
+			return false;
+
+		// Tell the producer we're looking at h, then make
+		// sure it wasn't dropped before we said so.
+		if (overflow.policy == boost_udp_overflow_options::drop_oldest) {
+			for (;;) {
+				reading.store(h, std::memory_order_seq_cst);
+
+				const std::size_t now = head.load(std::memory_order_seq_cst);
+
+				if (now == h)
+					break;
+
+				h = now;
+
+				if (h == tail.load(std::memory_order_acquire)) {
+					reading.store(not_reading, std::memory_order_release);
+					return false;
+				}
+			}
+		}
+
+		const slot& s = slots[h & mask];
+		datagram = datagram_view(s.data, s.size, s.sender);
+
+		return true;
+	}
+
+	//
+	// Remove the oldest datagram, consumer thread only
+	//
+	void pop() noexcept {
+		if (overflow.policy == boost_udp_overflow_options::drop_oldest) {
+			// The producer might have moved head on already
+			std::size_t h = reading.load(std::memory_order_relaxed);
+			head.compare_exchange_strong(h, h + 1, std::memory_order_seq_cst);
+			reading.store(not_reading, std::memory_order_release);
+			return;
+		}
+
+		head.store(head.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+	}
+
+	bool empty() const noexcept {
+		return head.load(std::memory_order_acquire) == tail.load(std::memory_order_acquire);
+	}
+
+	std::size_t depth() const noexcept {
+		return tail.load(std::memory_order_acquire) - head.load(std::memory_order_acquire);
+	}
+
+	std::size_t capacity() const noexcept {
+		return slots.size();
+	}
+
+	//
+	// Counters, safe to call from any thread
+	//
+	boost_udp_queue_stats stats() const noexcept {
+		boost_udp_queue_stats out;
+		out.pushed = pushed.load(std::memory_order_relaxed);
+		out.dropped = dropped.load(std::memory_order_relaxed);
+		out.oversize = oversize.load(std::memory_order_relaxed);
+		out.evicted = evicted.load(std::memory_order_relaxed);
+		out.blocked = blocked.load(std::memory_order_relaxed);
+		out.conflated = conflated.load(std::memory_order_relaxed);
+		out.held = held_count.load(std::memory_order_relaxed);
+		out.depth = depth();
+		out.max_depth = max_depth.load(std::memory_order_relaxed);
+
+		return out;
+	}
+};
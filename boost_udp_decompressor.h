@@ -0,0 +1,436 @@
+#pragma once
+
+//   Copyright 2022 Kevin Godden
+//
+//   Licensed under the Apache License, Version 2.0 (the "License");
+//   you may not use this file except in compliance with the License.
+//   You may obtain a copy of the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+//   Unless required by applicable law or agreed to in writing, software
+//   distributed under the License is distributed on an "AS IS" BASIS,
+//   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//   See the License for the specific language governing permissions and
+//   limitations under the License.
+
+#include "boost_udp_receive_rar.h"
+
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <vector>
+
+// Each codec is built in if its header is there, link with -lzstd
+// and/or -llz4. Define either as 0 to leave it out.
+#ifndef BOOST_UDP_HAVE_ZSTD
+#if defined(__has_include)
+#if __has_include(<zstd.h>)
+#define BOOST_UDP_HAVE_ZSTD 1
+#endif
+#endif
+#endif
+
+#ifndef BOOST_UDP_HAVE_LZ4
+#if defined(__has_include)
+#if __has_include(<lz4frame.h>)
+#define BOOST_UDP_HAVE_LZ4 1
+#endif
+#endif
+#endif
+
+#if BOOST_UDP_HAVE_ZSTD
+#include <zstd.h>
+#include <zstd_errors.h>
+#endif
+
+#if BOOST_UDP_HAVE_LZ4
+// For LZ4F_decompress_usingDict()
+#define LZ4F_STATIC_LINKING_ONLY
+#include <lz4frame.h>
+#endif
+
+//
+// Decompresses datagrams sent as zstd or LZ4 frames (each datagram one
+// or more whole frames), the codec is either fixed or picked per datagram
+// from the frame's magic number. Payloads can have been compressed with a
+// dictionary shared with the sender, which makes a big difference for
+// small payloads that look alike.
+//
+// The decompression contexts (and the digested dictionary) are made once
+// and reused for every datagram, so there's no allocation per datagram.
+// The output goes into buffers from a boost_udp_buffer_pool, either one of
+// its own or one shared with receivers. Each decompressed view is valid
+// until buffers more datagrams have been decompressed.
+//
+// Single threaded, use one decompressor per thread, they can share a pool.
+//
+// Synopsis:
+//
+/*
+	boost_udp_decompress_options options;
+	options.dictionary = load_dictionary();
+
+	boost_udp_decompressor decompressor(options, [](const datagram_view& plain) {
+		process(plain);
+	});
+
+	if (decompressor.setup_error())
+		...
+
+	boost_udp_receive_thread thread(rar, [&](const datagram_view& datagram) {
+		decompressor.push(datagram);
+	});
+*/
+
+struct boost_udp_decompress_options {
+	enum codec_type {
+		// Whichever the frame's magic number says
+		detect,
+		zstd,
+		lz4
+	};
+
+	codec_type codec = detect;
+
+	// The dictionary the sender compressed with, if any. For
+	// zstd it can be a trained dictionary or raw content.
+	std::vector<unsigned char> dictionary;
+
+	// With detect, hand on datagrams that aren't a zstd or
+	// LZ4 frame as they are, for senders that only
+	// compress the big ones. Otherwise they're dropped.
+	bool pass_through = false;
+
+	// Output buffers taken from the pool and used in turn,
+	// a view is valid until this many more datagrams
+	// have been decompressed.
+	std::size_t buffers = 1;
+
+	// The size of each output buffer, datagrams that
+	// decompress to more than this are dropped.
+	std::size_t max_output_size = boost_udp_buffer_pool::max_datagram_size;
+
+	// How the decompressor's own pool is allocated
+	boost_udp_buffer_memory memory;
+
+	// If set, the output buffers come from this pool, its
+	// buffer size is used in place of max_output_size.
+	std::shared_ptr<boost_udp_buffer_pool> pool;
+};
+
+struct boost_udp_decompress_stats {
+	// Datagrams handed on, and their bytes before and after
+	uint64_t decompressed = 0;
+	uint64_t compressed_bytes = 0;
+	uint64_t bytes = 0;
+
+	// Handed on as they are (see pass_through)
+	uint64_t passed = 0;
+
+	// Dropped because they didn't decode, would have been
+	// bigger than an output buffer, or used a codec that
+	// isn't built in (or that we don't recognise).
+	uint64_t corrupt = 0;
+	uint64_t oversized = 0;
+	uint64_t unsupported = 0;
+};
+
+//
+// Whether a codec was built in
+//
+inline bool boost_udp_decompress_supported(const boost_udp_decompress_options::codec_type codec) noexcept {
+	switch (codec) {
+	case boost_udp_decompress_options::zstd:
+#if BOOST_UDP_HAVE_ZSTD
+		return true;
+#else
+		return false;
+#endif
+	case boost_udp_decompress_options::lz4:
+#if BOOST_UDP_HAVE_LZ4
+		return true;
+#else
+		return false;
+#endif
+	default:
+		return true;
+	}
+}
+
+class boost_udp_decompressor {
+public:
+	using handler_type = std::function<void(const datagram_view&)>;
+
+	// Frame magic numbers, as little endian on the wire
+	static const uint32_t zstd_magic = 0xfd2fb528;
+	static const uint32_t lz4_magic = 0x184d2204;
+
+private:
+	boost_udp_decompress_options options;
+	handler_type handler;
+
+	boost::system::error_code setup_ec;
+
+	std::shared_ptr<boost_udp_buffer_pool> pool;
+	std::vector<unsigned char*> outputs;
+	std::size_t next_output = 0;
+
+#if BOOST_UDP_HAVE_ZSTD
+	ZSTD_DCtx* zstd_ctx = nullptr;
+	ZSTD_DDict* zstd_dictionary = nullptr;
+#endif
+
+#if BOOST_UDP_HAVE_LZ4
+	LZ4F_dctx* lz4_ctx = nullptr;
+#endif
+
+	boost_udp_decompress_stats counters;
+
+	boost::system::error_code setup() {
+		if (!options.buffers)
+			return boost::asio::error::invalid_argument;
+
+		if (!boost_udp_decompress_supported(options.codec))
+			return boost::asio::error::operation_not_supported;
+
+		if (!pool)
+			pool = std::make_shared<boost_udp_buffer_pool>(options.max_output_size, options.buffers, options.memory);
+
+		for (std::size_t i = 0; i != options.buffers; i++) {
+			unsigned char* output = pool->acquire();
+
+			if (!output)
+				return boost::asio::error::no_memory;
+
+			outputs.push_back(output);
+		}
+
+#if BOOST_UDP_HAVE_ZSTD
+		zstd_ctx = ZSTD_createDCtx();
+
+		if (!zstd_ctx)
+			return boost::asio::error::no_memory;
+
+		// Digest the dictionary once rather than per frame
+		if (!options.dictionary.empty()) {
+			zstd_dictionary = ZSTD_createDDict(options.dictionary.data(), options.dictionary.size());
+
+			if (!zstd_dictionary)
+				return boost::asio::error::invalid_argument;
+		}
+#endif
+
+#if BOOST_UDP_HAVE_LZ4
+		if (LZ4F_isError(LZ4F_createDecompressionContext(&lz4_ctx, LZ4F_VERSION)))
+			return boost::asio::error::no_memory;
+#endif
+
+		return{};
+	}
+
+	boost_udp_decompress_options::codec_type codec_of(const unsigned char* data, const std::size_t size) const {
+		if (options.codec != boost_udp_decompress_options::detect)
+			return options.codec;
+
+		if (size < 4)
+			return boost_udp_decompress_options::detect;
+
+		const uint32_t magic = uint32_t(data[0]) | uint32_t(data[1]) << 8 | uint32_t(data[2]) << 16 | uint32_t(data[3]) << 24;
+
+		if (magic == zstd_magic)
+			return boost_udp_decompress_options::zstd;
+
+		if (magic == lz4_magic)
+			return boost_udp_decompress_options::lz4;
+
+		return boost_udp_decompress_options::detect;
+	}
+
+#if BOOST_UDP_HAVE_ZSTD
+	boost::system::error_code decompress_zstd(const unsigned char* data, const std::size_t size, unsigned char* out, std::size_t& out_size) {
+		// Catch the too big ones before decoding
+		// anything, if the frame says its size.
+		const unsigned long long content = ZSTD_getFrameContentSize(data, size);
+
+		if (content == ZSTD_CONTENTSIZE_ERROR)
+			return boost::asio::error::invalid_argument;
+
+		if (content != ZSTD_CONTENTSIZE_UNKNOWN && content > out_size)
+			return boost::asio::error::message_size;
+
+		const std::size_t n = zstd_dictionary
+			? ZSTD_decompress_usingDDict(zstd_ctx, out, out_size, data, size, zstd_dictionary)
+			: ZSTD_decompressDCtx(zstd_ctx, out, out_size, data, size);
+
+		// Frames that don't say their size, or several frames,
+		// only find out they're too big as they run out of room.
+		if (ZSTD_isError(n))
+			return ZSTD_getErrorCode(n) == ZSTD_error_dstSize_tooSmall ? boost::asio::error::message_size : boost::asio::error::invalid_argument;
+
+		out_size = n;
+		return{};
+	}
+#endif
+
+#if BOOST_UDP_HAVE_LZ4
+	boost::system::error_code decompress_lz4(const unsigned char* data, const std::size_t size, unsigned char* out, std::size_t& out_size) {
+		LZ4F_decompressOptions_t settings;
+		std::memset(&settings, 0, sizeof(settings));
+
+		std::size_t read = 0, written = 0;
+
+		// One frame after another until the datagram's used up
+		while (read != size) {
+			std::size_t in = size - read;
+			std::size_t room = out_size - written;
+
+			const std::size_t hint = options.dictionary.empty()
+				? LZ4F_decompress(lz4_ctx, out + written, &room, data + read, &in, &settings)
+				: LZ4F_decompress_usingDict(lz4_ctx, out + written, &room, data + read, &in,
+					options.dictionary.data(), options.dictionary.size(), &settings);
+
+			read += in;
+			written += room;
+
+			if (hint == 0)
+				continue;
+
+			// Part way through a frame, so start
+			// the next datagram afresh.
+			LZ4F_resetDecompressionContext(lz4_ctx);
+
+			if (LZ4F_isError(hint))
+				return boost::asio::error::invalid_argument;
+
+			// Either it ran out of room, or the
+			// datagram ended part way through.
+			return written == out_size ? boost::asio::error::message_size : boost::asio::error::invalid_argument;
+		}
+
+		out_size = written;
+		return{};
+	}
+#endif
+
+	void count(const boost::system::error_code& ec) {
+		if (ec == boost::asio::error::message_size)
+			counters.oversized++;
+		else if (ec == boost::asio::error::operation_not_supported)
+			counters.unsupported++;
+		else
+			counters.corrupt++;
+	}
+
+public:
+	explicit boost_udp_decompressor(const boost_udp_decompress_options& options, handler_type handler = handler_type())
+		: options(options), handler(std::move(handler)), pool(options.pool) {
+
+		setup_ec = setup();
+	}
+
+	boost_udp_decompressor(const boost_udp_decompressor&) = delete;
+	boost_udp_decompressor& operator=(const boost_udp_decompressor&) = delete;
+
+	~boost_udp_decompressor() {
+#if BOOST_UDP_HAVE_ZSTD
+		ZSTD_freeDDict(zstd_dictionary);
+		ZSTD_freeDCtx(zstd_ctx);
+#endif
+
+#if BOOST_UDP_HAVE_LZ4
+		LZ4F_freeDecompressionContext(lz4_ctx);
+#endif
+
+		for (unsigned char* output : outputs)
+			pool->release(output);
+	}
+
+	//
+	// Why the decompressor couldn't be set up, operation_not_supported
+	// for a codec that isn't built in, invalid_argument for a bad
+	// dictionary, no_memory if there weren't output buffers. Nothing
+	// is decompressed if it's set.
+	//
+	const boost::system::error_code& setup_error() const noexcept {
+		return setup_ec;
+	}
+
+	//
+	// Decompress a datagram into the next output buffer. ec is
+	// message_size if it's too big for the buffer, invalid_argument
+	// if it doesn't decode and operation_not_supported if it isn't a
+	// frame of a codec we have (unless it's passed through), the
+	// view is empty in each case.
+	//
+	datagram_view decompress(const datagram_view& datagram, boost::system::error_code& ec) {
+		ec = setup_ec;
+
+		if (ec)
+			return{};
+
+		const boost_udp_decompress_options::codec_type codec = codec_of(datagram.data, datagram.size);
+
+		if (codec == boost_udp_decompress_options::detect) {
+			if (options.pass_through) {
+				counters.passed++;
+				return datagram;
+			}
+
+			ec = boost::asio::error::operation_not_supported;
+			counters.unsupported++;
+			return{};
+		}
+
+		unsigned char* out = outputs[next_output];
+		std::size_t out_size = pool->size();
+
+		ec = boost::asio::error::operation_not_supported;
+
+#if BOOST_UDP_HAVE_ZSTD
+		if (codec == boost_udp_decompress_options::zstd)
+			ec = decompress_zstd(datagram.data, datagram.size, out, out_size);
+#endif
+
+#if BOOST_UDP_HAVE_LZ4
+		if (codec == boost_udp_decompress_options::lz4)
+			ec = decompress_lz4(datagram.data, datagram.size, out, out_size);
+#endif
+
+		if (ec) {
+			count(ec);
+			return{};
+		}
+
+		if (++next_output == outputs.size())
+			next_output = 0;
+
+		counters.decompressed++;
+		counters.compressed_bytes += datagram.size;
+		counters.bytes += out_size;
+
+		return datagram_view(out, out_size, datagram.sender);
+	}
+
+	//
+	// Hand the decompressed datagram to the handler, returns
+	// true if there was one to hand on.
+	//
+	bool push(const datagram_view& datagram) {
+		boost::system::error_code ec;
+		const datagram_view plain = decompress(datagram, ec);
+
+		if (ec)
+			return false;
+
+		if (handler)
+			handler(plain);
+
+		return true;
+	}
+
+	boost_udp_decompress_stats stats() const noexcept {
+		return counters;
+	}
+};
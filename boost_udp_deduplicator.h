@@ -0,0 +1,314 @@
+#pragma once
+
+//   Copyright 2022 Kevin Godden
+//
+//   Licensed under the Apache License, Version 2.0 (the "License");
+//   you may not use this file except in compliance with the License.
+//   You may obtain a copy of the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+//   Unless required by applicable law or agreed to in writing, software
+//   distributed under the License is distributed on an "AS IS" BASIS,
+//   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//   See the License for the specific language governing permissions and
+//   limitations under the License.
+
+#include "boost_udp_receive_rar.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <vector>
+
+//
+// Drops duplicate datagrams from feeds that have no sequence numbers,
+// e.g. copies that come in over redundant paths. Each payload is hashed
+// (a wyhash style 64 bit hash, 8 bytes at a time) and looked up in a
+// small open addressing table of the hashes of the last window datagrams,
+// optionally only those that arrived in the last max_age.
+//
+// Entries aren't deleted when they fall out of the window, they're just
+// treated as empty and written over. Each hash probes a bucket of a few
+// slots, if they're all in use the oldest is written over early (and
+// counted as evicted), with the table four times the window that's rare.
+//
+// Two different payloads with the same 64 bit hash would be taken for
+// duplicates, the chance of that is too small to worry about.
+//
+// Single threaded.
+//
+// Synopsis:
+//
+/*
+	boost_udp_dedup_options options;
+	options.window = 16384;
+	options.max_age = std::chrono::milliseconds(50);
+
+	boost_udp_deduplicator dedup(options, [](const datagram_view& datagram) {
+		process(datagram);
+	});
+
+	boost_udp_receive_thread thread(rar, [&](const datagram_view& datagram) {
+		dedup.push(datagram);
+	});
+*/
+
+//
+// A fast 64 bit hash of size bytes, after wyhash (public domain).
+//
+inline uint64_t boost_udp_hash(const void* key, const std::size_t size, uint64_t seed = 0) noexcept {
+	static const uint64_t secret[4] = { 0x2d358dccaa6c78a5ull, 0x8bb84b93962eacc9ull, 0x4b33a62ed433d4a3ull, 0x4d5a2da51de1aa47ull };
+
+	// 64 x 64 -> 128 bit multiply, low half to a, high half to b
+	auto mum = [](uint64_t& a, uint64_t& b) {
+#if defined(__SIZEOF_INT128__)
+		const unsigned __int128 r = static_cast<unsigned __int128>(a) * b;
+		a = static_cast<uint64_t>(r);
+		b = static_cast<uint64_t>(r >> 64);
+#else
+		const uint64_t ha = a >> 32, hb = b >> 32, la = static_cast<uint32_t>(a), lb = static_cast<uint32_t>(b);
+		const uint64_t rh = ha * hb, rm0 = ha * lb, rm1 = hb * la, rl = la * lb;
+		const uint64_t t = rl + (rm0 << 32);
+		uint64_t c = t < rl;
+		const uint64_t lo = t + (rm1 << 32);
+		c += lo < t;
+		b = rh + (rm0 >> 32) + (rm1 >> 32) + c;
+		a = lo;
+#endif
+	};
+
+	auto mix = [&](uint64_t a, uint64_t b) {
+		mum(a, b);
+		return a ^ b;
+	};
+
+	auto r8 = [](const unsigned char* p) {
+		uint64_t v;
+		std::memcpy(&v, p, sizeof(v));
+		return v;
+	};
+
+	auto r4 = [](const unsigned char* p) {
+		uint32_t v;
+		std::memcpy(&v, p, sizeof(v));
+		return static_cast<uint64_t>(v);
+	};
+
+	const unsigned char* p = static_cast<const unsigned char*>(key);
+	uint64_t a, b;
+
+	seed ^= mix(seed ^ secret[0], secret[1]);
+
+	if (size <= 16) {
+		if (size >= 4) {
+			a = (r4(p) << 32) | r4(p + ((size >> 3) << 2));
+			b = (r4(p + size - 4) << 32) | r4(p + size - 4 - ((size >> 3) << 2));
+		}
+		else if (size > 0) {
+			a = (static_cast<uint64_t>(p[0]) << 16) | (static_cast<uint64_t>(p[size >> 1]) << 8) | p[size - 1];
+			b = 0;
+		}
+		else {
+			a = b = 0;
+		}
+	}
+	else {
+		std::size_t i = size;
+
+		// Three independent lanes for the long ones
+		if (i > 48) {
+			uint64_t see1 = seed, see2 = seed;
+
+			do {
+				seed = mix(r8(p) ^ secret[1], r8(p + 8) ^ seed);
+				see1 = mix(r8(p + 16) ^ secret[2], r8(p + 24) ^ see1);
+				see2 = mix(r8(p + 32) ^ secret[3], r8(p + 40) ^ see2);
+				p += 48;
+				i -= 48;
+			} while (i > 48);
+
+			seed ^= see1 ^ see2;
+		}
+
+		while (i > 16) {
+			seed = mix(r8(p) ^ secret[1], r8(p + 8) ^ seed);
+			i -= 16;
+			p += 16;
+		}
+
+		a = r8(p + i - 16);
+		b = r8(p + i - 8);
+	}
+
+	a ^= secret[1];
+	b ^= seed;
+	mum(a, b);
+
+	return mix(a ^ secret[0] ^ size, b ^ secret[1]);
+}
+
+struct boost_udp_dedup_options {
+	// How many of the most recent datagrams are remembered
+	std::size_t window = 65536;
+
+	// If set, datagrams older than this are forgotten
+	// too, however few have arrived since.
+	std::chrono::steady_clock::duration max_age = std::chrono::steady_clock::duration::zero();
+
+	// Bytes at the start of the payload left out of the hash,
+	// e.g. a send time stamp that differs between the paths.
+	std::size_t hash_offset = 0;
+
+	uint64_t seed = 0;
+};
+
+struct boost_udp_dedup_stats {
+	// Datagrams handed on, and those dropped as duplicates
+	uint64_t unique = 0;
+	uint64_t duplicates = 0;
+
+	// Forgotten before they fell out of the window, because
+	// their bucket was full. A duplicate of one of these
+	// won't be caught.
+	uint64_t evicted = 0;
+};
+
+class boost_udp_deduplicator {
+public:
+	using handler_type = std::function<void(const datagram_view&)>;
+
+private:
+	using clock = std::chrono::steady_clock;
+
+	// Slots probed for each hash
+	static const std::size_t bucket = 8;
+
+	struct entry {
+		uint64_t hash = 0;
+
+		// Which datagram this was (counting from 1),
+		// 0 for never used.
+		uint64_t serial = 0;
+
+		clock::time_point arrived;
+	};
+
+	boost_udp_dedup_options options;
+	handler_type handler;
+
+	std::vector<entry> table;
+	std::size_t mask = 0;
+
+	// Datagrams remembered so far
+	uint64_t serial = 0;
+
+	boost_udp_dedup_stats counters;
+
+	static std::size_t round_up_power_of_two(std::size_t n) {
+		std::size_t p = 1;
+
+		while (p < n)
+			p <<= 1;
+
+		return p;
+	}
+
+	bool live(const entry& e, const clock::time_point now) const {
+		if (!e.serial || serial - e.serial >= options.window)
+			return false;
+
+		return options.max_age == clock::duration::zero() || now - e.arrived < options.max_age;
+	}
+
+public:
+	explicit boost_udp_deduplicator(const boost_udp_dedup_options& options, handler_type handler = handler_type())
+		: options(options), handler(std::move(handler)) {
+
+		if (!this->options.window)
+			this->options.window = 1;
+
+		const std::size_t slots = this->options.window * 4;
+
+		table.resize(round_up_power_of_two(slots > bucket ? slots : bucket));
+		mask = table.size() - 1;
+	}
+
+	boost_udp_deduplicator(const boost_udp_deduplicator&) = delete;
+	boost_udp_deduplicator& operator=(const boost_udp_deduplicator&) = delete;
+
+	//
+	// Remember the datagram, returns false if it's a copy of one
+	// seen in the window.
+	//
+	bool check(const datagram_view& datagram) {
+		const std::size_t offset = std::min(options.hash_offset, datagram.size);
+		const uint64_t hash = boost_udp_hash(datagram.data + offset, datagram.size - offset, options.seed);
+
+		// Only look at the clock if we have to
+		const clock::time_point now = options.max_age != clock::duration::zero() ? clock::now() : clock::time_point();
+
+		entry* free = nullptr;
+		entry* oldest = nullptr;
+
+		for (std::size_t i = 0; i != bucket; i++) {
+			entry& e = table[(hash + i) & mask];
+
+			if (!live(e, now)) {
+				if (!free)
+					free = &e;
+
+				continue;
+			}
+
+			if (e.hash == hash) {
+				counters.duplicates++;
+				return false;
+			}
+
+			if (!oldest || e.serial < oldest->serial)
+				oldest = &e;
+		}
+
+		if (!free) {
+			free = oldest;
+			counters.evicted++;
+		}
+
+		free->hash = hash;
+		free->serial = ++serial;
+		free->arrived = now;
+
+		counters.unique++;
+
+		return true;
+	}
+
+	//
+	// Hand the datagram on to the handler unless it's a
+	// duplicate, returns true if it was handed on.
+	//
+	bool push(const datagram_view& datagram) {
+		if (!check(datagram))
+			return false;
+
+		if (handler)
+			handler(datagram);
+
+		return true;
+	}
+
+	//
+	// Forget everything
+	//
+	void clear() {
+		std::fill(table.begin(), table.end(), entry());
+		serial = 0;
+	}
+
+	boost_udp_dedup_stats stats() const noexcept {
+		return counters;
+	}
+};
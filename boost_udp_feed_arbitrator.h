@@ -0,0 +1,338 @@
+#pragma once
+
+//   Copyright 2022 Kevin Godden
+//
+//   Licensed under the Apache License, Version 2.0 (the "License");
+//   you may not use this file except in compliance with the License.
+//   You may obtain a copy of the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+//   Unless required by applicable law or agreed to in writing, software
+//   distributed under the License is distributed on an "AS IS" BASIS,
+//   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//   See the License for the specific language governing permissions and
+//   limitations under the License.
+
+#include "boost_udp_receive_rar.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+#include <poll.h>
+
+//
+// Arbitrates between redundant copies of a feed (the A & B lines an
+// exchange sends every packet on), receiving from two or more receivers
+// and handing on the first copy of each sequence number, the copies that
+// turn up later on the other lines are dropped. Which line won each
+// datagram is passed to the handler and counted.
+//
+// The sequence numbers seen are tracked in a bitmap covering the last
+// window sequence numbers below the highest seen, anything older than
+// that is dropped as stale. Datagrams are handed on in the order they
+// win, not in sequence order, put a boost_udp_sequencer after the
+// arbitrator for that.
+//
+// Single threaded, all the lines are waited on with a single poll().
+// POSIX only.
+//
+// Synopsis:
+//
+/*
+	boost_udp_receive_rar line_a("10.0.0.1", 8861);
+	boost_udp_receive_rar line_b("10.0.1.1", 8861);
+
+	boost_udp_arbitrator_options options;
+	options.sequence_offset = 0;
+	options.sequence_size = 8;
+
+	boost_udp_feed_arbitrator arbitrator({ &line_a, &line_b },
+		[](unsigned line, uint64_t sequence, const datagram_view& datagram) {
+			process(datagram);
+		}, options);
+
+	boost::system::error_code ec;
+
+	while (running) {
+		arbitrator.poll(100, ec);
+
+		if (ec)
+			break;
+	}
+*/
+
+struct boost_udp_arbitrator_options {
+	// Where the sequence number is, its size in bytes (1-8)
+	// and whether it's big endian (network order).
+	std::size_t sequence_offset = 0;
+	std::size_t sequence_size = 4;
+	bool big_endian = true;
+
+	// How many sequence numbers back from the highest seen
+	// are remembered (rounded up to a multiple of 64 that's
+	// a power of two). A copy that's later than this behind
+	// its twin is dropped as stale.
+	std::size_t window = 4096;
+};
+
+struct boost_udp_arbitrator_stats {
+	// Datagrams handed on, and those each line won
+	uint64_t delivered = 0;
+	std::vector<uint64_t> wins;
+
+	// Copies of a datagram already handed on
+	uint64_t duplicates = 0;
+
+	// Too far behind the window to tell
+	uint64_t stale = 0;
+
+	// Too short for a sequence number
+	uint64_t malformed = 0;
+};
+
+class boost_udp_feed_arbitrator {
+public:
+	using handler_type = std::function<void(unsigned line, uint64_t sequence, const datagram_view&)>;
+
+private:
+	std::vector<boost_udp_receive_rar*> lines;
+	handler_type handler;
+	boost_udp_arbitrator_options options;
+
+	// One bit per sequence number in the window,
+	// indexed by sequence number & mask.
+	std::vector<uint64_t> seen;
+	uint64_t mask = 0;
+
+	// The highest sequence number seen, extended
+	// to 64 bits so that it never wraps.
+	uint64_t highest = 0;
+	bool started = false;
+
+	// The sequence number space, 0 for a full 64 bits
+	uint64_t modulus = 0;
+
+	std::vector<pollfd> fds;
+
+	boost_udp_arbitrator_stats counters;
+
+	static std::size_t round_up_power_of_two(std::size_t n) {
+		std::size_t p = 1;
+
+		while (p < n)
+			p <<= 1;
+
+		return p;
+	}
+
+	bool read_sequence(const datagram_view& datagram, uint64_t& sequence) const {
+		if (options.sequence_offset + options.sequence_size > datagram.size)
+			return false;
+
+		const unsigned char* p = datagram.data + options.sequence_offset;
+		sequence = 0;
+
+		for (std::size_t i = 0; i != options.sequence_size; i++) {
+			const std::size_t byte = options.big_endian ? i : options.sequence_size - 1 - i;
+			sequence = (sequence << 8) | p[byte];
+		}
+
+		return true;
+	}
+
+	// Turn a sequence number from the wire into the one
+	// nearest highest in our never wrapping numbers.
+	uint64_t extend(const uint64_t raw) const {
+		if (!modulus)
+			return raw;
+
+		const uint64_t half = modulus / 2;
+		const uint64_t ahead = (raw - highest) & (modulus - 1);
+
+		return ahead < half ? highest + ahead : highest - (modulus - ahead);
+	}
+
+	uint64_t wire(const uint64_t sequence) const {
+		return modulus ? sequence & (modulus - 1) : sequence;
+	}
+
+	bool test_and_set(const uint64_t sequence) {
+		uint64_t& word = seen[(sequence & mask) / 64];
+		const uint64_t bit = uint64_t(1) << (sequence % 64);
+
+		const bool was = (word & bit) != 0;
+		word |= bit;
+
+		return was;
+	}
+
+	// Move the top of the window up to sequence, forgetting
+	// the sequence numbers that fall off the bottom.
+	void advance(const uint64_t sequence) {
+		const uint64_t bits = mask + 1;
+
+		if (sequence - highest >= bits) {
+			std::fill(seen.begin(), seen.end(), 0);
+		}
+		else {
+			for (uint64_t n = highest + 1; n != sequence + 1; n++) {
+
+				// Whole words at a time where we can
+				if (n % 64 == 0 && sequence + 1 - n >= 64) {
+					seen[(n & mask) / 64] = 0;
+					n += 63;
+					continue;
+				}
+
+				seen[(n & mask) / 64] &= ~(uint64_t(1) << (n % 64));
+			}
+		}
+
+		highest = sequence;
+	}
+
+public:
+	boost_udp_feed_arbitrator(std::vector<boost_udp_receive_rar*> lines, handler_type handler,
+		const boost_udp_arbitrator_options& options = boost_udp_arbitrator_options())
+		: lines(std::move(lines)), handler(std::move(handler)), options(options) {
+
+		if (this->options.sequence_size < 1 || this->options.sequence_size > 8)
+			this->options.sequence_size = 4;
+
+		if (this->options.sequence_size < 8)
+			modulus = uint64_t(1) << (8 * this->options.sequence_size);
+
+		std::size_t bits = round_up_power_of_two(std::max<std::size_t>(options.window, 64));
+
+		// No point remembering more than there are
+		if (modulus && bits > modulus / 2)
+			bits = std::max<std::size_t>(modulus / 2, 64);
+
+		seen.assign(bits / 64, 0);
+		mask = bits - 1;
+
+		for (auto* rar : this->lines)
+			fds.push_back({ rar->native_handle(), POLLIN, 0 });
+
+		counters.wins.assign(this->lines.size(), 0);
+	}
+
+	boost_udp_feed_arbitrator(const boost_udp_feed_arbitrator&) = delete;
+	boost_udp_feed_arbitrator& operator=(const boost_udp_feed_arbitrator&) = delete;
+
+	//
+	// Arbitrate a datagram that came in on the given line, it's
+	// handed on if it's the first copy of its sequence number.
+	// Returns true if it was.
+	//
+	bool push(const unsigned line, const datagram_view& datagram) {
+		uint64_t raw;
+
+		if (!read_sequence(datagram, raw)) {
+			counters.malformed++;
+			return false;
+		}
+
+		// The first datagram sets where we start, a lap in
+		// so that there's room to be behind.
+		if (!started) {
+			started = true;
+			highest = raw + modulus;
+		}
+
+		const uint64_t sequence = extend(raw);
+
+		if (sequence > highest) {
+			advance(sequence);
+		}
+		else if (highest - sequence > mask) {
+			counters.stale++;
+			return false;
+		}
+
+		if (test_and_set(sequence)) {
+			counters.duplicates++;
+			return false;
+		}
+
+		counters.delivered++;
+
+		if (line < counters.wins.size())
+			counters.wins[line]++;
+
+		handler(line, wire(sequence), datagram);
+
+		return true;
+	}
+
+	//
+	// Wait up to timeout_ms milliseconds (-1 for ever) for any of
+	// the lines to have something, then arbitrate everything that's
+	// waiting. The lines are taken a datagram at a time in turn so
+	// that none gets ahead just by being read first. Returns the
+	// number of datagrams handed on.
+	//
+	std::size_t poll(const int timeout_ms, boost::system::error_code& ec) {
+		ec.clear();
+
+		for (auto& fd : fds)
+			fd.revents = 0;
+
+		const int n = ::poll(fds.data(), fds.size(), timeout_ms);
+
+		if (n < 0 && errno != EINTR)
+			ec = boost::system::error_code(errno, boost::asio::error::get_system_category());
+
+		if (n <= 0)
+			return 0;
+
+		const uint64_t before = counters.delivered;
+
+		// Which lines still have something waiting
+		std::vector<bool> ready(lines.size());
+		std::size_t waiting = 0;
+
+		for (std::size_t i = 0; i != fds.size(); i++) {
+			ready[i] = fds[i].revents != 0;
+			waiting += ready[i];
+		}
+
+		while (waiting) {
+			for (std::size_t i = 0; i != lines.size(); i++) {
+				if (!ready[i])
+					continue;
+
+				const datagram_view datagram = lines[i]->try_receive_view(ec);
+
+				if (ec == boost::asio::error::would_block) {
+					ec.clear();
+					ready[i] = false;
+					waiting--;
+					continue;
+				}
+
+				if (ec)
+					return static_cast<std::size_t>(counters.delivered - before);
+
+				push(static_cast<unsigned>(i), datagram);
+			}
+		}
+
+		return static_cast<std::size_t>(counters.delivered - before);
+	}
+
+	//
+	// The highest sequence number seen
+	//
+	uint64_t highest_seen() const noexcept {
+		return wire(highest);
+	}
+
+	boost_udp_arbitrator_stats stats() const {
+		return counters;
+	}
+};
@@ -0,0 +1,248 @@
+#pragma once
+
+//   Copyright 2022 Kevin Godden
+//
+//   Licensed under the Apache License, Version 2.0 (the "License");
+//   you may not use this file except in compliance with the License.
+//   You may obtain a copy of the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+//   Unless required by applicable law or agreed to in writing, software
+//   distributed under the License is distributed on an "AS IS" BASIS,
+//   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//   See the License for the specific language governing permissions and
+//   limitations under the License.
+
+#include "boost_udp_datagram_ring.h"
+#include "boost_udp_receive_thread.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <thread>
+#include <vector>
+
+//
+// Processes datagrams on a pool of worker threads while keeping each flow
+// in order. Every datagram is given a key (by default its sender's address
+// & port), and all datagrams with the same key go to the same worker
+// through that worker's own single producer, single consumer queue. So
+// different flows are processed in parallel but each flow is processed
+// in the order it arrived.
+//
+// dispatch() must only be called from one thread, typically the handler
+// of a boost_udp_receive_thread. With the conflate overflow policy call
+// flush() too whenever the socket is drained.
+//
+// Synopsis:
+//
+/*
+	boost_udp_dispatcher_options options;
+
+	// Key on a channel id at the start of the payload
+	options.key = [](const datagram_view& datagram) -> uint64_t {
+		return datagram.size ? datagram.data[0] : 0;
+	};
+
+	boost_udp_flow_dispatcher dispatcher(4, [](unsigned worker, const datagram_view& datagram) {
+		process(datagram);
+	}, options);
+
+	boost_udp_receive_thread thread(rar, [&](const datagram_view& datagram) {
+		dispatcher.dispatch(datagram);
+	});
+
+	...
+
+	for (const auto& worker : dispatcher.stats().workers)
+		cout << "depth " << worker.depth << endl;
+*/
+
+struct boost_udp_dispatcher_options {
+	// Slots in each worker's queue, and the biggest
+	// datagram a slot can hold.
+	std::size_t queue_capacity = 1024;
+	std::size_t max_datagram_size = 2048;
+
+	// How the queues' memory is allocated
+	boost_udp_buffer_memory memory;
+
+	// What a worker's queue does when it's full
+	boost_udp_overflow_options overflow;
+
+	// Applied to every worker thread
+	boost_udp_thread_options worker_thread;
+
+	// Gives the flow key of a datagram, if not set the
+	// sender's address & port are used.
+	std::function<uint64_t(const datagram_view&)> key;
+};
+
+struct boost_udp_dispatcher_stats {
+	struct worker {
+		// What's been through the worker's queue, and how
+		// many datagrams the worker has processed.
+		boost_udp_queue_stats queue;
+		uint64_t processed = 0;
+	};
+
+	std::vector<worker> workers;
+
+	// The busiest worker's share of the datagrams over an
+	// even share, 1.0 is perfectly balanced.
+	double imbalance = 1.0;
+};
+
+class boost_udp_flow_dispatcher {
+public:
+	using handler_type = std::function<void(unsigned worker, const datagram_view&)>;
+
+private:
+	struct worker {
+		std::unique_ptr<boost_udp_datagram_ring> queue;
+		std::atomic<uint64_t> processed{ 0 };
+		std::thread thread;
+	};
+
+	handler_type handler;
+	boost_udp_dispatcher_options options;
+
+	std::vector<std::unique_ptr<worker>> workers;
+	std::atomic<bool> stopping{ false };
+
+	// Mix the key's bits so that similar keys
+	// spread across the workers.
+	static uint64_t mix(uint64_t key) {
+		key ^= key >> 33;
+		key *= 0xff51afd7ed558ccdull;
+		key ^= key >> 33;
+		key *= 0xc4ceb9fe1a85ec53ull;
+		key ^= key >> 33;
+
+		return key;
+	}
+
+	void run(const unsigned index) {
+		boost_udp_apply_thread_options(options.worker_thread);
+
+		worker& w = *workers[index];
+		boost_udp_backoff backoff;
+		datagram_view datagram;
+
+		// Keep going until stopped and everything queued has been
+		// processed. Look at stopping before the queue, anything
+		// pushed before stop() is then sure to be seen.
+		for (;;) {
+			const bool stopped = stopping.load(std::memory_order_acquire);
+
+			if (w.queue->peek(datagram)) {
+				handler(index, datagram);
+				w.queue->pop();
+				w.processed.fetch_add(1, std::memory_order_relaxed);
+				backoff.reset();
+			}
+			else if (stopped) {
+				break;
+			}
+			else {
+				backoff.pause();
+			}
+		}
+	}
+
+public:
+	boost_udp_flow_dispatcher(const unsigned worker_count, handler_type handler,
+		const boost_udp_dispatcher_options& options = boost_udp_dispatcher_options())
+		: handler(std::move(handler)), options(options) {
+
+		if (!this->options.key)
+			this->options.key = boost_udp_sender_key;
+
+		for (unsigned i = 0; i != std::max(worker_count, 1u); i++) {
+			workers.emplace_back(new worker);
+			workers.back()->queue.reset(new boost_udp_datagram_ring(options.queue_capacity, options.max_datagram_size, options.memory, options.overflow));
+		}
+
+		// Start the threads once all the queues are there
+		for (unsigned i = 0; i != workers.size(); i++)
+			workers[i]->thread = std::thread([this, i]() { run(i); });
+	}
+
+	boost_udp_flow_dispatcher(const boost_udp_flow_dispatcher&) = delete;
+	boost_udp_flow_dispatcher& operator=(const boost_udp_flow_dispatcher&) = delete;
+
+	~boost_udp_flow_dispatcher() {
+		stop();
+	}
+
+	//
+	// The worker a datagram goes to
+	//
+	unsigned worker_for(const datagram_view& datagram) const {
+		return static_cast<unsigned>(mix(options.key(datagram)) % workers.size());
+	}
+
+	//
+	// Queue a datagram (it's copied) to its flow's worker. Returns
+	// false if the datagram was dropped by the overflow policy, it's
+	// counted in the worker's queue stats.
+	//
+	bool dispatch(const datagram_view& datagram) {
+		return workers[worker_for(datagram)]->queue->push(datagram);
+	}
+
+	//
+	// Hand over anything held back by the conflate policy
+	//
+	void flush() {
+		for (auto& w : workers)
+			w->queue->flush();
+	}
+
+	//
+	// Let the workers finish what's queued, then stop them. Stop
+	// calling dispatch() first.
+	//
+	void stop() {
+		// Anything held back goes to the workers first
+		for (auto& w : workers) {
+			boost_udp_backoff backoff;
+
+			while (w->thread.joinable() && w->queue->stats().held) {
+				w->queue->flush();
+				backoff.pause();
+			}
+		}
+
+		stopping.store(true, std::memory_order_release);
+
+		for (auto& w : workers) {
+			if (w->thread.joinable())
+				w->thread.join();
+		}
+	}
+
+	boost_udp_dispatcher_stats stats() const {
+		boost_udp_dispatcher_stats out;
+		uint64_t total = 0, busiest = 0;
+
+		for (const auto& w : workers) {
+			boost_udp_dispatcher_stats::worker ws;
+			ws.queue = w->queue->stats();
+			ws.processed = w->processed.load(std::memory_order_relaxed);
+
+			total += ws.queue.pushed;
+			busiest = std::max(busiest, ws.queue.pushed);
+
+			out.workers.push_back(ws);
+		}
+
+		if (total)
+			out.imbalance = static_cast<double>(busiest) * workers.size() / total;
+
+		return out;
+	}
+};
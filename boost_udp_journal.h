@@ -0,0 +1,572 @@
+#pragma once
+
+//   Copyright 2022 Kevin Godden
+//
+//   Licensed under the Apache License, Version 2.0 (the "License");
+//   you may not use this file except in compliance with the License.
+//   You may obtain a copy of the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+//   Unless required by applicable law or agreed to in writing, software
+//   distributed under the License is distributed on an "AS IS" BASIS,
+//   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//   See the License for the specific language governing permissions and
+//   limitations under the License.
+
+#include "boost_udp_receive_rar.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <string>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+//
+// Records every datagram, with its time stamp and sender, to a journal
+// on disk for auditing and replaying. The journal is a series of segment
+// files, prefix.000000.journal, prefix.000001.journal..., each allocated
+// at its full size up front and mapped into memory, so recording a
+// datagram is a copy into the mapping and no system calls. When a
+// segment is full the next one is started, that's the only time the
+// journal touches the file system.
+//
+// receive() receives from a boost_udp_receive_rar straight into the
+// journal, with the kernel's time stamp of when the datagram arrived
+// (SO_TIMESTAMPNS), and hands back a view of it in the journal so it
+// can be processed too. The receiver's stats() don't count these.
+// record() copies in a datagram from anywhere else, stamped with the
+// current time.
+//
+// Each record's stride is written last, so a reader mapping a segment
+// while it's being written only sees whole records. To follow a live
+// segment map it at its full size and call boost_udp_journal_layout::
+// next() from where it last stopped, a null record means nothing more
+// yet. The segment is finished once the next one exists (or the journal
+// has been closed). Even once it's truncated the last record is followed
+// by a zeroed record header, so a reader never reads past the end of the
+// file. (The replay plays finished recordings, it doesn't follow live
+// ones.)
+//
+// Single threaded, POSIX only (Linux for the kernel time stamps).
+//
+// Synopsis:
+//
+/*
+	boost::system::error_code ec;
+	boost_udp_journal journal("/data/capture/feed_a", boost_udp_journal_options(), ec);
+
+	while (rar.wait(100, ec)) {
+		for (;;) {
+			const datagram_view datagram = journal.receive(rar, ec);
+
+			if (ec)
+				break;
+
+			process(datagram);
+		}
+	}
+*/
+
+struct boost_udp_journal_options {
+	// The size of each segment file, allocated when it's started
+	std::size_t segment_size = std::size_t(256) << 20;
+
+	// The biggest datagram receive() takes, bigger ones are
+	// truncated. receive() moves on to the next segment
+	// when there's less room than this left.
+	std::size_t max_datagram_size = boost_udp_buffer_pool::max_datagram_size;
+
+	// Stamp datagrams from receive() with the time the kernel
+	// got them, otherwise the time they were received.
+	bool kernel_timestamps = true;
+
+	// Write to every page of a new segment when it's started,
+	// so recording into it never page faults.
+	bool prefault = true;
+
+	// Cut each segment down to what was written (to the next page)
+	// when it's finished with, rather than leaving it full size.
+	bool truncate_on_close = true;
+
+	// Write over segment files that are already there,
+	// otherwise finding one is an error.
+	bool overwrite = false;
+};
+
+struct boost_udp_journal_stats {
+	// Datagrams recorded and their bytes
+	uint64_t records = 0;
+	uint64_t bytes = 0;
+
+	// Segments started
+	uint64_t segments = 0;
+
+	// Datagrams cut short to max_datagram_size, and those
+	// too big for a segment, which aren't recorded.
+	uint64_t truncated = 0;
+	uint64_t oversized = 0;
+
+	// Receives that failed, and segments that couldn't
+	// be started.
+	uint64_t errors = 0;
+};
+
+//
+// The journal's layout on disk, shared by the
+// journal and whatever reads it back.
+//
+namespace boost_udp_journal_layout {
+	const uint64_t magic = 0x5241525f4a524e31ull;   // "RAR_JRN1"
+	const uint32_t version = 1;
+
+	struct segment_header {
+		uint64_t magic;
+		uint32_t version;
+
+		// Where the first record starts
+		uint32_t records_offset;
+
+		// Which segment this is, and when it was started
+		// (nanoseconds since the epoch).
+		uint64_t index;
+		int64_t created;
+	};
+
+	// Followed by size bytes of datagram, each record starts on
+	// an 8 byte boundary. A stride of 0 is the end of the records.
+	struct record {
+		// Bytes from here to the next record, written last
+		uint32_t stride;
+		uint32_t size;
+
+		// When the datagram arrived, nanoseconds since the epoch
+		int64_t timestamp;
+
+		uint16_t family;
+		uint16_t port;
+		unsigned char address[16];
+
+		uint32_t reserved;
+	};
+
+	inline std::size_t records_offset() {
+		return 64;
+	}
+
+	inline std::size_t stride(const std::size_t size) {
+		return (sizeof(record) + size + 7) & ~std::size_t(7);
+	}
+
+	inline unsigned char* payload(record* r) {
+		return reinterpret_cast<unsigned char*>(r) + sizeof(record);
+	}
+
+	inline const unsigned char* payload(const record* r) {
+		return reinterpret_cast<const unsigned char*>(r) + sizeof(record);
+	}
+
+	inline void store_sender(record* r, const boost::asio::ip::udp::endpoint& sender) {
+		const auto address = sender.address();
+		r->port = sender.port();
+		std::memset(r->address, 0, sizeof(r->address));
+
+		if (address.is_v4()) {
+			const auto bytes = address.to_v4().to_bytes();
+			r->family = 4;
+			std::memcpy(r->address, bytes.data(), bytes.size());
+		}
+		else {
+			const auto bytes = address.to_v6().to_bytes();
+			r->family = 6;
+			std::memcpy(r->address, bytes.data(), bytes.size());
+		}
+	}
+
+	inline boost::asio::ip::udp::endpoint load_sender(const record* r) {
+		if (r->family == 4) {
+			boost::asio::ip::address_v4::bytes_type bytes;
+			std::memcpy(bytes.data(), r->address, bytes.size());
+			return boost::asio::ip::udp::endpoint(boost::asio::ip::address_v4(bytes), r->port);
+		}
+
+		boost::asio::ip::address_v6::bytes_type bytes;
+		std::memcpy(bytes.data(), r->address, bytes.size());
+		return boost::asio::ip::udp::endpoint(boost::asio::ip::address_v6(bytes), r->port);
+	}
+
+	//
+	// The record at offset in a segment of size bytes, or nullptr if
+	// there isn't a whole one there (yet). offset is moved on to
+	// the next record.
+	//
+	inline const record* next(const unsigned char* segment, const std::size_t size, std::size_t& offset) {
+		if (offset + sizeof(record) > size)
+			return nullptr;
+
+		const record* r = reinterpret_cast<const record*>(segment + offset);
+		const uint32_t stride = __atomic_load_n(&r->stride, __ATOMIC_ACQUIRE);
+
+		if (!stride || stride < sizeof(record) + r->size || stride > size - offset)
+			return nullptr;
+
+		offset += stride;
+		return r;
+	}
+
+	//
+	// The name of a segment file
+	//
+	inline std::string segment_path(const std::string& prefix, const uint64_t index) {
+		char number[32];
+		std::snprintf(number, sizeof(number), ".%06llu.journal", static_cast<unsigned long long>(index));
+		return prefix + number;
+	}
+
+	// Nanoseconds since the epoch, from the vDSO so no system call
+	inline int64_t now() {
+		timespec ts;
+		::clock_gettime(CLOCK_REALTIME, &ts);
+		return int64_t(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+	}
+}
+
+class boost_udp_journal {
+	std::string prefix;
+	boost_udp_journal_options options;
+
+	// The segment being written
+	int fd = -1;
+	unsigned char* base = nullptr;
+	std::size_t used = 0;
+
+	// The next segment's index
+	uint64_t index = 0;
+
+	boost::system::error_code open_ec;
+	boost_udp_journal_stats counters;
+
+	// The socket we've turned time stamps on for
+	int timestamped = -1;
+	boost::asio::ip::udp::endpoint sender;
+
+	static boost::system::error_code last_error() {
+		return boost::system::error_code(errno, boost::system::system_category());
+	}
+
+	boost::system::error_code start_segment() {
+		using namespace boost_udp_journal_layout;
+
+		const std::string path = segment_path(prefix, index);
+		const int flags = O_RDWR | O_CREAT | O_CLOEXEC | (options.overwrite ? O_TRUNC : O_EXCL);
+
+		fd = ::open(path.c_str(), flags, 0644);
+
+		if (fd < 0)
+			return last_error();
+
+		// Allocate the blocks now, so a full disk shows up
+		// here rather than as a SIGBUS later.
+		int error = ::posix_fallocate(fd, 0, static_cast<off_t>(options.segment_size));
+
+		if (error == EOPNOTSUPP || error == EINVAL)
+			error = ::ftruncate(fd, static_cast<off_t>(options.segment_size)) == 0 ? 0 : errno;
+
+		int map_flags = MAP_SHARED;
+
+#ifdef MAP_POPULATE
+		map_flags |= MAP_POPULATE;
+#endif
+
+		void* p = error ? MAP_FAILED : ::mmap(nullptr, options.segment_size, PROT_READ | PROT_WRITE, map_flags, fd, 0);
+
+		if (p == MAP_FAILED) {
+			if (!error)
+				error = errno;
+
+			::close(fd);
+			::unlink(path.c_str());
+			fd = -1;
+
+			return boost::system::error_code(error, boost::system::system_category());
+		}
+
+		base = static_cast<unsigned char*>(p);
+
+		// Dirty every page now rather than on the
+		// first write to each.
+		if (options.prefault) {
+			const std::size_t page = static_cast<std::size_t>(::sysconf(_SC_PAGESIZE));
+
+			for (std::size_t i = 0; i < options.segment_size; i += page)
+				base[i] = 0;
+		}
+
+		segment_header* header = reinterpret_cast<segment_header*>(base);
+		header->magic = magic;
+		header->version = version;
+		header->records_offset = static_cast<uint32_t>(records_offset());
+		header->index = index;
+		header->created = now();
+
+		used = records_offset();
+		index++;
+		counters.segments++;
+
+		return{};
+	}
+
+	void finish_segment() {
+		if (!base)
+			return;
+
+		::munmap(base, options.segment_size);
+		base = nullptr;
+
+		// Keep a zeroed record header past the last record, rounded
+		// up to a page, so a reader following the segment finds the
+		// end instead of a SIGBUS.
+		const std::size_t page = static_cast<std::size_t>(::sysconf(_SC_PAGESIZE));
+		const std::size_t keep = std::min(options.segment_size, (used + sizeof(boost_udp_journal_layout::record) + page - 1) / page * page);
+
+		if (options.truncate_on_close && ::ftruncate(fd, static_cast<off_t>(keep)) != 0)
+			counters.errors++;
+
+		::close(fd);
+		fd = -1;
+	}
+
+	// Room for a record of size bytes, moving on to the next
+	// segment if this one's full. nullptr if there's no room.
+	boost_udp_journal_layout::record* reserve(const std::size_t size, boost::system::error_code& ec) {
+		const std::size_t stride = boost_udp_journal_layout::stride(size);
+
+		if (used + stride > options.segment_size) {
+			finish_segment();
+
+			ec = open_ec = start_segment();
+
+			if (ec) {
+				counters.errors++;
+				return nullptr;
+			}
+		}
+
+		return reinterpret_cast<boost_udp_journal_layout::record*>(base + used);
+	}
+
+	// Fill in the header, the stride last so that
+	// readers never see half a record.
+	void commit(boost_udp_journal_layout::record* r, const std::size_t size, const int64_t timestamp,
+		const boost::asio::ip::udp::endpoint& from) noexcept {
+
+		const std::size_t stride = boost_udp_journal_layout::stride(size);
+
+		r->size = static_cast<uint32_t>(size);
+		r->timestamp = timestamp;
+		r->reserved = 0;
+		boost_udp_journal_layout::store_sender(r, from);
+
+		__atomic_store_n(&r->stride, static_cast<uint32_t>(stride), __ATOMIC_RELEASE);
+
+		used += stride;
+		counters.records++;
+		counters.bytes += size;
+	}
+
+	boost::system::error_code open() {
+		// Whatever the options, a record must fit in a segment
+		const std::size_t room = options.segment_size > boost_udp_journal_layout::records_offset() + sizeof(boost_udp_journal_layout::record)
+			? options.segment_size - boost_udp_journal_layout::records_offset() - sizeof(boost_udp_journal_layout::record) - 7 : 0;
+
+		if (room == 0 || room > UINT32_MAX)
+			return boost::system::errc::make_error_code(boost::system::errc::invalid_argument);
+
+		options.max_datagram_size = std::min(options.max_datagram_size, room);
+
+		return start_segment();
+	}
+
+public:
+	//
+	// Start a journal of segment files named prefix.000000.journal
+	// and so on, any error is reported in ec (and by open_error()).
+	//
+	boost_udp_journal(const std::string& prefix, const boost_udp_journal_options& options, boost::system::error_code& ec)
+		: prefix(prefix), options(options) {
+
+		ec = open_ec = open();
+	}
+
+	//
+	// Throws boost::system::system_error if the first segment can't
+	// be started, when built without exceptions check open_error().
+	//
+	explicit boost_udp_journal(const std::string& prefix, const boost_udp_journal_options& options = boost_udp_journal_options())
+		: prefix(prefix), options(options) {
+
+		open_ec = open();
+
+#ifndef BOOST_UDP_RECEIVE_RAR_NO_EXCEPTIONS
+		if (open_ec)
+			boost::throw_exception(boost::system::system_error(open_ec));
+#endif
+	}
+
+	boost_udp_journal(const boost_udp_journal&) = delete;
+	boost_udp_journal& operator=(const boost_udp_journal&) = delete;
+
+	~boost_udp_journal() {
+		finish_segment();
+	}
+
+	const boost::system::error_code& open_error() const noexcept {
+		return open_ec;
+	}
+
+	boost_udp_journal_stats stats() const noexcept {
+		return counters;
+	}
+
+	//
+	// The segment being written, and its file. no_segment
+	// and an empty path if there isn't one open.
+	//
+	static const uint64_t no_segment = ~uint64_t(0);
+
+	uint64_t segment() const noexcept {
+		return base ? index - 1 : no_segment;
+	}
+
+	std::string path() const {
+		return base ? boost_udp_journal_layout::segment_path(prefix, index - 1) : std::string();
+	}
+
+	//
+	// Record a datagram that arrived at timestamp (nanoseconds since
+	// the epoch). Returns false if it's too big for a segment or
+	// the next segment couldn't be started.
+	//
+	bool record(const datagram_view& datagram, const int64_t timestamp) noexcept {
+		if (open_ec)
+			return false;
+
+		if (boost_udp_journal_layout::stride(datagram.size) > options.segment_size - boost_udp_journal_layout::records_offset()) {
+			counters.oversized++;
+			return false;
+		}
+
+		boost::system::error_code ec;
+		boost_udp_journal_layout::record* r = reserve(datagram.size, ec);
+
+		if (!r)
+			return false;
+
+		std::memcpy(boost_udp_journal_layout::payload(r), datagram.data, datagram.size);
+		commit(r, datagram.size, timestamp, datagram.sender);
+
+		return true;
+	}
+
+	//
+	// Record a datagram stamped with the time now
+	//
+	bool record(const datagram_view& datagram) noexcept {
+		return record(datagram, boost_udp_journal_layout::now());
+	}
+
+	//
+	// Receive a datagram from the socket straight into the journal,
+	// never blocks. ec is boost::asio::error::would_block once there's
+	// nothing waiting. The view is of the datagram in the journal,
+	// valid until the journal moves on to its next segment, so only
+	// count on it until the next receive() or record().
+	//
+	datagram_view receive(boost_udp_receive_rar& rar, boost::system::error_code& ec) noexcept {
+		ec = open_ec;
+
+		if (ec)
+			return{};
+
+		boost_udp_journal_layout::record* r = reserve(options.max_datagram_size, ec);
+
+		if (!r)
+			return{};
+
+		const int socket = rar.native_handle();
+
+#ifdef SO_TIMESTAMPNS
+		if (options.kernel_timestamps && timestamped != socket) {
+			const int on = 1;
+			::setsockopt(socket, SOL_SOCKET, SO_TIMESTAMPNS, &on, sizeof(on));
+			timestamped = socket;
+		}
+#endif
+
+		iovec io = { boost_udp_journal_layout::payload(r), options.max_datagram_size };
+		alignas(cmsghdr) unsigned char control[CMSG_SPACE(sizeof(timespec))];
+
+		msghdr message;
+		std::memset(&message, 0, sizeof(message));
+		message.msg_name = sender.data();
+		message.msg_namelen = static_cast<socklen_t>(sender.capacity());
+		message.msg_iov = &io;
+		message.msg_iovlen = 1;
+		message.msg_control = control;
+		message.msg_controllen = sizeof(control);
+
+		const ssize_t received = ::recvmsg(socket, &message, MSG_DONTWAIT);
+
+		if (received < 0) {
+			ec = boost::system::error_code(errno, boost::asio::error::get_system_category());
+
+			if (ec == boost::asio::error::would_block || ec == boost::asio::error::try_again)
+				ec = boost::asio::error::would_block;
+			else
+				counters.errors++;
+
+			return{};
+		}
+
+		sender.resize(message.msg_namelen);
+
+		if (message.msg_flags & MSG_TRUNC)
+			counters.truncated++;
+
+		int64_t timestamp = 0;
+
+#ifdef SCM_TIMESTAMPNS
+		for (cmsghdr* c = CMSG_FIRSTHDR(&message); c; c = CMSG_NXTHDR(&message, c)) {
+			if (c->cmsg_level == SOL_SOCKET && c->cmsg_type == SCM_TIMESTAMPNS) {
+				timespec ts;
+				std::memcpy(&ts, CMSG_DATA(c), sizeof(ts));
+				timestamp = int64_t(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+			}
+		}
+#endif
+
+		if (!timestamp)
+			timestamp = boost_udp_journal_layout::now();
+
+		const std::size_t size = std::min<std::size_t>(static_cast<std::size_t>(received), options.max_datagram_size);
+		commit(r, size, timestamp, sender);
+
+		return datagram_view(boost_udp_journal_layout::payload(r), size, sender);
+	}
+
+	//
+	// Ask the kernel to start writing what's been recorded out to
+	// disk, or with wait, to finish doing so before returning.
+	// A system call, so not one for the receive path.
+	//
+	bool flush(const bool wait = false) noexcept {
+		return base && ::msync(base, used, wait ? MS_SYNC : MS_ASYNC) == 0;
+	}
+};
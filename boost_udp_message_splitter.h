@@ -0,0 +1,197 @@
+#pragma once
+
+//   Copyright 2022 Kevin Godden
+//
+//   Licensed under the Apache License, Version 2.0 (the "License");
+//   you may not use this file except in compliance with the License.
+//   You may obtain a copy of the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+//   Unless required by applicable law or agreed to in writing, software
+//   distributed under the License is distributed on an "AS IS" BASIS,
+//   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//   See the License for the specific language governing permissions and
+//   limitations under the License.
+
+#include "boost_udp_receive_rar.h"
+#include "boost_udp_byte_order.h"
+
+#include <cstdint>
+#include <iterator>
+
+//
+// Walks the messages packed into a datagram, for protocols that put
+// several length prefixed messages in each one (MoldUDP64 and friends).
+// Each message is handed out as a datagram_view pointing into the
+// datagram, so nothing is copied, and the views are valid for as long
+// as the datagram's.
+//
+// The layout is given at compile time: the size of the header, where
+// its message count is (and its size, 0 for no count, in which case
+// messages run to the end of the datagram) and the size of each
+// message's length prefix, all big or all little endian.
+//
+// A message whose length runs past the end of the datagram ends the
+// walk, complete() says whether all of the messages were there.
+//
+// Synopsis:
+//
+/*
+	const datagram_view datagram = rar.receive_view_sync();
+
+	for (const datagram_view& message : boost_udp_split<boost_udp_moldudp64_layout>(datagram))
+		process(message.data, message.size);
+*/
+
+template <std::size_t HeaderSize, std::size_t CountOffset, std::size_t CountSize, std::size_t LengthSize, bool BigEndian = true>
+struct boost_udp_message_layout {
+	static_assert(CountSize == 0 || CountOffset + CountSize <= HeaderSize, "the count must be in the header");
+	static_assert(LengthSize >= 1 && LengthSize <= 8, "lengths are 1 to 8 bytes");
+
+	static const std::size_t header_size = HeaderSize;
+	static const std::size_t count_offset = CountOffset;
+	static const std::size_t count_size = CountSize;
+	static const std::size_t length_size = LengthSize;
+	static const bool big_endian = BigEndian;
+};
+
+// Session (10), sequence number (8), message count (2), then
+// each message with a 2 byte length, all big endian.
+using boost_udp_moldudp64_layout = boost_udp_message_layout<20, 18, 2, 2>;
+
+template <typename Layout>
+class boost_udp_messages {
+	datagram_view datagram;
+
+	// Messages the header says there are, or as many
+	// as fit if there's no count.
+	uint64_t declared = 0;
+	bool has_header = false;
+
+public:
+	class iterator {
+		const unsigned char* p = nullptr;
+		const unsigned char* last = nullptr;
+		uint64_t remaining = 0;
+
+		datagram_view message;
+
+		// Read the message at p, or become
+		// the end if there isn't a whole one.
+		void read() {
+			if (!remaining || static_cast<std::size_t>(last - p) < Layout::length_size) {
+				p = nullptr;
+				return;
+			}
+
+			const uint64_t size = boost_udp_read_uint<Layout::length_size, Layout::big_endian>(p);
+
+			if (size > static_cast<uint64_t>(last - p) - Layout::length_size) {
+				p = nullptr;
+				return;
+			}
+
+			message = datagram_view(p + Layout::length_size, static_cast<std::size_t>(size));
+		}
+
+	public:
+		using iterator_category = std::forward_iterator_tag;
+		using value_type = datagram_view;
+		using difference_type = std::ptrdiff_t;
+		using pointer = const datagram_view*;
+		using reference = const datagram_view&;
+
+		iterator() = default;
+
+		iterator(const unsigned char* first, const unsigned char* last, const uint64_t count)
+			: p(first), last(last), remaining(count) {
+			read();
+		}
+
+		reference operator*() const { return message; }
+		pointer operator->() const { return &message; }
+
+		iterator& operator++() {
+			p = message.end();
+			remaining--;
+			read();
+			return *this;
+		}
+
+		iterator operator++(int) {
+			iterator before = *this;
+			++*this;
+			return before;
+		}
+
+		bool operator==(const iterator& other) const { return p == other.p; }
+		bool operator!=(const iterator& other) const { return p != other.p; }
+	};
+
+	explicit boost_udp_messages(const datagram_view& datagram) : datagram(datagram) {
+		has_header = datagram.size >= Layout::header_size;
+
+		if (!has_header)
+			return;
+
+		if (Layout::count_size)
+			declared = boost_udp_read_uint<Layout::count_size ? Layout::count_size : 1, Layout::big_endian>(datagram.data + Layout::count_offset);
+		else
+			declared = UINT64_MAX;
+	}
+
+	iterator begin() const {
+		if (!has_header)
+			return end();
+
+		return iterator(datagram.data + Layout::header_size, datagram.end(), declared);
+	}
+
+	iterator end() const {
+		return iterator();
+	}
+
+	//
+	// The header, empty if the datagram is too short for one
+	//
+	datagram_view header() const {
+		return has_header ? datagram_view(datagram.data, Layout::header_size, datagram.sender) : datagram_view();
+	}
+
+	//
+	// The message count from the header, 0 if there's
+	// no header or the layout has no count.
+	//
+	uint64_t count() const {
+		return has_header && Layout::count_size ? declared : 0;
+	}
+
+	//
+	// Whether the header and all of the messages it declares
+	// were there, and nothing after them (when there's no
+	// count, whether the messages exactly fill the datagram).
+	//
+	bool complete() const {
+		if (!has_header)
+			return false;
+
+		const unsigned char* p = datagram.data + Layout::header_size;
+		uint64_t found = 0;
+
+		for (auto i = begin(); i != end(); ++i) {
+			p = i->end();
+			found++;
+		}
+
+		return p == datagram.end() && (!Layout::count_size || found == declared);
+	}
+};
+
+//
+// The messages in a datagram laid out as Layout describes
+//
+template <typename Layout>
+inline boost_udp_messages<Layout> boost_udp_split(const datagram_view& datagram) {
+	return boost_udp_messages<Layout>(datagram);
+}
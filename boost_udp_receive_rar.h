@@ -15,9 +15,29 @@
 //   limitations under the License.
 
 #include <boost/asio.hpp>
+#include <boost/throw_exception.hpp>
+#include <algorithm>
+#include <memory>
 #include <string>
+#include <thread>
+#include <utility>
 #include <vector>
 
+#include "boost_udp_buffer_pool.h"
+
+#ifndef _WIN32
+#include <poll.h>
+#include <sys/socket.h>
+#endif
+
+// Build with -fno-exceptions (or define BOOST_NO_EXCEPTIONS) and
+// the throwing receive calls are left out, leaving only the
+// error_code overloads. As with the rest of boost you then have to
+// provide your own boost::throw_exception().
+#if defined(BOOST_NO_EXCEPTIONS) && !defined(BOOST_UDP_RECEIVE_RAR_NO_EXCEPTIONS)
+#define BOOST_UDP_RECEIVE_RAR_NO_EXCEPTIONS
+#endif
+
 //
 // 
 //
@@ -27,11 +47,18 @@
 // then just use the boost::asio functionality directly!
 //
 // The socket is opened & bound, and a buffer (~65KB) is allocated
-// as soon as an object of this class is created. To keep things simple
-// some data copies are performed.
+// as soon as an object of this class is created (unless lazy_buffers
+// is set in the options, then buffers are only allocated when the first
+// datagram is received). To keep things simple
+// some data copies are performed, the receive_view_async() variant
+// hands out a view of the receive buffer instead for when copies hurt.
 //
 // This class is not thread safe and should only be used from a single thread
 //
+// Every receive call has an overload taking a boost::system::error_code&
+// that reports errors (including those from async receives) instead of
+// throwing, the view returning ones are noexcept.
+//
 // Receive and Rejoice! (RAR)
 //
 // Synopsis:
@@ -80,117 +107,486 @@
 	} while (data.empty());
 
 	cout << "Sync, received a datagram of size " << data.size() << endl;
+
+	// Or without a copy, the view is valid until the next
+	// async receive call. A receive stays posted on one of the
+	// receiver's buffers while we look at the view.
+	datagram_view view;
+
+	do {
+		view = rar.receive_view_async();
+	} while (view.empty());
 */
 
+//
+// A view of a received datagram that still lives in one of the
+// receiver's internal buffers, no copy is made. The view is only
+// valid until the next receive call on the same receiver.
+//
+struct datagram_view {
+	const unsigned char* data = nullptr;
+	std::size_t size = 0;
+
+	// Who sent it
+	boost::asio::ip::udp::endpoint sender;
+
+	datagram_view() = default;
+	datagram_view(const unsigned char* d, const std::size_t n) : data(d), size(n) {}
+	datagram_view(const unsigned char* d, const std::size_t n, const boost::asio::ip::udp::endpoint& from) : data(d), size(n), sender(from) {}
+
+	const unsigned char* begin() const { return data; }
+	const unsigned char* end() const { return data + size; }
+	bool empty() const { return size == 0; }
+};
+
+//
+// The (few!) knobs that can be turned on a receiver, the defaults
+// are what you get with the plain two argument constructor.
+//
+struct boost_udp_receive_rar_options {
+	// The number of buffers the async receive path rotates through.
+	// A receive is kept posted on one of them while the others hold
+	// datagrams waiting to be collected by the caller, so bursts
+	// are drained without a gap where no receive is outstanding.
+	std::size_t async_buffers = 2;
+
+	// The size of each receive buffer, datagrams bigger than
+	// this are truncated. The default holds the biggest
+	// possible UDP datagram.
+	std::size_t buffer_size = boost_udp_buffer_pool::max_datagram_size;
+
+	// Don't allocate any buffers until the first receive call,
+	// handy when lots of receivers are set up at once and many
+	// of them might never see any traffic.
+	bool lazy_buffers = false;
+
+	// How the receiver's own buffers are allocated, huge pages,
+	// pre-faulting, locking and NUMA node. A shared pool has its
+	// own settings.
+	boost_udp_buffer_memory memory;
+
+	// If set, buffers are taken from (and given back to) this
+	// pool rather than allocated by each receiver. The pool's
+	// buffer size is used in place of buffer_size.
+	std::shared_ptr<boost_udp_buffer_pool> pool;
+
+	// Set SO_REUSEPORT so that several receivers can bind the
+	// same address & port, the kernel shares the datagrams out
+	// between them (see boost_udp_socket_filter.h for choosing
+	// how). Not available on Windows.
+	bool reuse_port = false;
+};
+
+//
+// What a receiver has been up to, and where its buffers live
+//
+struct boost_udp_receive_rar_stats {
+	// Datagrams (and their bytes) handed to the caller
+	std::size_t datagrams = 0;
+	std::size_t bytes = 0;
+
+	// Receives that reported an error
+	std::size_t errors = 0;
+
+	// How the buffer memory was set up, including its
+	// NUMA node. For a shared pool this covers the
+	// whole pool.
+	boost_udp_buffer_placement placement;
+};
+
 class boost_udp_receive_rar {
 	// Some boost::asio necessaries!
 	boost::asio::io_service io_service;
 	boost::asio::ip::udp::socket socket;
 	boost::asio::ip::udp::endpoint endpoint;
 
-	// Holds the received data for async receives
-	std::vector<unsigned char> buffer;
+	// Where our buffers come from, either shared with other
+	// receivers or just for us.
+	std::shared_ptr<boost_udp_buffer_pool> pool;
+
+	// Holds the received data for sync receives,
+	// and who sent it.
+	unsigned char* buffer = nullptr;
+	boost::asio::ip::udp::endpoint sender;
+
+	// One of the rotating async receive buffers
+	struct async_slot {
+		unsigned char* data = nullptr;
+
+		// The number of bytes received into
+		// this buffer.
+		size_t bytesRead = 0;
+
+		// How the receive into this buffer went
+		boost::system::error_code ec;
+
+		boost::asio::ip::udp::endpoint sender;
+
+		// Holds a datagram (or an error) that hasn't
+		// been handed back to us by the caller yet.
+		bool full = false;
+	};
+
+	std::vector<async_slot> slots;
+
+	// The slot the posted async receive writes to
+	size_t post_slot = 0;
+
+	// The next slot to hand to the caller
+	size_t read_slot = 0;
+
+	// The slot currently lent to the caller as
+	// a datagram_view, if any.
+	size_t lent_slot = 0;
+	bool lent = false;
 
 	// Is there an async receive in progress?
 	bool in_receive = false;
 
-	// The number of bytes received
-	// by async receive.
-	size_t bytesRead = 0;
+	// Anything that went wrong while opening
+	// the socket.
+	boost::system::error_code open_ec;
+
+	boost_udp_receive_rar_stats counters;
+
+	// Count a datagram (or error) handed to the caller
+	datagram_view counted(const datagram_view& datagram, const boost::system::error_code& ec) noexcept {
+		if (ec) {
+			counters.errors++;
+			return{};
+		}
+
+		counters.datagrams++;
+		counters.bytes += datagram.size;
+
+		return datagram;
+	}
+
+	// Post an async receive into the current post slot, the
+	// completion handler fills the slot and immediately posts
+	// the next receive if there is a free slot for it.
+	void post_receive() {
+		in_receive = true;
+
+		socket.async_receive_from(boost::asio::buffer(slots[post_slot].data, pool->size()), slots[post_slot].sender, 0,
+			[this](boost::system::error_code ec, std::size_t N)
+		{
+			// Errors are queued up in order with the datagrams
+			// and reported when the caller reaches them.
+			async_slot& slot = slots[post_slot];
+			slot.bytesRead = N;
+			slot.ec = ec;
+			slot.full = true;
+
+			post_slot = (post_slot + 1) % slots.size();
+			in_receive = false;
+
+			// Keep a receive armed if we can, if all
+			// buffers are full then the next call to
+			// receive_view_async() will re-arm. We don't
+			// re-arm after an error, otherwise a broken
+			// socket would just spin.
+			if (!ec && !slots[post_slot].full)
+				post_receive();
+		}
+
+		);
+	}
+
+	// Make sure we have the sync receive buffer
+	bool acquire_sync_buffer(boost::system::error_code& ec) noexcept {
+		if (!buffer)
+			buffer = pool->acquire();
+
+		if (!buffer)
+			ec = boost::asio::error::no_buffer_space;
+
+		return buffer;
+	}
+
+	// Make sure we have all of the async receive buffers
+	bool acquire_async_buffers(boost::system::error_code& ec) noexcept {
+		for (auto& slot : slots) {
+			if (!slot.data)
+				slot.data = pool->acquire();
+
+			if (!slot.data) {
+				ec = boost::asio::error::no_buffer_space;
+				return false;
+			}
+		}
+
+		return true;
+	}
+
+	// Give all our buffers back to the pool
+	void release_buffers() noexcept {
+		// Close first so that no pending receive can
+		// touch the buffers once they're back in the pool.
+		boost::system::error_code ignored;
+		socket.close(ignored);
+
+		if (!pool)
+			return;
+
+		pool->release(buffer);
+		buffer = nullptr;
+
+		for (auto& slot : slots) {
+			pool->release(slot.data);
+			slot.data = nullptr;
+		}
+	}
+
+	// Open & bind the socket and set up the buffers,
+	// the first thing that fails is returned.
+	boost::system::error_code open_socket(const std::string& ip_address, const int port,
+		const boost_udp_receive_rar_options& options) {
+
+		boost::system::error_code ec;
+
+		// Open socket & make/bind endpoint
+		socket.open(boost::asio::ip::udp::v4(), ec);
+
+		if (ec)
+			return ec;
+
+		const auto address = boost::asio::ip::address::from_string(ip_address, ec);
+
+		if (ec)
+			return ec;
+
+#ifdef SO_REUSEPORT
+		if (options.reuse_port) {
+			socket.set_option(boost::asio::detail::socket_option::boolean<SOL_SOCKET, SO_REUSEPORT>(true), ec);
+
+			if (ec)
+				return ec;
+		}
+#else
+		if (options.reuse_port)
+			return boost::asio::error::operation_not_supported;
+#endif
+
+		endpoint = boost::asio::ip::udp::endpoint(address, port);
+		socket.bind(endpoint, ec);
+
+		if (ec)
+			return ec;
+
+		// We need at least one async buffer!
+		slots.resize(std::max<std::size_t>(options.async_buffers, 1));
+
+		// Without a shared pool we make one just big enough
+		// for our own buffers, allocated in one go.
+		pool = options.pool;
+
+		if (!pool)
+			pool = std::make_shared<boost_udp_buffer_pool>(options.buffer_size, slots.size() + 1, options.memory);
+
+		// Unless asked to wait, grab all the
+		// buffers now.
+		if (!options.lazy_buffers) {
+			acquire_sync_buffer(ec);
+			acquire_async_buffers(ec);
+		}
+
+		return ec;
+	}
 
 public:
 	// Construct with IP address an port, note that the IP address is the 
 	// address of the network interface on the _receiving_ computer on which you
 	// want to receive UDP data.
-	boost_udp_receive_rar(const std::string& ip_address, const int port) : socket(io_service) {
+	//
+	// Throws boost::system::system_error if the socket can't be opened, when
+	// built without exceptions check open_error() instead.
+	boost_udp_receive_rar(const std::string& ip_address, const int port,
+		const boost_udp_receive_rar_options& options = boost_udp_receive_rar_options()) : socket(io_service) {
+
+		open_ec = open_socket(ip_address, port, options);
+
+#ifndef BOOST_UDP_RECEIVE_RAR_NO_EXCEPTIONS
+		if (open_ec) {
+			// The destructor won't run, so tidy up here
+			release_buffers();
+			boost::throw_exception(boost::system::system_error(open_ec));
+		}
+#endif
+	}
 
-		// Open socket & make/bind endpoint
-		socket.open(boost::asio::ip::udp::v4());
-		endpoint = boost::asio::ip::udp::endpoint(boost::asio::ip::address::from_string(ip_address), port);
-		socket.bind(endpoint);
+	// As above but never throws, any error is reported in ec
+	// (and by open_error()) and the receiver is left unusable.
+	boost_udp_receive_rar(const std::string& ip_address, const int port,
+		const boost_udp_receive_rar_options& options, boost::system::error_code& ec) : socket(io_service) {
 
-		// Figure out how big the datagrams can be and
-		// create a buffer big enough to hold this amount
-		// of received bytes.
-		boost::asio::socket_base::receive_buffer_size option;
-		socket.get_option(option);
-		const int size = option.value();
+		ec = open_ec = open_socket(ip_address, port, options);
+	}
 
-		// Make sure vector has enough space.
-		buffer.resize(size);
+	boost_udp_receive_rar(const std::string& ip_address, const int port, boost::system::error_code& ec)
+		: boost_udp_receive_rar(ip_address, port, boost_udp_receive_rar_options(), ec) {
+	}
+
+	// The receiver hands out pointers into its own
+	// buffers, so it can't be copied or moved.
+	boost_udp_receive_rar(const boost_udp_receive_rar&) = delete;
+	boost_udp_receive_rar& operator=(const boost_udp_receive_rar&) = delete;
+
+	~boost_udp_receive_rar() {
+		release_buffers();
 	}
 
 	//
-	// Receive a binary UDP Datagram asynchronously
-	// If no datagram has been received, then
-	// an empty vector is returned.
+	// Create and bind a receiver for each (IP address, port) pair, spread
+	// over a number of threads so that opening lots of ports at start up
+	// doesn't take forever. Receivers that failed to open are left in the
+	// result with their error in open_error(), it is also stored in the
+	// matching element of errors.
 	//
-	std::vector<unsigned char> receive_binary_async() {
+	// Combine with lazy_buffers (and a shared pool) to keep start up
+	// cheap when there are thousands of ports.
+	//
+	static std::vector<std::unique_ptr<boost_udp_receive_rar>> open_all(
+		const std::vector<std::pair<std::string, int>>& addresses,
+		const boost_udp_receive_rar_options& options,
+		std::vector<boost::system::error_code>& errors,
+		unsigned threads = std::thread::hardware_concurrency()) {
 
-		// Is there already an async receive
-		// in progress?
-		if (in_receive) {
+		std::vector<std::unique_ptr<boost_udp_receive_rar>> receivers(addresses.size());
+		errors.assign(addresses.size(), boost::system::error_code());
 
-			// Yes, let's see if any data has arrived..
-			if (bytesRead && bytesRead > 0) {
-				// Looks like we have some data, lets grab and
-				// return it in a vector<>
-				std::vector<unsigned char> out;
-				out.resize(bytesRead);
+		threads = std::max(1u, std::min<unsigned>(threads, static_cast<unsigned>(addresses.size())));
 
-				// Copy N bytes to the output vector.
-				std::copy_n(buffer.begin(), bytesRead, out.begin());
+		// Each thread takes every Nth address
+		auto open_some = [&](const unsigned first) {
+			for (std::size_t i = first; i < addresses.size(); i += threads) {
+				receivers[i].reset(new boost_udp_receive_rar(addresses[i].first, addresses[i].second, options, errors[i]));
+			}
+		};
 
-				// Mark async receive as complete
-				// so that the caller can setup a new
-				// read they want to.
-				in_receive = false;
+		std::vector<std::thread> workers;
 
-				// Hopefully the compiler will perform 
-				// Return Value Optimisation on this vector!
-				return out;
-			}
-			else {
-				// No data received yet, let's get
-				// boost::asio to check again.
+		for (unsigned t = 1; t < threads; t++)
+			workers.emplace_back(open_some, t);
 
-				// We have to do this so that we can
-				// receive more than 1 async message!
-				if (io_service.stopped())
-					io_service.reset();
+		open_some(0);
 
-				io_service.poll_one();
-			}
+		for (auto& worker : workers)
+			worker.join();
 
-		}
-		else {
-			// There is no async receive already in progress
-			// so let's start one now.
-
-			// Clear flags
-			bytesRead = 0;
-
-			// Mark async receive in progress.
-			in_receive = true;
-
-			// Setup a boost::asio async receive providing a receive 
-			// complete handler as a lambda
-			socket.async_receive(boost::asio::buffer(buffer), 0,
-				[&](boost::system::error_code ec, std::size_t N)
-			{
-				// This lambda will be called when the receive
-				// completes, we just set the number of bytes
-				// received, and the next time receive_async()
-				// is called the data will be returned to the
-				// caller.
-				bytesRead = N;
-			}
+		return receivers;
+	}
+
+#ifndef BOOST_UDP_RECEIVE_RAR_NO_EXCEPTIONS
+	//
+	// As above, but throws boost::system::system_error for
+	// the first address that couldn't be opened.
+	//
+	static std::vector<std::unique_ptr<boost_udp_receive_rar>> open_all(
+		const std::vector<std::pair<std::string, int>>& addresses,
+		const boost_udp_receive_rar_options& options = boost_udp_receive_rar_options(),
+		unsigned threads = std::thread::hardware_concurrency()) {
+
+		std::vector<boost::system::error_code> errors;
+		auto receivers = open_all(addresses, options, errors, threads);
 
-			);
+		for (const auto& ec : errors)
+			throw_if(ec);
+
+		return receivers;
+	}
+#endif
+
+	//
+	// The error, if any, from opening & binding
+	// the socket when the receiver was constructed.
+	//
+	const boost::system::error_code& open_error() const noexcept {
+		return open_ec;
+	}
+
+	//
+	// Counters, and where the buffers were placed. Note that with
+	// lazy_buffers nothing is placed until the first receive.
+	//
+	boost_udp_receive_rar_stats stats() const {
+		boost_udp_receive_rar_stats out = counters;
+
+		if (pool)
+			out.placement = pool->placement();
+
+		return out;
+	}
+
+	//
+	// Receive a UDP Datagram asynchronously without
+	// copying it. If no datagram has been received then
+	// an empty view is returned and ec is clear, if the
+	// receive failed ec holds the error.
+	//
+	// The returned view points into one of the async
+	// buffers and stays valid until the next async
+	// receive call, datagrams keep being received into
+	// the other buffers in the meantime.
+	//
+	datagram_view receive_view_async(boost::system::error_code& ec) noexcept {
+		ec = open_ec;
+
+		if (ec || !acquire_async_buffers(ec))
+			return{};
+
+		// Take back the buffer we lent out
+		// on the previous call.
+		if (lent) {
+			slots[lent_slot].full = false;
+			lent = false;
 		}
 
+		// Make sure that a receive is armed, this is
+		// the first call or all the buffers were full.
+		if (!in_receive && !slots[post_slot].full)
+			post_receive();
+
+		// Let boost::asio run any completed receives,
+		// each of which re-arms the next one.
+		// We have to do this so that we can
+		// receive more than 1 async message!
+		if (io_service.stopped())
+			io_service.reset();
+
+		io_service.poll();
+
+		async_slot& slot = slots[read_slot];
+
 		// Nothing received yet!
-		return{};
+		if (!slot.full)
+			return{};
+
+		// Lend the filled buffer to the caller,
+		// or hand back the error it holds.
+		lent_slot = read_slot;
+		lent = true;
+		read_slot = (read_slot + 1) % slots.size();
+
+		ec = slot.ec;
+
+		return counted(datagram_view(slot.data, slot.bytesRead, slot.sender), ec);
+	}
+
+	//
+	// Receive a binary UDP Datagram asynchronously
+	// If no datagram has been received, then
+	// an empty vector is returned.
+	//
+	std::vector<unsigned char> receive_binary_async(boost::system::error_code& ec) {
+
+		// Grab a view of the datagram and copy
+		// it out to a vector<>
+		const datagram_view datagram = receive_view_async(ec);
+
+		// Hopefully the compiler will perform 
+		// Return Value Optimisation on this vector!
+		return std::vector<unsigned char>(datagram.begin(), datagram.end());
 	}
 
 	//
@@ -198,11 +594,11 @@ public:
 	// If no datagram has been received, then
 	// an empty string is returned.
 	//
-	std::string receive_async() {
-		// Get the datagram as binary
-		const auto datagram = receive_binary_async();
+	std::string receive_async(boost::system::error_code& ec) {
+		// Get a view of the datagram
+		const datagram_view datagram = receive_view_async(ec);
 
-		// If we got back an empty vector, then
+		// If we got back an empty view, then
 		// nothing was received, return empty string.
 		if (datagram.empty())
 			return{};
@@ -211,26 +607,131 @@ public:
 		return std::string(datagram.begin(), datagram.end());
 	}
 
+	//
+	// Receive a UDP Datagram synchronously without
+	// copying it. This function will block until a
+	// datagram is received or an error occurs.
+	//
+	// The returned view points into the sync receive
+	// buffer and stays valid until the next sync
+	// receive call.
+	//
+	datagram_view receive_view_sync(boost::system::error_code& ec) noexcept {
+		ec = open_ec;
+
+		if (ec || !acquire_sync_buffer(ec))
+			return{};
+
+		// Sync receive of a UDP datagram into our buffer
+		const size_t bytesRead = socket.receive_from(boost::asio::buffer(buffer, pool->size()), sender, 0, ec);
+
+		return counted(datagram_view(buffer, bytesRead, sender), ec);
+	}
+
+#ifndef _WIN32
+	//
+	// Receive a UDP Datagram without copying it if one is
+	// waiting, never blocks. If nothing is waiting ec is set
+	// to boost::asio::error::would_block.
+	//
+	// Uses the sync receive buffer, so the view is valid
+	// until the next sync (or try) receive call.
+	//
+	datagram_view try_receive_view(boost::system::error_code& ec) noexcept {
+		ec = open_ec;
+
+		if (ec || !acquire_sync_buffer(ec))
+			return{};
+
+		const std::size_t bytesRead = try_receive_into(buffer, pool->size(), sender, ec);
+
+		if (ec)
+			return{};
+
+		return datagram_view(buffer, std::min(bytesRead, pool->size()), sender);
+	}
+
+	//
+	// As try_receive_view() but the datagram goes straight into
+	// the caller's memory, e.g. a slot in a ring that other threads
+	// read from. Returns the size of the datagram, more than size
+	// if it didn't fit and only the first size bytes were kept.
+	// ec is boost::asio::error::would_block if nothing was waiting.
+	//
+	std::size_t try_receive_into(void* data, const std::size_t size,
+		boost::asio::ip::udp::endpoint& from, boost::system::error_code& ec) noexcept {
+
+		ec = open_ec;
+
+		if (ec)
+			return 0;
+
+		socklen_t from_size = static_cast<socklen_t>(from.capacity());
+		const ssize_t bytesRead = ::recvfrom(socket.native_handle(), data, size, MSG_DONTWAIT | MSG_TRUNC, from.data(), &from_size);
+
+		if (bytesRead < 0) {
+			ec = boost::system::error_code(errno, boost::asio::error::get_system_category());
+
+			// Nothing waiting isn't an error worth counting
+			if (ec == boost::asio::error::would_block || ec == boost::asio::error::try_again) {
+				ec = boost::asio::error::would_block;
+				return 0;
+			}
+
+			counted(datagram_view(), ec);
+			return 0;
+		}
+
+		from.resize(from_size);
+
+		counted(datagram_view(static_cast<const unsigned char*>(data), std::min<std::size_t>(bytesRead, size)), ec);
+
+		return static_cast<std::size_t>(bytesRead);
+	}
+
+	//
+	// Wait up to timeout_ms milliseconds (-1 for ever) for a
+	// datagram to arrive, returns true if there is one waiting.
+	// Handy with try_receive_view() when the receiving thread
+	// needs to wake up now and again.
+	//
+	bool wait(const int timeout_ms, boost::system::error_code& ec) noexcept {
+		ec = open_ec;
+
+		if (ec)
+			return false;
+
+		pollfd fd = { socket.native_handle(), POLLIN, 0 };
+		const int n = ::poll(&fd, 1, timeout_ms);
+
+		if (n < 0 && errno != EINTR)
+			ec = boost::system::error_code(errno, boost::asio::error::get_system_category());
+
+		return n > 0;
+	}
+
+	//
+	// The socket's OS handle, for waiting on several
+	// receivers at once.
+	//
+	boost::asio::ip::udp::socket::native_handle_type native_handle() noexcept {
+		return socket.native_handle();
+	}
+#endif
+
 	//
 	// Receive a binary UDP Datagram synchronously
 	// This function will block until a datagram
 	// is received.
 	//
-	std::vector<unsigned char> receive_binary_sync() {
-
-		// Sync receive of a UDP datagram as a vector
-		const size_t bytesRead = socket.receive(boost::asio::buffer(buffer));
+	std::vector<unsigned char> receive_binary_sync(boost::system::error_code& ec) {
 
 		// Copy just the received data from our
 		// internal buffer to an output vector
-		std::vector<unsigned char> out;
-		out.resize(bytesRead);
-
-		// Copy N bytes to the output vector.
-		std::copy_n(buffer.begin(), bytesRead, out.begin());
+		const datagram_view datagram = receive_view_sync(ec);
 
 		// Hope for RVO!
-		return out;
+		return std::vector<unsigned char>(datagram.begin(), datagram.end());
 	}
 
 	//
@@ -238,12 +739,68 @@ public:
 	// This function will block until a datagram
 	// is received.
 	//
-	std::string receive_sync() {
+	std::string receive_sync(boost::system::error_code& ec) {
 
 		// Sync receive of a UDP datagram as a string
-		const auto datagram = receive_binary_sync();
+		const datagram_view datagram = receive_view_sync(ec);
 
 		// Copy to a string.
 		return std::string(datagram.begin(), datagram.end());
 	}
+
+#ifndef BOOST_UDP_RECEIVE_RAR_NO_EXCEPTIONS
+	//
+	// The throwing versions of the above, these throw
+	// boost::system::system_error when anything goes
+	// wrong, including errors from async receives.
+	//
+
+	datagram_view receive_view_async() {
+		boost::system::error_code ec;
+		const datagram_view datagram = receive_view_async(ec);
+		throw_if(ec);
+		return datagram;
+	}
+
+	std::vector<unsigned char> receive_binary_async() {
+		boost::system::error_code ec;
+		auto datagram = receive_binary_async(ec);
+		throw_if(ec);
+		return datagram;
+	}
+
+	std::string receive_async() {
+		boost::system::error_code ec;
+		auto datagram = receive_async(ec);
+		throw_if(ec);
+		return datagram;
+	}
+
+	datagram_view receive_view_sync() {
+		boost::system::error_code ec;
+		const datagram_view datagram = receive_view_sync(ec);
+		throw_if(ec);
+		return datagram;
+	}
+
+	std::vector<unsigned char> receive_binary_sync() {
+		boost::system::error_code ec;
+		auto datagram = receive_binary_sync(ec);
+		throw_if(ec);
+		return datagram;
+	}
+
+	std::string receive_sync() {
+		boost::system::error_code ec;
+		auto datagram = receive_sync(ec);
+		throw_if(ec);
+		return datagram;
+	}
+
+private:
+	static void throw_if(const boost::system::error_code& ec) {
+		if (ec)
+			boost::throw_exception(boost::system::system_error(ec));
+	}
+#endif
 };
\ No newline at end of file
@@ -0,0 +1,292 @@
+#pragma once
+
+//   Copyright 2022 Kevin Godden
+//
+//   Licensed under the Apache License, Version 2.0 (the "License");
+//   you may not use this file except in compliance with the License.
+//   You may obtain a copy of the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+//   Unless required by applicable law or agreed to in writing, software
+//   distributed under the License is distributed on an "AS IS" BASIS,
+//   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//   See the License for the specific language governing permissions and
+//   limitations under the License.
+
+#include "boost_udp_receive_rar.h"
+
+#include <atomic>
+#include <cerrno>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <future>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+
+//
+// Runs a boost_udp_receive_rar on a thread of its own, calling a handler
+// for each datagram received. The thread can be pinned to a set of CPUs,
+// given a real-time scheduling policy and can lock the process's memory,
+// so that the receive path can sit on a dedicated core away from noisy
+// neighbours.
+//
+// Linux only (pthread affinity and scheduling).
+//
+// The handler is called on the receive thread with a view into the
+// receiver's buffer, which is only valid for the duration of the call.
+// An optional drained handler is called whenever there's nothing left
+// waiting on the socket, handy for flushing batches.
+// The receiver mustn't be used by anyone else while the thread runs.
+//
+// Synopsis:
+//
+/*
+	boost_udp_receive_rar rar("127.0.0.1", 8861);
+
+	boost_udp_thread_options options;
+	options.cpus = { 3 };
+	options.policy = boost_udp_thread_options::fifo;
+	options.priority = 50;
+
+	boost_udp_receive_thread thread(rar, [](const datagram_view& datagram) {
+		process(datagram.data, datagram.size);
+	}, options);
+
+	// Real time scheduling needs privileges, we keep
+	// going without it but let you know.
+	if (thread.setup_error())
+		cout << "Couldn't tune the receive thread: " << thread.setup_error().message() << endl;
+
+	...
+
+	thread.stop();
+*/
+
+struct boost_udp_thread_options {
+	// CPUs to pin the thread to, empty to leave it
+	// wherever the scheduler puts it.
+	std::vector<int> cpus;
+
+	// If cpus is empty and this is set, pin the thread
+	// to the CPUs of this NUMA node.
+	int numa_node = -1;
+
+	enum policy_type {
+		normal,
+		fifo,
+		round_robin
+	};
+
+	// Scheduling policy and, for fifo and round_robin,
+	// the real-time priority (1-99).
+	policy_type policy = normal;
+	int priority = 0;
+
+	// mlockall() the process's current and future memory
+	bool lock_memory = false;
+
+	// Spin on the socket rather than sleeping until a datagram
+	// arrives. Lowest latency, but burns the whole core, only
+	// sensible on a dedicated one (and never with real-time
+	// scheduling on a core other threads need).
+	bool busy_poll = false;
+};
+
+//
+// The CPUs of a NUMA node, from sysfs. Empty
+// if the node doesn't exist.
+//
+inline std::vector<int> boost_udp_numa_node_cpus(const int node) {
+	std::vector<int> cpus;
+	std::ifstream in("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+	std::string list;
+
+	if (!std::getline(in, list))
+		return cpus;
+
+	// A list of ranges, e.g. 0-3,8-11
+	std::stringstream ranges(list);
+	std::string range;
+
+	while (std::getline(ranges, range, ',')) {
+		const auto dash = range.find('-');
+		const int first = std::atoi(range.c_str());
+		int last = first;
+
+		if (dash != std::string::npos)
+			last = std::atoi(range.c_str() + dash + 1);
+
+		for (int cpu = first; cpu <= last; cpu++)
+			cpus.push_back(cpu);
+	}
+
+	return cpus;
+}
+
+//
+// Apply the options to the calling thread, anything that can't be
+// done is skipped and the first error is returned.
+//
+inline boost::system::error_code boost_udp_apply_thread_options(const boost_udp_thread_options& options) {
+	boost::system::error_code first_ec;
+
+	auto failed = [&](const int error) {
+		if (!first_ec)
+			first_ec = boost::system::error_code(error, boost::system::system_category());
+	};
+
+	std::vector<int> cpus = options.cpus;
+
+	if (cpus.empty() && options.numa_node >= 0)
+		cpus = boost_udp_numa_node_cpus(options.numa_node);
+
+	if (!cpus.empty()) {
+		cpu_set_t set;
+		CPU_ZERO(&set);
+
+		for (const int cpu : cpus)
+			CPU_SET(cpu, &set);
+
+		const int error = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+
+		if (error)
+			failed(error);
+	}
+
+	if (options.policy != boost_udp_thread_options::normal) {
+		sched_param param = {};
+		param.sched_priority = options.priority;
+
+		const int policy = options.policy == boost_udp_thread_options::fifo ? SCHED_FIFO : SCHED_RR;
+		const int error = pthread_setschedparam(pthread_self(), policy, &param);
+
+		if (error)
+			failed(error);
+	}
+
+	if (options.lock_memory && mlockall(MCL_CURRENT | MCL_FUTURE) != 0)
+		failed(errno);
+
+	return first_ec;
+}
+
+class boost_udp_receive_thread {
+public:
+	using handler_type = std::function<void(const datagram_view&)>;
+	using drained_type = std::function<void()>;
+
+private:
+	boost_udp_receive_rar& rar;
+	handler_type handler;
+	boost_udp_thread_options options;
+
+	// Called each time everything waiting has
+	// been handed over, if set.
+	drained_type drained;
+
+	std::atomic<bool> stopping{ false };
+
+	// From applying the thread options, and the
+	// error (if any) that stopped the thread.
+	boost::system::error_code setup_ec;
+	boost::system::error_code receive_ec;
+
+	std::thread thread;
+
+	void run(std::promise<void>& started) {
+		setup_ec = boost_udp_apply_thread_options(options);
+		started.set_value();
+
+		boost::system::error_code ec;
+
+		while (!stopping.load(std::memory_order_relaxed)) {
+
+			// Sleep until there's something to receive, waking
+			// now and again to see if we've been stopped.
+			if (!options.busy_poll && !rar.wait(100, ec)) {
+				if (ec)
+					break;
+
+				continue;
+			}
+
+			// Hand over everything that's waiting
+			for (;;) {
+				const datagram_view datagram = rar.try_receive_view(ec);
+
+				if (ec)
+					break;
+
+				handler(datagram);
+			}
+
+			if (ec != boost::asio::error::would_block)
+				break;
+
+			ec.clear();
+
+			if (drained)
+				drained();
+		}
+
+		receive_ec = ec;
+	}
+
+public:
+	boost_udp_receive_thread(boost_udp_receive_rar& rar, handler_type handler,
+		const boost_udp_thread_options& options = boost_udp_thread_options(), drained_type drained = drained_type())
+		: rar(rar), handler(std::move(handler)), options(options), drained(std::move(drained)) {
+
+		// Wait for the thread to set itself up so
+		// setup_error() is ready when we return.
+		std::promise<void> started;
+		auto ready = started.get_future();
+
+		thread = std::thread([this, &started]() { run(started); });
+
+		ready.wait();
+	}
+
+	boost_udp_receive_thread(const boost_udp_receive_thread&) = delete;
+	boost_udp_receive_thread& operator=(const boost_udp_receive_thread&) = delete;
+
+	~boost_udp_receive_thread() {
+		stop();
+	}
+
+	//
+	// Stop receiving and wait for the thread to finish, takes
+	// up to 100ms unless busy polling.
+	//
+	void stop() {
+		stopping = true;
+
+		if (thread.joinable())
+			thread.join();
+	}
+
+	//
+	// The first of the thread options that couldn't be
+	// applied (usually missing privileges for real-time
+	// scheduling or locking memory).
+	//
+	const boost::system::error_code& setup_error() const noexcept {
+		return setup_ec;
+	}
+
+	//
+	// The receive error that stopped the thread, only
+	// valid once the thread has been stopped.
+	//
+	const boost::system::error_code& receive_error() const noexcept {
+		return receive_ec;
+	}
+};
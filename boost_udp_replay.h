@@ -0,0 +1,739 @@
+#pragma once
+
+//   Copyright 2022 Kevin Godden
+//
+//   Licensed under the Apache License, Version 2.0 (the "License");
+//   you may not use this file except in compliance with the License.
+//   You may obtain a copy of the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+//   Unless required by applicable law or agreed to in writing, software
+//   distributed under the License is distributed on an "AS IS" BASIS,
+//   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//   See the License for the specific language governing permissions and
+//   limitations under the License.
+
+#include "boost_udp_receive_rar.h"
+#include "boost_udp_byte_order.h"
+#include "boost_udp_journal.h"
+
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+//
+// Plays back recorded traffic through the same receive functions as
+// boost_udp_receive_rar, so code written against a receiver can be run
+// over a capture, e.g. for back testing or as a repeatable benchmark.
+// The recording is either a journal written by boost_udp_journal (give
+// the journal's prefix, or a single segment file) or a classic pcap file
+// (not pcapng) of UDP over IPv4 or IPv6, which can be filtered by
+// destination port.
+//
+// The files are mapped into memory and each datagram is handed out as a
+// view straight into the mapping, valid until the next receive. Datagrams
+// come out either as fast as they're asked for, or paced to the gaps
+// between their original time stamps (sped up or slowed down by speed),
+// starting from the first receive. When paced, the async and try_
+// functions return nothing until the next datagram is due and the sync
+// ones wait for it.
+//
+// Once everything has been played ec is boost::asio::error::eof.
+//
+// Single threaded, POSIX only.
+//
+// Synopsis:
+//
+/*
+	boost_udp_replay_options options;
+	options.paced = true;
+	options.speed = 10.0;
+
+	boost_udp_replay replay("/data/capture/feed_a", options);
+
+	boost::system::error_code ec;
+
+	for (;;) {
+		const datagram_view datagram = replay.receive_view_sync(ec);
+
+		if (ec)
+			break;
+
+		process(datagram, replay.timestamp());
+	}
+*/
+
+struct boost_udp_replay_options {
+	enum format_type {
+		// A pcap file if path is one, else a journal
+		detect,
+		journal,
+		pcap
+	};
+
+	format_type format = detect;
+
+	// Hand datagrams out at their original pace, speed
+	// times faster (or slower if it's less than 1).
+	bool paced = false;
+	double speed = 1.0;
+
+	// With pcap, only datagrams sent to this port (0 for all)
+	uint16_t port = 0;
+};
+
+class boost_udp_replay {
+	using clock = std::chrono::steady_clock;
+
+	std::string path;
+	boost_udp_replay_options options;
+
+	// What's being played, options.format worked out
+	boost_udp_replay_options::format_type format = boost_udp_replay_options::detect;
+
+	// The file being played
+	unsigned char* base = nullptr;
+	std::size_t mapped = 0;
+	std::size_t offset = 0;
+
+	// How far into the file has been paged in
+	std::size_t populated = 0;
+	static const std::size_t populate_window = std::size_t(4) << 20;
+
+	// A segment played to the end, kept mapped until the next
+	// receive as the last view handed out may point into it.
+	unsigned char* retired = nullptr;
+	std::size_t retired_size = 0;
+
+	// For a journal prefix, the segment being played,
+	// a single file has no next segment.
+	bool segments = false;
+	uint64_t segment = 0;
+
+	// How the pcap file was written
+	bool big_endian = false;
+	bool nanoseconds = false;
+	uint32_t link_type = 0;
+
+	boost::system::error_code open_ec;
+
+	// The next datagram, read ahead so we know when it's due
+	datagram_view pending;
+	int64_t pending_timestamp = 0;
+	bool has_pending = false;
+
+	// When the first datagram was handed out, and its time
+	// stamp, for pacing the rest.
+	bool started = false;
+	clock::time_point start;
+	int64_t first_timestamp = 0;
+
+	int64_t last_timestamp = 0;
+
+	boost_udp_receive_rar_stats counters;
+	uint64_t skipped_packets = 0;
+
+	static const uint32_t pcap_magic = 0xa1b2c3d4;
+	static const uint32_t pcap_nanosecond_magic = 0xa1b23c4d;
+	static const std::size_t pcap_header_size = 24;
+	static const std::size_t pcap_record_size = 16;
+
+	static boost::system::error_code invalid() {
+		return boost::system::errc::make_error_code(boost::system::errc::invalid_argument);
+	}
+
+	boost::system::error_code map(const std::string& file) {
+		unmap();
+
+		const int fd = ::open(file.c_str(), O_RDONLY | O_CLOEXEC);
+
+		if (fd < 0)
+			return boost::system::error_code(errno, boost::system::system_category());
+
+		struct stat st;
+
+		if (::fstat(fd, &st) != 0) {
+			const int error = errno;
+			::close(fd);
+			return boost::system::error_code(error, boost::system::system_category());
+		}
+
+		if (st.st_size == 0) {
+			::close(fd);
+			return invalid();
+		}
+
+		void* p = ::mmap(nullptr, static_cast<std::size_t>(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+		::close(fd);
+
+		if (p == MAP_FAILED)
+			return boost::system::error_code(errno, boost::system::system_category());
+
+		base = static_cast<unsigned char*>(p);
+		mapped = static_cast<std::size_t>(st.st_size);
+
+		// We read it front to back, once
+		::madvise(base, mapped, MADV_SEQUENTIAL);
+
+		populated = 0;
+		populate();
+
+		return{};
+	}
+
+	// Page in the window ahead of where we're reading, rather than
+	// taking a page fault every few datagrams, or reading the whole
+	// of a big capture in when it's opened.
+	void populate() {
+		if (offset + populate_window / 2 < populated || populated >= mapped)
+			return;
+
+		const std::size_t window = populate_window;
+		const std::size_t length = std::min(window, mapped - populated);
+
+#ifdef MADV_POPULATE_READ
+		// Older kernels don't know it, they just read ahead
+		if (::madvise(base + populated, length, MADV_POPULATE_READ) != 0)
+#endif
+			::madvise(base + populated, length, MADV_WILLNEED);
+
+		populated += length;
+	}
+
+	void unmap() {
+		if (base)
+			::munmap(base, mapped);
+
+		base = nullptr;
+		mapped = 0;
+	}
+
+	// Done with the current segment. Only the first one retired
+	// since the last receive can hold a view, any after it are
+	// unmapped straight away.
+	void retire() {
+		if (retired) {
+			unmap();
+			return;
+		}
+
+		retired = base;
+		retired_size = mapped;
+		base = nullptr;
+		mapped = 0;
+	}
+
+	void release() {
+		if (retired)
+			::munmap(retired, retired_size);
+
+		retired = nullptr;
+		retired_size = 0;
+	}
+
+	uint32_t read32(const unsigned char* p) const {
+		return static_cast<uint32_t>(big_endian ? boost_udp_read_uint<4, true>(p) : boost_udp_read_uint<4, false>(p));
+	}
+
+	static uint16_t network16(const unsigned char* p) {
+		return static_cast<uint16_t>(boost_udp_read_uint<2, true>(p));
+	}
+
+	bool journal_file() const {
+		return mapped >= boost_udp_journal_layout::records_offset()
+			&& reinterpret_cast<const boost_udp_journal_layout::segment_header*>(base)->magic == boost_udp_journal_layout::magic
+			&& reinterpret_cast<const boost_udp_journal_layout::segment_header*>(base)->version == boost_udp_journal_layout::version;
+	}
+
+	bool pcap_file() {
+		if (mapped < pcap_header_size)
+			return false;
+
+		const uint32_t magic = static_cast<uint32_t>(boost_udp_read_uint<4, false>(base));
+
+		if (magic == pcap_magic || magic == pcap_nanosecond_magic)
+			big_endian = false;
+		else if (boost_udp_byte_swap(magic) == pcap_magic || boost_udp_byte_swap(magic) == pcap_nanosecond_magic)
+			big_endian = true;
+		else
+			return false;
+
+		nanoseconds = read32(base) == pcap_nanosecond_magic;
+		link_type = read32(base + 20);
+		offset = pcap_header_size;
+
+		return true;
+	}
+
+	boost::system::error_code open() {
+		release();
+		unmap();
+
+		offset = 0;
+		segment = 0;
+		has_pending = started = false;
+
+		// A file, or the prefix of a journal's segments
+		segments = options.format != boost_udp_replay_options::pcap && ::access(path.c_str(), F_OK) != 0;
+
+		const boost::system::error_code ec = map(segments ? boost_udp_journal_layout::segment_path(path, 0) : path);
+
+		if (ec)
+			return ec;
+
+		if (options.format != boost_udp_replay_options::journal && pcap_file()) {
+			format = boost_udp_replay_options::pcap;
+			return{};
+		}
+
+		if (options.format != boost_udp_replay_options::pcap && journal_file()) {
+			format = boost_udp_replay_options::journal;
+			offset = boost_udp_journal_layout::records_offset();
+			return{};
+		}
+
+		unmap();
+		return invalid();
+	}
+
+	// The UDP datagram in a captured packet, false if it
+	// isn't one (or isn't to the port we want).
+	bool udp_in(const unsigned char* p, const std::size_t n, datagram_view& datagram) const {
+		std::size_t ip = 0;
+		unsigned version = 0;
+
+		auto ether_version = [](const uint16_t type) {
+			return type == 0x0800 ? 4u : type == 0x86dd ? 6u : 0u;
+		};
+
+		switch (link_type) {
+		case 0: {
+			// BSD loopback, the address family in the
+			// byte order of the machine that captured it.
+			if (n < 4)
+				return false;
+
+			const uint32_t family = read32(p);
+			version = family == 2 ? 4 : (family == 10 || family == 24 || family == 28 || family == 30) ? 6 : 0;
+			ip = 4;
+			break;
+		}
+
+		case 1: {
+			// Ethernet, with any VLAN tags
+			if (n < 14)
+				return false;
+
+			uint16_t type = network16(p + 12);
+			ip = 14;
+
+			while (type == 0x8100 || type == 0x88a8) {
+				if (n < ip + 4)
+					return false;
+
+				type = network16(p + ip + 2);
+				ip += 4;
+			}
+
+			version = ether_version(type);
+			break;
+		}
+
+		case 12:
+		case 101:
+			// Raw IP
+			version = n ? p[0] >> 4 : 0;
+			break;
+
+		case 113:
+			// Linux cooked capture
+			if (n < 16)
+				return false;
+
+			version = ether_version(network16(p + 14));
+			ip = 16;
+			break;
+
+		case 228:
+			version = 4;
+			break;
+
+		case 229:
+			version = 6;
+			break;
+
+		case 276:
+			// Linux cooked capture v2
+			if (n < 20)
+				return false;
+
+			version = ether_version(network16(p));
+			ip = 20;
+			break;
+
+		default:
+			return false;
+		}
+
+		std::size_t udp = 0, end = 0;
+		boost::asio::ip::address from;
+
+		if (version == 4) {
+			if (n < ip + 20 || p[ip + 9] != 17)
+				return false;
+
+			// Fragments can't be put back together here
+			if (network16(p + ip + 6) & 0x3fff)
+				return false;
+
+			udp = ip + (p[ip] & 0x0f) * 4;
+			end = std::min<std::size_t>(n, ip + network16(p + ip + 2));
+
+			boost::asio::ip::address_v4::bytes_type bytes;
+			std::memcpy(bytes.data(), p + ip + 12, bytes.size());
+			from = boost::asio::ip::address_v4(bytes);
+		}
+		else if (version == 6) {
+			// UDP straight after the fixed header only
+			if (n < ip + 40 || p[ip + 6] != 17)
+				return false;
+
+			udp = ip + 40;
+			end = std::min<std::size_t>(n, udp + network16(p + ip + 4));
+
+			boost::asio::ip::address_v6::bytes_type bytes;
+			std::memcpy(bytes.data(), p + ip + 8, bytes.size());
+			from = boost::asio::ip::address_v6(bytes);
+		}
+		else {
+			return false;
+		}
+
+		if (udp + 8 > end)
+			return false;
+
+		if (options.port && network16(p + udp + 2) != options.port)
+			return false;
+
+		const std::size_t length = network16(p + udp + 4);
+		const std::size_t size = std::min<std::size_t>(length >= 8 ? length - 8 : 0, end - udp - 8);
+
+		datagram = datagram_view(p + udp + 8, size, boost::asio::ip::udp::endpoint(from, network16(p + udp)));
+		return true;
+	}
+
+	bool next_journal() {
+		for (;;) {
+			const boost_udp_journal_layout::record* r = boost_udp_journal_layout::next(base, mapped, offset);
+
+			if (r) {
+				pending = datagram_view(boost_udp_journal_layout::payload(r), r->size, boost_udp_journal_layout::load_sender(r));
+				pending_timestamp = r->timestamp;
+				return true;
+			}
+
+			// On to the next segment, if there is one
+			retire();
+
+			if (!segments || map(boost_udp_journal_layout::segment_path(path, ++segment)) || !journal_file()) {
+				unmap();
+				return false;
+			}
+
+			offset = boost_udp_journal_layout::records_offset();
+		}
+	}
+
+	bool next_pcap() {
+		while (offset + pcap_record_size <= mapped) {
+			const unsigned char* record = base + offset;
+			const std::size_t captured = read32(record + 8);
+
+			// Cut off part way through
+			if (captured > mapped - offset - pcap_record_size)
+				return false;
+
+			offset += pcap_record_size + captured;
+
+			if (!udp_in(record + pcap_record_size, captured, pending)) {
+				skipped_packets++;
+				continue;
+			}
+
+			const int64_t fraction = read32(record + 4);
+			pending_timestamp = int64_t(read32(record)) * 1000000000 + (nanoseconds ? fraction : fraction * 1000);
+
+			return true;
+		}
+
+		return false;
+	}
+
+	bool read_ahead() {
+		if (!has_pending && base) {
+			has_pending = format == boost_udp_replay_options::pcap ? next_pcap() : next_journal();
+
+			if (base)
+				populate();
+		}
+
+		return has_pending;
+	}
+
+	// When the next datagram should be handed out
+	clock::time_point due() const {
+		const double gap = double(pending_timestamp - first_timestamp) / (options.speed > 0 ? options.speed : 1.0);
+		return start + std::chrono::duration_cast<clock::duration>(std::chrono::duration<double, std::nano>(gap));
+	}
+
+	datagram_view counted(const datagram_view& datagram) noexcept {
+		counters.datagrams++;
+		counters.bytes += datagram.size;
+
+		return datagram;
+	}
+
+public:
+	//
+	// Open a journal (its prefix or one of its segments) or a pcap
+	// file, any error is reported in ec (and by open_error()).
+	//
+	boost_udp_replay(const std::string& path, const boost_udp_replay_options& options, boost::system::error_code& ec)
+		: path(path), options(options) {
+
+		ec = open_ec = open();
+	}
+
+	//
+	// Throws boost::system::system_error if the recording can't be
+	// opened, when built without exceptions check open_error().
+	//
+	explicit boost_udp_replay(const std::string& path, const boost_udp_replay_options& options = boost_udp_replay_options())
+		: path(path), options(options) {
+
+		open_ec = open();
+
+#ifndef BOOST_UDP_RECEIVE_RAR_NO_EXCEPTIONS
+		if (open_ec)
+			boost::throw_exception(boost::system::system_error(open_ec));
+#endif
+	}
+
+	boost_udp_replay(const boost_udp_replay&) = delete;
+	boost_udp_replay& operator=(const boost_udp_replay&) = delete;
+
+	~boost_udp_replay() {
+		release();
+		unmap();
+	}
+
+	const boost::system::error_code& open_error() const noexcept {
+		return open_ec;
+	}
+
+	boost_udp_receive_rar_stats stats() const noexcept {
+		return counters;
+	}
+
+	//
+	// Packets in a pcap file that weren't UDP datagrams
+	// we could play (or were to other ports).
+	//
+	uint64_t skipped() const noexcept {
+		return skipped_packets;
+	}
+
+	//
+	// When the last datagram handed out originally arrived,
+	// nanoseconds since the epoch.
+	//
+	int64_t timestamp() const noexcept {
+		return last_timestamp;
+	}
+
+	//
+	// Start again from the beginning, pacing starts
+	// afresh from the next receive.
+	//
+	void rewind() {
+		open_ec = open();
+	}
+
+	//
+	// The next datagram if it's due, never blocks. ec is
+	// boost::asio::error::would_block if it isn't due yet, and
+	// boost::asio::error::eof once everything has been played.
+	// The view is valid until the next receive.
+	//
+	datagram_view try_receive_view(boost::system::error_code& ec) noexcept {
+		ec = open_ec;
+
+		if (ec)
+			return{};
+
+		const bool more = read_ahead();
+
+		// The last view has had its time
+		release();
+
+		if (!more) {
+			ec = boost::asio::error::eof;
+			return{};
+		}
+
+		if (options.paced) {
+			if (!started) {
+				started = true;
+				start = clock::now();
+				first_timestamp = pending_timestamp;
+			}
+			else if (clock::now() < due()) {
+				ec = boost::asio::error::would_block;
+				return{};
+			}
+		}
+
+		has_pending = false;
+		last_timestamp = pending_timestamp;
+
+		return counted(pending);
+	}
+
+	//
+	// Wait up to timeout_ms for the next datagram to be due,
+	// true if it is. False straight away at the end. The view
+	// from the last receive stays valid.
+	//
+	bool wait(const int timeout_ms, boost::system::error_code& ec) noexcept {
+		ec = open_ec;
+
+		if (ec)
+			return false;
+
+		if (!read_ahead()) {
+			ec = boost::asio::error::eof;
+			return false;
+		}
+
+		if (!options.paced || !started)
+			return true;
+
+		const clock::time_point until = std::min(due(), clock::now() + std::chrono::milliseconds(timeout_ms));
+
+		// Sleep for most of it, then spin so we're on time
+		for (clock::time_point now = clock::now(); now < until; now = clock::now()) {
+			if (until - now > std::chrono::microseconds(200))
+				std::this_thread::sleep_for(until - now - std::chrono::microseconds(100));
+		}
+
+		return clock::now() >= due();
+	}
+
+	//
+	// The receiver's functions, async here means
+	// return straight away if nothing is due.
+	//
+
+	datagram_view receive_view_async(boost::system::error_code& ec) noexcept {
+		const datagram_view datagram = try_receive_view(ec);
+
+		if (ec == boost::asio::error::would_block)
+			ec.clear();
+
+		return datagram;
+	}
+
+	std::vector<unsigned char> receive_binary_async(boost::system::error_code& ec) {
+		const datagram_view datagram = receive_view_async(ec);
+		return std::vector<unsigned char>(datagram.begin(), datagram.end());
+	}
+
+	std::string receive_async(boost::system::error_code& ec) {
+		const datagram_view datagram = receive_view_async(ec);
+		return std::string(datagram.begin(), datagram.end());
+	}
+
+	datagram_view receive_view_sync(boost::system::error_code& ec) noexcept {
+		for (;;) {
+			const datagram_view datagram = try_receive_view(ec);
+
+			if (ec != boost::asio::error::would_block)
+				return datagram;
+
+			wait(100, ec);
+		}
+	}
+
+	std::vector<unsigned char> receive_binary_sync(boost::system::error_code& ec) {
+		const datagram_view datagram = receive_view_sync(ec);
+		return std::vector<unsigned char>(datagram.begin(), datagram.end());
+	}
+
+	std::string receive_sync(boost::system::error_code& ec) {
+		const datagram_view datagram = receive_view_sync(ec);
+		return std::string(datagram.begin(), datagram.end());
+	}
+
+#ifndef BOOST_UDP_RECEIVE_RAR_NO_EXCEPTIONS
+	//
+	// The throwing versions of the above
+	//
+
+	datagram_view receive_view_async() {
+		boost::system::error_code ec;
+		const datagram_view datagram = receive_view_async(ec);
+		throw_if(ec);
+		return datagram;
+	}
+
+	std::vector<unsigned char> receive_binary_async() {
+		boost::system::error_code ec;
+		auto datagram = receive_binary_async(ec);
+		throw_if(ec);
+		return datagram;
+	}
+
+	std::string receive_async() {
+		boost::system::error_code ec;
+		auto datagram = receive_async(ec);
+		throw_if(ec);
+		return datagram;
+	}
+
+	datagram_view receive_view_sync() {
+		boost::system::error_code ec;
+		const datagram_view datagram = receive_view_sync(ec);
+		throw_if(ec);
+		return datagram;
+	}
+
+	std::vector<unsigned char> receive_binary_sync() {
+		boost::system::error_code ec;
+		auto datagram = receive_binary_sync(ec);
+		throw_if(ec);
+		return datagram;
+	}
+
+	std::string receive_sync() {
+		boost::system::error_code ec;
+		auto datagram = receive_sync(ec);
+		throw_if(ec);
+		return datagram;
+	}
+
+private:
+	static void throw_if(const boost::system::error_code& ec) {
+		if (ec)
+			boost::throw_exception(boost::system::system_error(ec));
+	}
+#endif
+};
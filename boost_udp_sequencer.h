@@ -0,0 +1,367 @@
+#pragma once
+
+//   Copyright 2022 Kevin Godden
+//
+//   Licensed under the Apache License, Version 2.0 (the "License");
+//   you may not use this file except in compliance with the License.
+//   You may obtain a copy of the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+//   Unless required by applicable law or agreed to in writing, software
+//   distributed under the License is distributed on an "AS IS" BASIS,
+//   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//   See the License for the specific language governing permissions and
+//   limitations under the License.
+
+#include "boost_udp_receive_rar.h"
+
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <vector>
+
+//
+// Puts a feed's datagrams back in order by a sequence number at a fixed
+// offset in the payload. Datagrams that arrive early wait in a window (a
+// ring indexed by sequence number) for the ones before them, for up to
+// hold_time, after which the missing ones are given up on, reported to
+// the gap handler and what's waiting is handed over. Duplicates, and
+// datagrams that turn up after we've given up on them, are dropped.
+//
+// Sequence numbers of less than 8 bytes can wrap around.
+//
+// Single threaded, typically called from a receive thread's handler,
+// with poll() called from its drained handler so that held datagrams
+// are released on time when the feed goes quiet.
+//
+// Synopsis:
+//
+/*
+	boost_udp_sequencer_options options;
+	options.sequence_offset = 0;
+	options.sequence_size = 4;
+	options.hold_time = std::chrono::milliseconds(2);
+
+	boost_udp_sequencer sequencer(options,
+		[](uint64_t sequence, const datagram_view& datagram) { process(datagram); },
+		[](uint64_t first, uint64_t count) { request_retransmit(first, count); });
+
+	boost_udp_receive_thread thread(rar,
+		[&](const datagram_view& datagram) { sequencer.push(datagram); },
+		boost_udp_thread_options(),
+		[&]() { sequencer.poll(); });
+*/
+
+struct boost_udp_sequencer_options {
+	// Where the sequence number is, its size in bytes (1-8)
+	// and whether it's big endian (network order).
+	std::size_t sequence_offset = 0;
+	std::size_t sequence_size = 4;
+	bool big_endian = true;
+
+	// Datagrams that can wait for earlier ones (rounded up
+	// to a power of two), and the biggest that can wait.
+	std::size_t window = 1024;
+	std::size_t max_datagram_size = 2048;
+
+	// How long to wait for a missing datagram
+	std::chrono::steady_clock::duration hold_time = std::chrono::milliseconds(1);
+
+	// How the window's memory is allocated
+	boost_udp_buffer_memory memory;
+};
+
+struct boost_udp_sequencer_stats {
+	// Datagrams handed on in order
+	uint64_t delivered = 0;
+
+	// Arrived ahead of one they follow
+	uint64_t reordered = 0;
+
+	// Seen already, or too late
+	uint64_t duplicates = 0;
+
+	// Gaps given up on, and the datagrams in them
+	uint64_t gaps = 0;
+	uint64_t missing = 0;
+
+	// Too short for a sequence number, or too big to wait
+	uint64_t malformed = 0;
+
+	// Waiting in the window now
+	std::size_t held = 0;
+};
+
+class boost_udp_sequencer {
+public:
+	using handler_type = std::function<void(uint64_t sequence, const datagram_view&)>;
+	using gap_handler_type = std::function<void(uint64_t first, uint64_t count)>;
+
+private:
+	using clock = std::chrono::steady_clock;
+
+	struct slot {
+		unsigned char* data = nullptr;
+		std::size_t size = 0;
+		boost::asio::ip::udp::endpoint sender;
+
+		// The sequence number waiting here, if full
+		uint64_t sequence = 0;
+		bool full = false;
+
+		clock::time_point arrived;
+	};
+
+	boost_udp_sequencer_options options;
+	handler_type handler;
+	gap_handler_type gap_handler;
+
+	std::shared_ptr<boost_udp_buffer_pool> pool;
+	std::vector<slot> slots;
+	std::size_t mask = 0;
+
+	// The next sequence number to hand on, extended
+	// to 64 bits so that it never wraps.
+	uint64_t expected = 0;
+	bool started = false;
+
+	// The sequence number space, 0 for a full 64 bits
+	uint64_t modulus = 0;
+
+	boost_udp_sequencer_stats counters;
+
+	static std::size_t round_up_power_of_two(std::size_t n) {
+		std::size_t p = 1;
+
+		while (p < n)
+			p <<= 1;
+
+		return p;
+	}
+
+	bool read_sequence(const datagram_view& datagram, uint64_t& sequence) const {
+		if (options.sequence_offset + options.sequence_size > datagram.size)
+			return false;
+
+		const unsigned char* p = datagram.data + options.sequence_offset;
+		sequence = 0;
+
+		for (std::size_t i = 0; i != options.sequence_size; i++) {
+			const std::size_t byte = options.big_endian ? i : options.sequence_size - 1 - i;
+			sequence = (sequence << 8) | p[byte];
+		}
+
+		return true;
+	}
+
+	// Turn a sequence number from the wire into the one
+	// nearest expected in our never wrapping numbers,
+	// and back again.
+	uint64_t extend(const uint64_t raw) const {
+		if (!modulus)
+			return raw;
+
+		const uint64_t half = modulus / 2;
+		const uint64_t ahead = (raw - expected) & (modulus - 1);
+
+		// More than half way round is behind
+		return ahead < half ? expected + ahead : expected - (modulus - ahead);
+	}
+
+	uint64_t wire(const uint64_t sequence) const {
+		return modulus ? sequence & (modulus - 1) : sequence;
+	}
+
+	void deliver(const uint64_t sequence, const datagram_view& datagram) {
+		counters.delivered++;
+		expected = sequence + 1;
+		handler(wire(sequence), datagram);
+	}
+
+	// Hand on whatever's waiting from expected onwards
+	void release_waiting() {
+		for (;;) {
+			slot& s = slots[expected & mask];
+
+			if (!s.full || s.sequence != expected)
+				return;
+
+			s.full = false;
+			counters.held--;
+
+			deliver(s.sequence, datagram_view(s.data, s.size, s.sender));
+		}
+	}
+
+	// The oldest waiting datagram, the one after the first gap
+	slot* first_waiting() {
+		for (uint64_t n = expected + 1; n != expected + slots.size(); n++) {
+			slot& s = slots[n & mask];
+
+			if (s.full && s.sequence == n)
+				return &s;
+		}
+
+		return nullptr;
+	}
+
+	void report_gap(const uint64_t first, const uint64_t count) {
+		counters.gaps++;
+		counters.missing += count;
+
+		if (gap_handler)
+			gap_handler(wire(first), count);
+	}
+
+	// Give up on the gap at expected, hand on what's waiting
+	// after it, until there's a gap that hasn't waited long
+	// enough (or nothing waiting).
+	void give_up(const clock::time_point now, const bool everything) {
+		while (counters.held) {
+			slot* s = first_waiting();
+
+			if (!s || (!everything && now - s->arrived < options.hold_time))
+				return;
+
+			report_gap(expected, s->sequence - expected);
+			expected = s->sequence;
+			release_waiting();
+		}
+	}
+
+public:
+	boost_udp_sequencer(const boost_udp_sequencer_options& options, handler_type handler,
+		gap_handler_type gap_handler = gap_handler_type())
+		: options(options), handler(std::move(handler)), gap_handler(std::move(gap_handler)) {
+
+		if (this->options.sequence_size < 1 || this->options.sequence_size > 8)
+			this->options.sequence_size = 4;
+
+		if (this->options.sequence_size < 8)
+			modulus = uint64_t(1) << (8 * this->options.sequence_size);
+
+		const std::size_t n = round_up_power_of_two(options.window ? options.window : 1);
+
+		pool = std::make_shared<boost_udp_buffer_pool>(options.max_datagram_size, n, options.memory);
+		slots.resize(n);
+
+		for (auto& s : slots) {
+			s.data = pool->acquire();
+
+			if (!s.data) {
+				slots.resize(1);
+				slots[0].data = nullptr;
+				break;
+			}
+		}
+
+		mask = slots.size() - 1;
+	}
+
+	boost_udp_sequencer(const boost_udp_sequencer&) = delete;
+	boost_udp_sequencer& operator=(const boost_udp_sequencer&) = delete;
+
+	//
+	// Take the next datagram off the wire, it's handed on now
+	// if it's the one expected (along with any that were waiting
+	// for it), or else waits in the window.
+	//
+	void push(const datagram_view& datagram) {
+		uint64_t raw;
+
+		if (!read_sequence(datagram, raw)) {
+			counters.malformed++;
+			return;
+		}
+
+		// The first datagram sets where we start, a lap
+		// in so that there's room to be behind.
+		if (!started) {
+			started = true;
+			expected = raw + modulus;
+		}
+
+		const uint64_t sequence = extend(raw);
+
+		if (sequence < expected) {
+			counters.duplicates++;
+			return;
+		}
+
+		if (sequence == expected) {
+			deliver(sequence, datagram);
+			release_waiting();
+			return;
+		}
+
+		// Too far ahead for the window, give up
+		// on enough of the oldest to make room.
+		if (sequence - expected >= slots.size()) {
+			while (counters.held && sequence - expected >= slots.size()) {
+				slot* s = first_waiting();
+				report_gap(expected, s->sequence - expected);
+				expected = s->sequence;
+				release_waiting();
+			}
+
+			if (sequence - expected >= slots.size()) {
+				report_gap(expected, sequence - expected);
+				deliver(sequence, datagram);
+				release_waiting();
+				return;
+			}
+		}
+
+		slot& s = slots[sequence & mask];
+
+		if (s.full && s.sequence == sequence) {
+			counters.duplicates++;
+			return;
+		}
+
+		if (!s.data || datagram.size > pool->size()) {
+			counters.malformed++;
+			return;
+		}
+
+		std::memcpy(s.data, datagram.data, datagram.size);
+		s.size = datagram.size;
+		s.sender = datagram.sender;
+		s.sequence = sequence;
+		s.full = true;
+		s.arrived = clock::now();
+
+		counters.reordered++;
+		counters.held++;
+	}
+
+	//
+	// Give up on gaps that have waited hold_time, call this
+	// whenever the feed goes quiet (and now and again).
+	//
+	void poll(const clock::time_point now = clock::now()) {
+		give_up(now, false);
+	}
+
+	//
+	// Give up on every gap and hand on everything
+	// that's waiting, e.g. when the feed ends.
+	//
+	void flush() {
+		give_up(clock::now(), true);
+	}
+
+	//
+	// The next sequence number we're waiting for
+	//
+	uint64_t next_expected() const noexcept {
+		return wire(expected);
+	}
+
+	boost_udp_sequencer_stats stats() const noexcept {
+		return counters;
+	}
+};
@@ -0,0 +1,681 @@
+#pragma once
+
+//   Copyright 2022 Kevin Godden
+//
+//   Licensed under the Apache License, Version 2.0 (the "License");
+//   you may not use this file except in compliance with the License.
+//   You may obtain a copy of the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+//   Unless required by applicable law or agreed to in writing, software
+//   distributed under the License is distributed on an "AS IS" BASIS,
+//   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//   See the License for the specific language governing permissions and
+//   limitations under the License.
+
+#include "boost_udp_datagram_ring.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+//
+// Shares one receiver's datagrams with other processes on the same host
+// through a ring in shared memory (/dev/shm), so that ten processes that
+// want the same feed don't each need a socket of their own.
+//
+// boost_udp_shm_publisher creates the ring and receives from a
+// boost_udp_receive_rar straight into it (or copies datagrams in with
+// publish()). boost_udp_shm_reader opens the ring from another process
+// and has the same receive functions as boost_udp_receive_rar.
+//
+// The publisher never waits for readers. Each slot carries a sequence
+// number that's cleared while the slot is written, readers copy a datagram
+// out and then check that its sequence number didn't change meanwhile. A
+// reader that falls a whole ring behind skips what it missed and counts it
+// in lost().
+//
+// POSIX only (shm_open & mmap).
+//
+// Synopsis:
+//
+/*
+	// The receiving process
+	boost::system::error_code ec;
+	boost_udp_shm_publisher publisher("/feed_a", boost_udp_shm_options(), ec);
+
+	while (rar.wait(100, ec)) {
+		do
+			publisher.receive(rar, ec);
+		while (!ec);
+	}
+
+	// Every other process
+	boost_udp_shm_reader reader("/feed_a");
+
+	for (;;) {
+		const std::string datagram = reader.receive_sync();
+		...
+	}
+*/
+
+struct boost_udp_shm_options {
+	// Slots in the ring (rounded up to a power of two),
+	// and the biggest datagram a slot can hold.
+	std::size_t capacity = 4096;
+	std::size_t slot_size = 2048;
+
+	// Remove the name when the publisher goes, readers
+	// that have it open carry on with what's there.
+	bool unlink_on_close = true;
+};
+
+//
+// The ring's layout in shared memory, shared
+// by the publisher and the readers.
+//
+namespace boost_udp_shm_layout {
+	static_assert(std::atomic<uint64_t>::is_always_lock_free, "the ring needs lock-free 64 bit atomics");
+
+	const uint64_t magic = 0x5241525f55445031ull;   // "RAR_UDP1"
+	const uint32_t version = 1;
+
+	struct header {
+		// Written last by the publisher, readers
+		// check it before anything else.
+		std::atomic<uint64_t> magic;
+		uint32_t version;
+		uint32_t capacity;
+		uint32_t slot_size;
+		uint32_t slot_stride;
+
+		// Sequence number of the next datagram, everything
+		// before it has been published.
+		alignas(64) std::atomic<uint64_t> published;
+	};
+
+	// Followed by slot_size bytes of datagram
+	struct alignas(64) slot {
+		// The sequence number + 1 of the datagram
+		// in the slot, 0 while it's being written.
+		std::atomic<uint64_t> sequence;
+
+		uint32_t size;
+		uint16_t family;
+		uint16_t port;
+		unsigned char address[16];
+	};
+
+	inline std::size_t slots_offset() {
+		return (sizeof(header) + 63) & ~std::size_t(63);
+	}
+
+	inline std::size_t stride(const std::size_t slot_size) {
+		return (sizeof(slot) + slot_size + 63) & ~std::size_t(63);
+	}
+
+	inline slot* at(unsigned char* base, const header* h, const uint64_t sequence) {
+		return reinterpret_cast<slot*>(base + slots_offset() + (sequence & (h->capacity - 1)) * h->slot_stride);
+	}
+
+	inline unsigned char* payload(slot* s) {
+		return reinterpret_cast<unsigned char*>(s) + sizeof(slot);
+	}
+
+	inline void store_sender(slot* s, const boost::asio::ip::udp::endpoint& sender) {
+		const auto address = sender.address();
+		s->port = sender.port();
+		std::memset(s->address, 0, sizeof(s->address));
+
+		if (address.is_v4()) {
+			const auto bytes = address.to_v4().to_bytes();
+			s->family = 4;
+			std::memcpy(s->address, bytes.data(), bytes.size());
+		}
+		else {
+			const auto bytes = address.to_v6().to_bytes();
+			s->family = 6;
+			std::memcpy(s->address, bytes.data(), bytes.size());
+		}
+	}
+
+	inline boost::asio::ip::udp::endpoint load_sender(const uint16_t family, const uint16_t port, const unsigned char* address) {
+		if (family == 4) {
+			boost::asio::ip::address_v4::bytes_type bytes;
+			std::memcpy(bytes.data(), address, bytes.size());
+			return boost::asio::ip::udp::endpoint(boost::asio::ip::address_v4(bytes), port);
+		}
+
+		boost::asio::ip::address_v6::bytes_type bytes;
+		std::memcpy(bytes.data(), address, bytes.size());
+		return boost::asio::ip::udp::endpoint(boost::asio::ip::address_v6(bytes), port);
+	}
+}
+
+class boost_udp_shm_publisher {
+	std::string name;
+	boost_udp_shm_options options;
+
+	unsigned char* base = nullptr;
+	std::size_t mapped = 0;
+	boost_udp_shm_layout::header* header = nullptr;
+
+	boost::asio::ip::udp::endpoint sender;
+
+	boost::system::error_code open_ec;
+	uint64_t oversize = 0;
+
+	static std::size_t round_up_power_of_two(std::size_t n) {
+		std::size_t p = 1;
+
+		while (p < n)
+			p <<= 1;
+
+		return p;
+	}
+
+	boost::system::error_code create() {
+		using namespace boost_udp_shm_layout;
+
+		const std::size_t capacity = round_up_power_of_two(options.capacity ? options.capacity : 1);
+		mapped = slots_offset() + capacity * stride(options.slot_size);
+
+		// Start afresh, anyone still reading an old ring keeps it
+		::shm_unlink(name.c_str());
+
+		const int fd = ::shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0644);
+
+		if (fd < 0)
+			return boost::system::error_code(errno, boost::system::system_category());
+
+		if (::ftruncate(fd, static_cast<off_t>(mapped)) != 0) {
+			const int error = errno;
+			::close(fd);
+			::shm_unlink(name.c_str());
+			return boost::system::error_code(error, boost::system::system_category());
+		}
+
+		void* p = ::mmap(nullptr, mapped, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		::close(fd);
+
+		if (p == MAP_FAILED) {
+			const int error = errno;
+			::shm_unlink(name.c_str());
+			return boost::system::error_code(error, boost::system::system_category());
+		}
+
+		// ftruncate() gave us zeros, which is an empty
+		// ring, just fill in the header.
+		base = static_cast<unsigned char*>(p);
+		header = reinterpret_cast<boost_udp_shm_layout::header*>(base);
+		header->version = version;
+		header->capacity = static_cast<uint32_t>(capacity);
+		header->slot_size = static_cast<uint32_t>(options.slot_size);
+		header->slot_stride = static_cast<uint32_t>(stride(options.slot_size));
+		header->published.store(0, std::memory_order_relaxed);
+		header->magic.store(magic, std::memory_order_release);
+
+		return{};
+	}
+
+	// Mark a slot as being written, readers copying it out will
+	// notice. Returns what the slot held.
+	static uint64_t begin_write(boost_udp_shm_layout::slot* s) noexcept {
+		const uint64_t previous = s->sequence.load(std::memory_order_relaxed);
+
+		s->sequence.store(0, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+
+		return previous;
+	}
+
+	void end_write(boost_udp_shm_layout::slot* s, const uint64_t sequence) noexcept {
+		s->sequence.store(sequence + 1, std::memory_order_release);
+		header->published.store(sequence + 1, std::memory_order_release);
+	}
+
+public:
+	//
+	// Create the ring called name (a POSIX shared memory name,
+	// e.g. "/feed_a"), replacing any there already.
+	//
+	boost_udp_shm_publisher(const std::string& name, const boost_udp_shm_options& options, boost::system::error_code& ec)
+		: name(name), options(options) {
+
+		ec = open_ec = create();
+	}
+
+	//
+	// Throws boost::system::system_error if the ring can't be
+	// created, when built without exceptions check open_error().
+	//
+	explicit boost_udp_shm_publisher(const std::string& name, const boost_udp_shm_options& options = boost_udp_shm_options())
+		: name(name), options(options) {
+
+		open_ec = create();
+
+#ifndef BOOST_UDP_RECEIVE_RAR_NO_EXCEPTIONS
+		if (open_ec)
+			boost::throw_exception(boost::system::system_error(open_ec));
+#endif
+	}
+
+	boost_udp_shm_publisher(const boost_udp_shm_publisher&) = delete;
+	boost_udp_shm_publisher& operator=(const boost_udp_shm_publisher&) = delete;
+
+	~boost_udp_shm_publisher() {
+		if (!base)
+			return;
+
+		::munmap(base, mapped);
+
+		if (options.unlink_on_close)
+			::shm_unlink(name.c_str());
+	}
+
+	//
+	// Copy a datagram into the ring. Returns false if it's too
+	// big for a slot (or the ring couldn't be created).
+	//
+	bool publish(const datagram_view& datagram) noexcept {
+		if (!header)
+			return false;
+
+		if (datagram.size > header->slot_size) {
+			oversize++;
+			return false;
+		}
+
+		const uint64_t sequence = header->published.load(std::memory_order_relaxed);
+		boost_udp_shm_layout::slot* s = boost_udp_shm_layout::at(base, header, sequence);
+
+		begin_write(s);
+
+		std::memcpy(boost_udp_shm_layout::payload(s), datagram.data, datagram.size);
+		s->size = static_cast<uint32_t>(datagram.size);
+		boost_udp_shm_layout::store_sender(s, datagram.sender);
+
+		end_write(s, sequence);
+
+		return true;
+	}
+
+	//
+	// Receive a datagram from the socket straight into the next slot,
+	// never blocks. ec is boost::asio::error::would_block once there's
+	// nothing waiting. Returns false if nothing was published, a
+	// datagram too big for a slot is taken off the socket and dropped.
+	//
+	bool receive(boost_udp_receive_rar& rar, boost::system::error_code& ec) noexcept {
+		ec = open_ec;
+
+		if (ec)
+			return false;
+
+		const uint64_t sequence = header->published.load(std::memory_order_relaxed);
+		boost_udp_shm_layout::slot* s = boost_udp_shm_layout::at(base, header, sequence);
+
+		const uint64_t previous = begin_write(s);
+		const std::size_t size = rar.try_receive_into(boost_udp_shm_layout::payload(s), header->slot_size, sender, ec);
+
+		if (ec) {
+			// Nothing written, the slot still holds what it did
+			s->sequence.store(previous, std::memory_order_release);
+			return false;
+		}
+
+		// Too big for a slot, what did fit has overwritten the slot
+		// so it stays marked as empty and nothing is published.
+		if (size > header->slot_size) {
+			oversize++;
+			return false;
+		}
+
+		s->size = static_cast<uint32_t>(size);
+		boost_udp_shm_layout::store_sender(s, sender);
+
+		end_write(s, sequence);
+
+		return true;
+	}
+
+	const boost::system::error_code& open_error() const noexcept {
+		return open_ec;
+	}
+
+	uint64_t published() const noexcept {
+		return header ? header->published.load(std::memory_order_relaxed) : 0;
+	}
+
+	uint64_t oversized() const noexcept {
+		return oversize;
+	}
+};
+
+class boost_udp_shm_reader {
+	unsigned char* base = nullptr;
+	std::size_t mapped = 0;
+	const boost_udp_shm_layout::header* header = nullptr;
+
+	boost::system::error_code open_ec;
+
+	// The next sequence number to read
+	uint64_t next = 0;
+
+	// Where datagrams are copied out to
+	std::vector<unsigned char> buffer;
+	boost::asio::ip::udp::endpoint sender;
+
+	boost_udp_receive_rar_stats counters;
+	uint64_t missed = 0;
+
+	boost::system::error_code open(const std::string& name) {
+		using namespace boost_udp_shm_layout;
+
+		const int fd = ::shm_open(name.c_str(), O_RDONLY, 0);
+
+		if (fd < 0)
+			return boost::system::error_code(errno, boost::system::system_category());
+
+		struct stat st;
+
+		if (::fstat(fd, &st) != 0) {
+			const int error = errno;
+			::close(fd);
+			return boost::system::error_code(error, boost::system::system_category());
+		}
+
+		mapped = static_cast<std::size_t>(st.st_size);
+
+		if (mapped < slots_offset()) {
+			::close(fd);
+			return boost::system::errc::make_error_code(boost::system::errc::invalid_argument);
+		}
+
+		void* p = ::mmap(nullptr, mapped, PROT_READ, MAP_SHARED, fd, 0);
+		::close(fd);
+
+		if (p == MAP_FAILED)
+			return boost::system::error_code(errno, boost::system::system_category());
+
+		base = static_cast<unsigned char*>(p);
+		header = reinterpret_cast<const boost_udp_shm_layout::header*>(base);
+
+		// Not a ring of ours, a different layout, or slots that
+		// don't fit what was mapped. at() masks the sequence with
+		// capacity - 1 so it must be a power of two.
+		const std::size_t capacity = header->capacity;
+
+		if (header->magic.load(std::memory_order_acquire) != magic || header->version != version
+			|| capacity == 0 || (capacity & (capacity - 1)) != 0
+			|| header->slot_stride < stride(header->slot_size)
+			|| mapped < slots_offset() + capacity * header->slot_stride) {
+			return boost::system::errc::make_error_code(boost::system::errc::invalid_argument);
+		}
+
+		buffer.resize(header->slot_size);
+
+		// Start with the next datagram published
+		next = header->published.load(std::memory_order_acquire);
+
+		return{};
+	}
+
+	datagram_view counted(const datagram_view& datagram, const boost::system::error_code& ec) noexcept {
+		if (ec) {
+			counters.errors++;
+			return{};
+		}
+
+		counters.datagrams++;
+		counters.bytes += datagram.size;
+
+		return datagram;
+	}
+
+	bool waiting() const noexcept {
+		return header->published.load(std::memory_order_acquire) != next;
+	}
+
+public:
+	//
+	// Open the ring a boost_udp_shm_publisher created,
+	// any error is reported in ec (and by open_error()).
+	//
+	boost_udp_shm_reader(const std::string& name, boost::system::error_code& ec) {
+		ec = open_ec = open(name);
+	}
+
+	//
+	// Throws boost::system::system_error if the ring can't be
+	// opened, when built without exceptions check open_error().
+	//
+	explicit boost_udp_shm_reader(const std::string& name) {
+		open_ec = open(name);
+
+#ifndef BOOST_UDP_RECEIVE_RAR_NO_EXCEPTIONS
+		if (open_ec) {
+			// The destructor won't run, so tidy up here
+			if (base)
+				::munmap(base, mapped);
+
+			boost::throw_exception(boost::system::system_error(open_ec));
+		}
+#endif
+	}
+
+	boost_udp_shm_reader(const boost_udp_shm_reader&) = delete;
+	boost_udp_shm_reader& operator=(const boost_udp_shm_reader&) = delete;
+
+	~boost_udp_shm_reader() {
+		if (base)
+			::munmap(base, mapped);
+	}
+
+	const boost::system::error_code& open_error() const noexcept {
+		return open_ec;
+	}
+
+	boost_udp_receive_rar_stats stats() const noexcept {
+		return counters;
+	}
+
+	//
+	// Datagrams overwritten before we got to them
+	//
+	uint64_t lost() const noexcept {
+		return missed;
+	}
+
+	//
+	// The next datagram if there is one, never blocks. ec is
+	// boost::asio::error::would_block if there's nothing new.
+	// The view is valid until the next receive.
+	//
+	datagram_view try_receive_view(boost::system::error_code& ec) noexcept {
+		using namespace boost_udp_shm_layout;
+
+		ec = open_ec;
+
+		if (ec)
+			return{};
+
+		for (;;) {
+			const uint64_t published = header->published.load(std::memory_order_acquire);
+
+			if (next == published) {
+				ec = boost::asio::error::would_block;
+				return{};
+			}
+
+			// Lapped, jump to the oldest datagram still there
+			if (published - next > header->capacity) {
+				missed += published - header->capacity - next;
+				next = published - header->capacity;
+			}
+
+			slot* s = at(base, header, next);
+			const uint64_t before = s->sequence.load(std::memory_order_acquire);
+
+			if (before != next + 1) {
+				missed++;
+				next++;
+				continue;
+			}
+
+			const std::size_t size = std::min<std::size_t>(s->size, buffer.size());
+			const uint16_t family = s->family;
+			const uint16_t port = s->port;
+			unsigned char address[sizeof(s->address)];
+
+			std::memcpy(buffer.data(), payload(s), size);
+			std::memcpy(address, s->address, sizeof(address));
+
+			// Make sure nothing was overwritten while we copied
+			std::atomic_thread_fence(std::memory_order_acquire);
+
+			if (s->sequence.load(std::memory_order_relaxed) != before) {
+				missed++;
+				next++;
+				continue;
+			}
+
+			next++;
+			sender = load_sender(family, port, address);
+
+			return counted(datagram_view(buffer.data(), size, sender), ec);
+		}
+	}
+
+	//
+	// Wait up to timeout_ms for a datagram, true if there's
+	// one. Spins briefly before yielding and sleeping.
+	//
+	bool wait(const int timeout_ms, boost::system::error_code& ec) noexcept {
+		ec = open_ec;
+
+		if (ec)
+			return false;
+
+		const auto until = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+		boost_udp_backoff backoff;
+
+		while (!waiting()) {
+			if (std::chrono::steady_clock::now() >= until)
+				return false;
+
+			backoff.pause();
+		}
+
+		return true;
+	}
+
+	//
+	// The receiver's functions, async here means
+	// return straight away if there's nothing new.
+	//
+
+	datagram_view receive_view_async(boost::system::error_code& ec) noexcept {
+		const datagram_view datagram = try_receive_view(ec);
+
+		if (ec == boost::asio::error::would_block)
+			ec.clear();
+
+		return datagram;
+	}
+
+	std::vector<unsigned char> receive_binary_async(boost::system::error_code& ec) {
+		const datagram_view datagram = receive_view_async(ec);
+		return std::vector<unsigned char>(datagram.begin(), datagram.end());
+	}
+
+	std::string receive_async(boost::system::error_code& ec) {
+		const datagram_view datagram = receive_view_async(ec);
+		return std::string(datagram.begin(), datagram.end());
+	}
+
+	datagram_view receive_view_sync(boost::system::error_code& ec) noexcept {
+		for (;;) {
+			const datagram_view datagram = try_receive_view(ec);
+
+			if (ec != boost::asio::error::would_block)
+				return datagram;
+
+			wait(100, ec);
+		}
+	}
+
+	std::vector<unsigned char> receive_binary_sync(boost::system::error_code& ec) {
+		const datagram_view datagram = receive_view_sync(ec);
+		return std::vector<unsigned char>(datagram.begin(), datagram.end());
+	}
+
+	std::string receive_sync(boost::system::error_code& ec) {
+		const datagram_view datagram = receive_view_sync(ec);
+		return std::string(datagram.begin(), datagram.end());
+	}
+
+#ifndef BOOST_UDP_RECEIVE_RAR_NO_EXCEPTIONS
+	//
+	// The throwing versions of the above
+	//
+
+	datagram_view receive_view_async() {
+		boost::system::error_code ec;
+		const datagram_view datagram = receive_view_async(ec);
+		throw_if(ec);
+		return datagram;
+	}
+
+	std::vector<unsigned char> receive_binary_async() {
+		boost::system::error_code ec;
+		auto datagram = receive_binary_async(ec);
+		throw_if(ec);
+		return datagram;
+	}
+
+	std::string receive_async() {
+		boost::system::error_code ec;
+		auto datagram = receive_async(ec);
+		throw_if(ec);
+		return datagram;
+	}
+
+	datagram_view receive_view_sync() {
+		boost::system::error_code ec;
+		const datagram_view datagram = receive_view_sync(ec);
+		throw_if(ec);
+		return datagram;
+	}
+
+	std::vector<unsigned char> receive_binary_sync() {
+		boost::system::error_code ec;
+		auto datagram = receive_binary_sync(ec);
+		throw_if(ec);
+		return datagram;
+	}
+
+	std::string receive_sync() {
+		boost::system::error_code ec;
+		auto datagram = receive_sync(ec);
+		throw_if(ec);
+		return datagram;
+	}
+
+private:
+	static void throw_if(const boost::system::error_code& ec) {
+		if (ec)
+			boost::throw_exception(boost::system::system_error(ec));
+	}
+#endif
+};
@@ -0,0 +1,413 @@
+#pragma once
+
+//   Copyright 2022 Kevin Godden
+//
+//   Licensed under the Apache License, Version 2.0 (the "License");
+//   you may not use this file except in compliance with the License.
+//   You may obtain a copy of the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+//   Unless required by applicable law or agreed to in writing, software
+//   distributed under the License is distributed on an "AS IS" BASIS,
+//   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//   See the License for the specific language governing permissions and
+//   limitations under the License.
+
+#include "boost_udp_receive_rar.h"
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <linux/filter.h>
+#include <sys/socket.h>
+
+//
+// Kernel side filtering of datagrams with classic BPF (Linux only). A small
+// set of rules is turned into a socket filter and attached to a receiver's
+// socket, datagrams that don't pass are dropped by the kernel before they
+// take up space in the socket's queue or cost a receive call.
+//
+// A datagram passes if all of these hold:
+//
+//   - its source address is one of source_addresses (or that list is empty)
+//   - its source port is one of source_ports (or that list is empty)
+//   - its payload length is between min_length and max_length
+//   - for each payload_match, the payload bytes at its offset equal one
+//     of its values
+//
+// IPv4 only. Datagrams that were already queued when the filter is
+// attached are still delivered.
+//
+// Also here is the reuseport steering program, for a group of receivers
+// bound to the same address & port with SO_REUSEPORT. The program picks
+// which receiver (shard) gets each datagram from a key, so the load can
+// be balanced on purpose and related flows kept on the same shard.
+//
+// Synopsis:
+//
+/*
+	boost_udp_receive_rar rar("127.0.0.1", 8861);
+
+	boost_udp_filter_rules rules;
+	rules.source_addresses = { "192.168.1.20", "192.168.1.21" };
+	rules.min_length = 16;
+
+	// Only message types 'A' and 'D', held in the first byte
+	rules.payload_matches.push_back({ 0, { { 'A' }, { 'D' } } });
+
+	const auto ec = boost_udp_attach_filter(rar, rules);
+
+	// Four receivers sharing port 8862, datagrams are steered
+	// to them by the channel number in the first payload byte.
+	boost_udp_reuseport_selector selector;
+	selector.key = boost_udp_reuseport_selector::payload;
+	selector.offset = 0;
+	selector.size = 1;
+
+	boost::system::error_code shards_ec;
+	auto shards = boost_udp_open_shards("127.0.0.1", 8862, 4, selector, boost_udp_receive_rar_options(), shards_ec);
+*/
+
+//
+// A tiny classic BPF assembler. Conditional jumps in classic BPF can only
+// skip 255 instructions, so every branch here is a conditional skip over
+// an unconditional jump (which can go anywhere) to a label.
+//
+class boost_udp_bpf_program {
+	std::vector<sock_filter> code;
+
+	// Where each label is, and the jumps waiting to
+	// be pointed at one.
+	std::vector<std::size_t> labels;
+	std::vector<std::pair<std::size_t, int>> fixups;
+
+	void emit(const uint16_t op, const uint32_t k, const uint8_t jt = 0, const uint8_t jf = 0) {
+		code.push_back(sock_filter{ op, jt, jf, k });
+	}
+
+	void jump_if(const uint16_t op, const uint32_t k, const bool when, const int label) {
+		// Skip the jump unless the test came out as wanted
+		if (when)
+			emit(BPF_JMP | op | BPF_K, k, 0, 1);
+		else
+			emit(BPF_JMP | op | BPF_K, k, 1, 0);
+
+		jump(label);
+	}
+
+public:
+	int new_label() {
+		labels.push_back(static_cast<std::size_t>(-1));
+		return static_cast<int>(labels.size() - 1);
+	}
+
+	void bind(const int label) {
+		labels[label] = code.size();
+	}
+
+	void jump(const int label) {
+		fixups.emplace_back(code.size(), label);
+		emit(BPF_JMP | BPF_JA, 0);
+	}
+
+	// A = packet bytes at offset (1, 2 or 4 of them, network order)
+	void load(const uint32_t offset, const std::size_t size) {
+		const uint16_t width = size == 4 ? BPF_W : size == 2 ? BPF_H : BPF_B;
+		emit(BPF_LD | width | BPF_ABS, offset);
+	}
+
+	// A = packet length
+	void load_length() {
+		emit(BPF_LD | BPF_W | BPF_LEN, 0);
+	}
+
+	// A = one of the kernel's ancillary values (SKF_AD_*)
+	void load_ancillary(const uint32_t which) {
+		emit(BPF_LD | BPF_W | BPF_ABS, SKF_AD_OFF + which);
+	}
+
+	// A = A % k
+	void modulo(const uint32_t k) {
+		emit(BPF_ALU | BPF_MOD | BPF_K, k);
+	}
+
+	void if_equal(const uint32_t k, const int label) { jump_if(BPF_JEQ, k, true, label); }
+	void if_not_equal(const uint32_t k, const int label) { jump_if(BPF_JEQ, k, false, label); }
+	void if_less(const uint32_t k, const int label) { jump_if(BPF_JGE, k, false, label); }
+	void if_greater(const uint32_t k, const int label) { jump_if(BPF_JGT, k, true, label); }
+
+	// Finish with A, or k, as the result
+	void return_a() { emit(BPF_RET | BPF_A, 0); }
+	void return_k(const uint32_t k) { emit(BPF_RET | BPF_K, k); }
+
+	//
+	// The finished program with all jumps resolved
+	//
+	std::vector<sock_filter> assemble() const {
+		std::vector<sock_filter> out = code;
+
+		for (const auto& fixup : fixups)
+			out[fixup.first].k = static_cast<uint32_t>(labels[fixup.second] - fixup.first - 1);
+
+		return out;
+	}
+};
+
+struct boost_udp_filter_rules {
+	// Accept datagrams only from these addresses / ports,
+	// empty lists accept anything.
+	std::vector<std::string> source_addresses;
+	std::vector<uint16_t> source_ports;
+
+	// Accepted payload lengths
+	std::size_t min_length = 0;
+	std::size_t max_length = 65535;
+
+	// The payload bytes at offset must be one of values
+	struct payload_match {
+		std::size_t offset;
+		std::vector<std::vector<unsigned char>> values;
+	};
+
+	std::vector<payload_match> payload_matches;
+
+	//
+	// Turn the rules into a BPF program. A socket filter on a UDP socket
+	// sees the packet from the UDP header on, the IP header is reached
+	// through SKF_NET_OFF.
+	//
+	std::vector<sock_filter> compile() const {
+		const uint32_t udp_header = 8;
+
+		boost_udp_bpf_program program;
+
+		const int reject = program.new_label();
+
+		// Source address
+		if (!source_addresses.empty()) {
+			const int next = program.new_label();
+
+			program.load(SKF_NET_OFF + 12, 4);
+
+			for (const auto& address : source_addresses) {
+				// Bad addresses can't match anything
+				boost::system::error_code ec;
+				const auto v4 = boost::asio::ip::make_address_v4(address, ec);
+
+				if (!ec)
+					program.if_equal(v4.to_uint(), next);
+			}
+
+			program.jump(reject);
+			program.bind(next);
+		}
+
+		// Source port
+		if (!source_ports.empty()) {
+			const int next = program.new_label();
+
+			program.load(0, 2);
+
+			for (const auto port : source_ports)
+				program.if_equal(port, next);
+
+			program.jump(reject);
+			program.bind(next);
+		}
+
+		// Length, the packet length includes the UDP header
+		if (min_length > 0 || max_length < 65535) {
+			program.load_length();
+			program.if_less(static_cast<uint32_t>(min_length + udp_header), reject);
+			program.if_greater(static_cast<uint32_t>(max_length + udp_header), reject);
+		}
+
+		// Payload bytes, compared up to four at a time. Loads past
+		// the end of the packet make the filter drop it, which is
+		// what we want.
+		for (const auto& match : payload_matches) {
+			const int next = program.new_label();
+
+			for (const auto& value : match.values) {
+				const int mismatch = program.new_label();
+
+				for (std::size_t i = 0; i < value.size();) {
+					const std::size_t left = value.size() - i;
+					const std::size_t size = left >= 4 ? 4 : left >= 2 ? 2 : 1;
+
+					uint32_t k = 0;
+
+					for (std::size_t b = 0; b != size; b++)
+						k = (k << 8) | value[i + b];
+
+					program.load(static_cast<uint32_t>(udp_header + match.offset + i), size);
+					program.if_not_equal(k, mismatch);
+
+					i += size;
+				}
+
+				program.jump(next);
+				program.bind(mismatch);
+			}
+
+			program.jump(reject);
+			program.bind(next);
+		}
+
+		// Keep the whole packet
+		program.return_k(0xffffffff);
+
+		program.bind(reject);
+		program.return_k(0);
+
+		return program.assemble();
+	}
+};
+
+//
+// Attach a BPF program to a receiver's socket, replacing
+// any filter that was there.
+//
+inline boost::system::error_code boost_udp_attach_filter(boost_udp_receive_rar& rar, const std::vector<sock_filter>& code) {
+	sock_fprog program;
+	program.len = static_cast<unsigned short>(code.size());
+	program.filter = const_cast<sock_filter*>(code.data());
+
+	if (setsockopt(rar.native_handle(), SOL_SOCKET, SO_ATTACH_FILTER, &program, sizeof(program)) != 0)
+		return boost::system::error_code(errno, boost::system::system_category());
+
+	return{};
+}
+
+inline boost::system::error_code boost_udp_attach_filter(boost_udp_receive_rar& rar, const boost_udp_filter_rules& rules) {
+	boost::system::error_code ec;
+
+	// Validate the addresses before compiling
+	for (const auto& address : rules.source_addresses) {
+		boost::asio::ip::make_address_v4(address, ec);
+
+		if (ec)
+			return ec;
+	}
+
+	return boost_udp_attach_filter(rar, rules.compile());
+}
+
+//
+// Remove the receiver's socket filter
+//
+inline boost::system::error_code boost_udp_detach_filter(boost_udp_receive_rar& rar) {
+	int ignored = 0;
+
+	if (setsockopt(rar.native_handle(), SOL_SOCKET, SO_DETACH_FILTER, &ignored, sizeof(ignored)) != 0)
+		return boost::system::error_code(errno, boost::system::system_category());
+
+	return{};
+}
+
+//
+// How datagrams are steered between the receivers of a reuseport
+// group, the shard is key % shards.
+//
+struct boost_udp_reuseport_selector {
+	enum key_type {
+		// An unsigned, big endian, field in the payload (size 1, 2
+		// or 4 bytes at offset), e.g. a channel id. Datagrams too
+		// short to hold it go to shard 0.
+		payload,
+
+		// The sender's port, assumes IPv4 headers without options
+		source_port,
+
+		// The CPU the datagram was received on by the kernel,
+		// handy with receive threads pinned one per CPU.
+		cpu
+	};
+
+	key_type key = source_port;
+
+	std::size_t offset = 0;
+	std::size_t size = 1;
+
+	//
+	// A reuseport program returns the index of the socket (in the order
+	// they were bound) to receive the datagram, it sees the packet from
+	// the start of the UDP payload.
+	//
+	std::vector<sock_filter> compile(const uint32_t shards) const {
+		boost_udp_bpf_program program;
+
+		switch (key) {
+		case payload:
+			program.load(static_cast<uint32_t>(offset), size);
+			break;
+
+		case source_port:
+			program.load(SKF_NET_OFF + 20, 2);
+			break;
+
+		case cpu:
+			program.load_ancillary(SKF_AD_CPU);
+			break;
+		}
+
+		program.modulo(shards ? shards : 1);
+		program.return_a();
+
+		return program.assemble();
+	}
+};
+
+//
+// Attach a steering program to a reuseport group, through any
+// one of its receivers.
+//
+inline boost::system::error_code boost_udp_attach_reuseport_selector(boost_udp_receive_rar& rar,
+	const boost_udp_reuseport_selector& selector, const uint32_t shards) {
+
+	const std::vector<sock_filter> code = selector.compile(shards);
+
+	sock_fprog program;
+	program.len = static_cast<unsigned short>(code.size());
+	program.filter = const_cast<sock_filter*>(code.data());
+
+	if (setsockopt(rar.native_handle(), SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &program, sizeof(program)) != 0)
+		return boost::system::error_code(errno, boost::system::system_category());
+
+	return{};
+}
+
+//
+// Open shards receivers on the same address & port with SO_REUSEPORT
+// and steer datagrams between them with the selector. Shard i of the
+// result gets the datagrams whose key % shards == i. They are opened one
+// at a time as the kernel numbers them in the order they're bound.
+//
+inline std::vector<std::unique_ptr<boost_udp_receive_rar>> boost_udp_open_shards(const std::string& ip_address,
+	const int port, const uint32_t shards, const boost_udp_reuseport_selector& selector,
+	boost_udp_receive_rar_options options, boost::system::error_code& ec) {
+
+	std::vector<std::unique_ptr<boost_udp_receive_rar>> receivers;
+
+	options.reuse_port = true;
+
+	for (uint32_t i = 0; i != shards; i++) {
+		receivers.emplace_back(new boost_udp_receive_rar(ip_address, port, options, ec));
+
+		if (ec) {
+			receivers.clear();
+			return receivers;
+		}
+	}
+
+	if (!receivers.empty())
+		ec = boost_udp_attach_reuseport_selector(*receivers.front(), selector, shards);
+
+	if (ec)
+		receivers.clear();
+
+	return receivers;
+}
@@ -0,0 +1,207 @@
+#pragma once
+
+//   Copyright 2022 Kevin Godden
+//
+//   Licensed under the Apache License, Version 2.0 (the "License");
+//   you may not use this file except in compliance with the License.
+//   You may obtain a copy of the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+//   Unless required by applicable law or agreed to in writing, software
+//   distributed under the License is distributed on an "AS IS" BASIS,
+//   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//   See the License for the specific language governing permissions and
+//   limitations under the License.
+
+#include "boost_udp_receive_rar.h"
+#include "boost_udp_byte_order.h"
+
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+//
+// Reads fixed layout binary messages straight out of the receive buffer,
+// in place of copying a datagram into a struct and byte swapping it by
+// hand. A message type lists its fields, each with its offset, type,
+// endianness and (for integers narrower than their type) width, all at
+// compile time, along with the message's size:
+//
+//   struct trade {
+//       using price = boost_udp_field<0, uint64_t>;
+//       using quantity = boost_udp_field<8, uint32_t>;
+//       using side = boost_udp_field<12, char>;
+//       using venue = boost_udp_field<13, uint32_t, true, 3>;
+//
+//       static const std::size_t size = 16;
+//   };
+//
+// A boost_udp_typed_view<trade> checks the datagram is at least size
+// bytes, each field is decoded from the buffer when it's asked for.
+// The view is only valid as long as the datagram_view it came from.
+//
+// Synopsis:
+//
+/*
+	boost::system::error_code ec;
+	const auto t = boost_udp_receive_as<trade>(rar, ec);
+
+	// ec is boost::asio::error::message_size if
+	// the datagram is too short for a trade.
+	if (!ec)
+		book.add(t.get<trade::price>(), t.get<trade::quantity>());
+*/
+
+//
+// A field of a message, Width bytes at Offset read as a Type, which
+// can be an integer (or char, or an enum) or a float or double.
+//
+template <std::size_t Offset, typename Type, bool BigEndian = true, std::size_t Width = sizeof(Type)>
+struct boost_udp_field {
+	static_assert(std::is_arithmetic<Type>::value || std::is_enum<Type>::value, "fields are numbers or enums");
+	static_assert(Width >= 1 && Width <= sizeof(Type), "a field can't be wider than its type");
+	static_assert(std::is_integral<Type>::value || std::is_enum<Type>::value || Width == sizeof(Type),
+		"floating point fields are their full width");
+
+	using type = Type;
+
+	static const std::size_t offset = Offset;
+	static const std::size_t width = Width;
+
+	static Type read(const unsigned char* message) noexcept {
+		const uint64_t bits = boost_udp_read_uint<Width, BigEndian>(message + Offset);
+
+		return from_bits(bits, std::is_floating_point<Type>());
+	}
+
+private:
+	static Type from_bits(const uint64_t bits, std::true_type) noexcept {
+		// Same size unsigned integer, then the bits into a float
+		typename std::conditional<sizeof(Type) == 4, uint32_t, uint64_t>::type narrowed =
+			static_cast<typename std::conditional<sizeof(Type) == 4, uint32_t, uint64_t>::type>(bits);
+
+		Type value;
+		std::memcpy(&value, &narrowed, sizeof(value));
+		return value;
+	}
+
+	static Type from_bits(uint64_t bits, std::false_type) noexcept {
+		// Signed fields narrower than 64 bits are sign extended
+		if (std::is_signed<Type>::value && Width < 8) {
+			const uint64_t sign = uint64_t(1) << (Width * 8 - 1);
+			bits = (bits ^ sign) - sign;
+		}
+
+		return static_cast<Type>(bits);
+	}
+};
+
+template <typename Message>
+class boost_udp_typed_view {
+	datagram_view datagram;
+
+public:
+	boost_udp_typed_view() = default;
+
+	explicit boost_udp_typed_view(const datagram_view& datagram) : datagram(datagram) {
+		if (datagram.size < Message::size)
+			this->datagram = datagram_view();
+	}
+
+	//
+	// Whether there's a whole message to look at
+	//
+	bool valid() const noexcept {
+		return datagram.size != 0;
+	}
+
+	//
+	// Decode a field, e.g. view.get<trade::price>()
+	//
+	template <typename Field>
+	typename Field::type get() const noexcept {
+		static_assert(Field::offset + Field::width <= Message::size, "the field is outside the message");
+
+		return Field::read(datagram.data);
+	}
+
+	//
+	// The datagram the message is in, including
+	// any bytes after the message.
+	//
+	const datagram_view& raw() const noexcept {
+		return datagram;
+	}
+};
+
+//
+// A typed view of a datagram, ec is boost::asio::error::message_size
+// (and the view isn't valid) if it's too short for the message.
+//
+template <typename Message>
+inline boost_udp_typed_view<Message> boost_udp_view_as(const datagram_view& datagram, boost::system::error_code& ec) noexcept {
+	const boost_udp_typed_view<Message> view(datagram);
+
+	if (!view.valid())
+		ec = boost::asio::error::message_size;
+
+	return view;
+}
+
+//
+// Receive a message synchronously, as receive_view_sync() the
+// view is valid until the next sync receive.
+//
+template <typename Message>
+inline boost_udp_typed_view<Message> boost_udp_receive_as(boost_udp_receive_rar& rar, boost::system::error_code& ec) noexcept {
+	const datagram_view datagram = rar.receive_view_sync(ec);
+
+	if (ec)
+		return{};
+
+	return boost_udp_view_as<Message>(datagram, ec);
+}
+
+//
+// Receive a message asynchronously, the view isn't valid (and ec is
+// clear) if nothing has been received. As receive_view_async() the
+// view is valid until the next async receive.
+//
+template <typename Message>
+inline boost_udp_typed_view<Message> boost_udp_receive_as_async(boost_udp_receive_rar& rar, boost::system::error_code& ec) noexcept {
+	const datagram_view datagram = rar.receive_view_async(ec);
+
+	if (ec || datagram.empty())
+		return{};
+
+	return boost_udp_view_as<Message>(datagram, ec);
+}
+
+#ifndef BOOST_UDP_RECEIVE_RAR_NO_EXCEPTIONS
+//
+// The throwing versions, these throw boost::system::system_error
+//
+
+template <typename Message>
+inline boost_udp_typed_view<Message> boost_udp_receive_as(boost_udp_receive_rar& rar) {
+	boost::system::error_code ec;
+	const auto view = boost_udp_receive_as<Message>(rar, ec);
+
+	if (ec)
+		boost::throw_exception(boost::system::system_error(ec));
+
+	return view;
+}
+
+template <typename Message>
+inline boost_udp_typed_view<Message> boost_udp_receive_as_async(boost_udp_receive_rar& rar) {
+	boost::system::error_code ec;
+	const auto view = boost_udp_receive_as_async<Message>(rar, ec);
+
+	if (ec)
+		boost::throw_exception(boost::system::system_error(ec));
+
+	return view;
+}
+#endif
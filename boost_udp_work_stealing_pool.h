@@ -0,0 +1,510 @@
+#pragma once
+
+//   Copyright 2022 Kevin Godden
+//
+//   Licensed under the Apache License, Version 2.0 (the "License");
+//   you may not use this file except in compliance with the License.
+//   You may obtain a copy of the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+//   Unless required by applicable law or agreed to in writing, software
+//   distributed under the License is distributed on an "AS IS" BASIS,
+//   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//   See the License for the specific language governing permissions and
+//   limitations under the License.
+
+#include "boost_udp_datagram_ring.h"
+#include "boost_udp_receive_thread.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+//
+// A work-stealing pool of threads for stateless datagram processing.
+// Datagrams are copied into batches, full batches are handed to the
+// workers in turn, and a worker with nothing to do steals batches from
+// the others. Unlike boost_udp_flow_dispatcher there's no ordering
+// between datagrams, but a skewed mix of traffic still keeps every
+// worker busy.
+//
+// submit() and flush() must only be called from one thread, typically
+// a boost_udp_receive_thread, flushing whenever the socket is drained
+// so that a part filled batch isn't left waiting.
+//
+// Synopsis:
+//
+/*
+	boost_udp_work_stealing_pool pool(4, [](unsigned worker, const datagram_view& datagram) {
+		process(datagram);
+	});
+
+	boost_udp_receive_thread thread(rar,
+		[&](const datagram_view& datagram) { pool.submit(datagram); },
+		boost_udp_thread_options(),
+		[&]() { pool.flush(); });
+*/
+
+//
+// A batch of datagrams copied back to back into one block of memory
+//
+class boost_udp_datagram_batch {
+	struct entry {
+		std::size_t offset;
+		std::size_t size;
+		boost::asio::ip::udp::endpoint sender;
+	};
+
+	std::unique_ptr<unsigned char[]> bytes;
+	std::size_t capacity_bytes;
+	std::size_t used = 0;
+
+	std::vector<entry> entries;
+	std::size_t max_entries;
+
+public:
+	boost_udp_datagram_batch(const std::size_t max_datagrams, const std::size_t max_bytes)
+		: bytes(new unsigned char[max_bytes]), capacity_bytes(max_bytes), max_entries(max_datagrams) {
+		entries.reserve(max_datagrams);
+	}
+
+	//
+	// Copy a datagram in, false if there's no room
+	//
+	bool add(const datagram_view& datagram) {
+		if (entries.size() == max_entries || used + datagram.size > capacity_bytes)
+			return false;
+
+		std::memcpy(bytes.get() + used, datagram.data, datagram.size);
+		entries.push_back(entry{ used, datagram.size, datagram.sender });
+		used += datagram.size;
+
+		return true;
+	}
+
+	datagram_view operator[](const std::size_t i) const {
+		const entry& e = entries[i];
+		return datagram_view(bytes.get() + e.offset, e.size, e.sender);
+	}
+
+	std::size_t size() const { return entries.size(); }
+	bool empty() const { return entries.empty(); }
+	bool full() const { return entries.size() == max_entries; }
+
+	void clear() {
+		entries.clear();
+		used = 0;
+	}
+};
+
+struct boost_udp_work_stealing_options {
+	// Datagrams per batch, and the bytes a batch can hold
+	std::size_t batch_datagrams = 32;
+	std::size_t batch_bytes = 64 * 1024;
+
+	// Batches allowed in flight, once they're all in use
+	// the overflow policy decides. drop_oldest drops the
+	// oldest batch waiting for a worker.
+	std::size_t max_batches = 256;
+	boost_udp_overflow_options overflow;
+
+	// Applied to every worker thread
+	boost_udp_thread_options worker_thread;
+};
+
+struct boost_udp_work_stealing_stats {
+	uint64_t submitted = 0;
+	uint64_t dropped = 0;
+
+	// What the overflow policy did, as in boost_udp_queue_stats
+	uint64_t evicted = 0;
+	uint64_t blocked = 0;
+	uint64_t conflated = 0;
+	std::size_t held = 0;
+
+	struct worker {
+		uint64_t processed = 0;
+		uint64_t batches = 0;
+
+		// Batches this worker took from the others
+		uint64_t stolen = 0;
+	};
+
+	std::vector<worker> workers;
+};
+
+class boost_udp_work_stealing_pool {
+public:
+	using handler_type = std::function<void(unsigned worker, const datagram_view&)>;
+
+private:
+	using batch_ptr = boost_udp_datagram_batch*;
+
+	// Each worker's queue of batches. The owner takes the
+	// oldest, thieves take the newest, which keeps the owner's
+	// latency down and leaves thieves the most work.
+	struct worker {
+		std::mutex mutex;
+		std::deque<batch_ptr> batches;
+
+		std::atomic<uint64_t> processed{ 0 };
+		std::atomic<uint64_t> completed{ 0 };
+		std::atomic<uint64_t> stolen{ 0 };
+
+		std::thread thread;
+	};
+
+	handler_type handler;
+	boost_udp_work_stealing_options options;
+
+	std::vector<std::unique_ptr<worker>> workers;
+
+	// Every batch there is, and the ones not in use
+	std::vector<std::unique_ptr<boost_udp_datagram_batch>> all_batches;
+	std::vector<batch_ptr> free_batches;
+	std::mutex free_mutex;
+
+	// The batch being filled by submit()
+	batch_ptr filling = nullptr;
+
+	// Held back by the conflate policy
+	std::unique_ptr<boost_udp_held_datagrams> held;
+
+	// Which worker gets the next batch
+	unsigned next_worker = 0;
+
+	std::atomic<uint64_t> submitted{ 0 };
+	std::atomic<uint64_t> dropped{ 0 };
+	std::atomic<uint64_t> evicted{ 0 };
+	std::atomic<uint64_t> blocked{ 0 };
+	std::atomic<uint64_t> conflated{ 0 };
+	std::atomic<std::size_t> held_count{ 0 };
+
+	// Batches handed over but not yet finished with
+	std::atomic<std::size_t> outstanding{ 0 };
+	std::atomic<bool> stopping{ false };
+
+	batch_ptr take_free_batch() {
+		std::lock_guard<std::mutex> lock(free_mutex);
+
+		if (free_batches.empty())
+			return nullptr;
+
+		batch_ptr b = free_batches.back();
+		free_batches.pop_back();
+
+		return b;
+	}
+
+	void give_back(batch_ptr b) {
+		b->clear();
+
+		std::lock_guard<std::mutex> lock(free_mutex);
+		free_batches.push_back(b);
+	}
+
+	// Our own oldest batch, or else the newest one
+	// from the first busy worker we find.
+	batch_ptr find_work(const unsigned index) {
+		{
+			worker& own = *workers[index];
+			std::lock_guard<std::mutex> lock(own.mutex);
+
+			if (!own.batches.empty()) {
+				batch_ptr b = own.batches.front();
+				own.batches.pop_front();
+				return b;
+			}
+		}
+
+		for (unsigned n = 1; n < workers.size(); n++) {
+			worker& victim = *workers[(index + n) % workers.size()];
+			std::lock_guard<std::mutex> lock(victim.mutex);
+
+			if (!victim.batches.empty()) {
+				batch_ptr b = victim.batches.back();
+				victim.batches.pop_back();
+				workers[index]->stolen.fetch_add(1, std::memory_order_relaxed);
+				return b;
+			}
+		}
+
+		return nullptr;
+	}
+
+	// Copy a datagram into the current batch, handing the
+	// batch over once it's full. False if there's no batch
+	// to put it in.
+	bool add(const datagram_view& datagram) {
+		if (!filling)
+			filling = take_free_batch();
+
+		if (!filling || !filling->add(datagram)) {
+			// No room left, send it on and start another
+			hand_over();
+
+			if (!filling)
+				filling = take_free_batch();
+
+			if (!filling || !filling->add(datagram))
+				return false;
+		}
+
+		submitted.fetch_add(1, std::memory_order_relaxed);
+
+		if (filling->full())
+			hand_over();
+
+		return true;
+	}
+
+	// Hand the part filled batch, if any, to a worker
+	void hand_over() {
+		if (!filling || filling->empty())
+			return;
+
+		outstanding.fetch_add(1, std::memory_order_acq_rel);
+
+		worker& w = *workers[next_worker];
+		next_worker = (next_worker + 1) % workers.size();
+
+		{
+			std::lock_guard<std::mutex> lock(w.mutex);
+			w.batches.push_back(filling);
+		}
+
+		filling = nullptr;
+	}
+
+	// Drop the oldest batch a worker hasn't started on
+	bool evict() {
+		for (unsigned n = 0; n != workers.size(); n++) {
+			worker& victim = *workers[(next_worker + n) % workers.size()];
+			batch_ptr b = nullptr;
+
+			{
+				std::lock_guard<std::mutex> lock(victim.mutex);
+
+				if (victim.batches.empty())
+					continue;
+
+				b = victim.batches.front();
+				victim.batches.pop_front();
+			}
+
+			evicted.fetch_add(b->size(), std::memory_order_relaxed);
+			give_back(b);
+			outstanding.fetch_sub(1, std::memory_order_acq_rel);
+
+			return true;
+		}
+
+		return false;
+	}
+
+	// Hold a datagram back, false if it had to be dropped
+	bool hold(const datagram_view& datagram) {
+		switch (held->hold(options.overflow.key(datagram), datagram)) {
+		case boost_udp_held_datagrams::held:
+			break;
+
+		case boost_udp_held_datagrams::replaced:
+			conflated.fetch_add(1, std::memory_order_relaxed);
+			break;
+
+		case boost_udp_held_datagrams::full:
+			dropped.fetch_add(1, std::memory_order_relaxed);
+			return false;
+		}
+
+		held_count.store(held->size(), std::memory_order_relaxed);
+
+		return true;
+	}
+
+	// Move what's held back into batches while there are any
+	void release_held() {
+		if (!held)
+			return;
+
+		while (!held->empty() && add(held->front()))
+			held->pop();
+
+		held_count.store(held->size(), std::memory_order_relaxed);
+	}
+
+	void run(const unsigned index) {
+		boost_udp_apply_thread_options(options.worker_thread);
+
+		worker& w = *workers[index];
+		boost_udp_backoff backoff;
+
+		for (;;) {
+			batch_ptr b = find_work(index);
+
+			if (b) {
+				for (std::size_t i = 0; i != b->size(); i++)
+					handler(index, (*b)[i]);
+
+				w.processed.fetch_add(b->size(), std::memory_order_relaxed);
+				w.completed.fetch_add(1, std::memory_order_relaxed);
+
+				give_back(b);
+				outstanding.fetch_sub(1, std::memory_order_acq_rel);
+
+				backoff.reset();
+			}
+			else if (stopping.load(std::memory_order_acquire) && outstanding.load(std::memory_order_acquire) == 0) {
+				break;
+			}
+			else {
+				backoff.pause();
+			}
+		}
+	}
+
+public:
+	boost_udp_work_stealing_pool(const unsigned worker_count, handler_type handler,
+		const boost_udp_work_stealing_options& options = boost_udp_work_stealing_options())
+		: handler(std::move(handler)), options(options) {
+
+		if (options.overflow.policy == boost_udp_overflow_options::conflate) {
+			held.reset(new boost_udp_held_datagrams(options.overflow.max_held));
+
+			if (!this->options.overflow.key)
+				this->options.overflow.key = boost_udp_sender_key;
+		}
+
+		for (std::size_t i = 0; i != std::max<std::size_t>(options.max_batches, 1); i++) {
+			all_batches.emplace_back(new boost_udp_datagram_batch(options.batch_datagrams, options.batch_bytes));
+			free_batches.push_back(all_batches.back().get());
+		}
+
+		for (unsigned i = 0; i != std::max(worker_count, 1u); i++)
+			workers.emplace_back(new worker);
+
+		for (unsigned i = 0; i != workers.size(); i++)
+			workers[i]->thread = std::thread([this, i]() { run(i); });
+	}
+
+	boost_udp_work_stealing_pool(const boost_udp_work_stealing_pool&) = delete;
+	boost_udp_work_stealing_pool& operator=(const boost_udp_work_stealing_pool&) = delete;
+
+	~boost_udp_work_stealing_pool() {
+		stop();
+	}
+
+	//
+	// Copy a datagram into the current batch, handing the batch
+	// to a worker once it's full. If every batch is in use the
+	// overflow policy decides, returns false if the datagram was
+	// dropped (it's counted).
+	//
+	bool submit(const datagram_view& datagram) {
+		// Too big for any batch
+		if (datagram.size > options.batch_bytes) {
+			dropped.fetch_add(1, std::memory_order_relaxed);
+			return false;
+		}
+
+		// Anything held back goes first, to keep the order
+		if (held && !held->empty()) {
+			release_held();
+
+			if (!held->empty())
+				return hold(datagram);
+		}
+
+		if (add(datagram))
+			return true;
+
+		switch (options.overflow.policy) {
+		case boost_udp_overflow_options::drop_newest:
+			break;
+
+		case boost_udp_overflow_options::drop_oldest:
+			if (evict() && add(datagram))
+				return true;
+
+			break;
+
+		case boost_udp_overflow_options::block: {
+			blocked.fetch_add(1, std::memory_order_relaxed);
+			boost_udp_backoff backoff;
+
+			while (!add(datagram))
+				backoff.pause();
+
+			return true;
+		}
+
+		case boost_udp_overflow_options::conflate:
+			return hold(datagram);
+		}
+
+		dropped.fetch_add(1, std::memory_order_relaxed);
+
+		return false;
+	}
+
+	//
+	// Hand the part filled batch, and anything held back
+	// by the conflate policy, to the workers.
+	//
+	void flush() {
+		release_held();
+		hand_over();
+	}
+
+	//
+	// Flush, let the workers finish everything
+	// and stop them.
+	//
+	void stop() {
+		// Wait for batches to take what's held back
+		boost_udp_backoff backoff;
+
+		while (held && !held->empty() && !workers.empty() && workers[0]->thread.joinable()) {
+			flush();
+			backoff.pause();
+		}
+
+		flush();
+
+		stopping.store(true, std::memory_order_release);
+
+		for (auto& w : workers) {
+			if (w->thread.joinable())
+				w->thread.join();
+		}
+	}
+
+	boost_udp_work_stealing_stats stats() const {
+		boost_udp_work_stealing_stats out;
+		out.submitted = submitted.load(std::memory_order_relaxed);
+		out.dropped = dropped.load(std::memory_order_relaxed);
+		out.evicted = evicted.load(std::memory_order_relaxed);
+		out.blocked = blocked.load(std::memory_order_relaxed);
+		out.conflated = conflated.load(std::memory_order_relaxed);
+		out.held = held_count.load(std::memory_order_relaxed);
+
+		for (const auto& w : workers) {
+			boost_udp_work_stealing_stats::worker ws;
+			ws.processed = w->processed.load(std::memory_order_relaxed);
+			ws.batches = w->completed.load(std::memory_order_relaxed);
+			ws.stolen = w->stolen.load(std::memory_order_relaxed);
+
+			out.workers.push_back(ws);
+		}
+
+		return out;
+	}
+};
@@ -0,0 +1,1375 @@
+#include "../boost_udp_receive_rar.h"
+#include "../boost_udp_receive_thread.h"
+#include "../boost_udp_authenticator.h"
+#include "../boost_udp_byte_order.h"
+#include "../boost_udp_checksum.h"
+#include "../boost_udp_decompressor.h"
+#include "../boost_udp_deduplicator.h"
+#include "../boost_udp_flow_dispatcher.h"
+#include "../boost_udp_journal.h"
+#include "../boost_udp_replay.h"
+#include "../boost_udp_socket_filter.h"
+#include "../boost_udp_typed_view.h"
+#include "../boost_udp_work_stealing_pool.h"
+#include "boost_udp_send_faf.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <ctime>
+#include <endian.h>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <thread>
+
+//
+// Rough & ready benchmarks for boost_udp_receive_rar, everything
+// goes over loopback so the numbers are only good for comparing
+// one configuration against another on the same machine.
+//
+// Usage: ./bench_boost_udp_receive_rar [benchmark name]
+//
+// With no name all of the benchmarks are run.
+//
+
+using bench_clock = std::chrono::steady_clock;
+
+static double seconds_since(const bench_clock::time_point& start) {
+	return std::chrono::duration<double>(bench_clock::now() - start).count();
+}
+
+//
+// Send count datagrams of the given size to the port in
+// back to back bursts, pausing for a moment between bursts.
+//
+static void send_bursts(const int port, const int count, const int size, const int burst) {
+	boost_udp_send_faf sender("127.0.0.1", port);
+	std::vector<unsigned char> payload(size, 'x');
+
+	for (int i = 0; i != count; i++) {
+		sender.send(payload.data(), size);
+
+		if ((i + 1) % burst == 0)
+			std::this_thread::sleep_for(std::chrono::microseconds(200));
+	}
+}
+
+//
+// The async receive exactly as it was before the buffers were rotated,
+// for comparison: one receive in flight, poll_one() to run it, and the
+// datagram copied out before the next call re-arms it.
+//
+class baseline_async_receiver {
+	boost::asio::io_service io_service;
+	boost::asio::ip::udp::socket socket;
+	std::vector<unsigned char> buffer;
+	bool in_receive = false;
+	size_t bytesRead = 0;
+
+public:
+	baseline_async_receiver(const std::string& ip_address, const int port) : socket(io_service) {
+		socket.open(boost::asio::ip::udp::v4());
+		socket.bind(boost::asio::ip::udp::endpoint(boost::asio::ip::address::from_string(ip_address), port));
+
+		boost::asio::socket_base::receive_buffer_size option;
+		socket.get_option(option);
+		buffer.resize(option.value());
+	}
+
+	std::vector<unsigned char> receive_binary_async() {
+		if (in_receive) {
+			if (bytesRead && bytesRead > 0) {
+				std::vector<unsigned char> out;
+				out.resize(bytesRead);
+				std::copy_n(buffer.begin(), bytesRead, out.begin());
+				in_receive = false;
+				return out;
+			}
+			else {
+				if (io_service.stopped())
+					io_service.reset();
+
+				io_service.poll_one();
+			}
+		}
+		else {
+			bytesRead = 0;
+			in_receive = true;
+
+			socket.async_receive(boost::asio::buffer(buffer), 0,
+				[&](boost::system::error_code ec, std::size_t N)
+			{
+				bytesRead = N;
+			}
+
+			);
+		}
+
+		return{};
+	}
+};
+
+// Mean and standard deviation
+static std::pair<double, double> mean_sd(const std::vector<double>& values) {
+	double sum = 0, squares = 0;
+
+	for (const double v : values)
+		sum += v;
+
+	const double mean = sum / values.size();
+
+	for (const double v : values)
+		squares += (v - mean) * (v - mean);
+
+	return { mean, values.size() > 1 ? std::sqrt(squares / (values.size() - 1)) : 0.0 };
+}
+
+//
+// Blast bursts at a receiver and drain it with the async API,
+// reporting how many datagrams made it and how quickly, as the
+// mean and standard deviation over several runs. "before" is the
+// async path as it was before the buffers were rotated.
+//
+static void bench_async_burst() {
+	const int count = 200000;
+	const int size = 64;
+	const int burst = 256;
+	const int runs = 10;
+
+	struct config {
+		const char* name;
+		std::size_t buffers;
+		bool copy;
+	};
+
+	const config configs[] = {
+		{ "before,  1 buffer ", 0, true },
+		{ "vector,  1 buffer ", 1, true },
+		{ "vector,  2 buffers", 2, true },
+		{ "view,    2 buffers", 2, false },
+		{ "view,    8 buffers", 8, false },
+	};
+
+	std::vector<std::vector<double>> loss(std::size(configs)), pps(std::size(configs));
+
+	// Interleaved, so a noisy moment doesn't all land on one config
+	for (int run = 0; run != runs; run++) {
+		for (std::size_t n = 0; n != std::size(configs); n++) {
+			const config& c = configs[n];
+			const int port = 9100 + static_cast<int>(n);
+
+			std::unique_ptr<baseline_async_receiver> before;
+			std::unique_ptr<boost_udp_receive_rar> rar;
+
+			if (c.buffers) {
+				boost_udp_receive_rar_options options;
+				options.async_buffers = c.buffers;
+				rar.reset(new boost_udp_receive_rar("127.0.0.1", port, options));
+
+				// Arm the receive before the sender starts
+				rar->receive_view_async();
+			}
+			else {
+				before.reset(new baseline_async_receiver("127.0.0.1", port));
+				before->receive_binary_async();
+			}
+
+			std::thread sender(send_bursts, port, count, size, burst);
+
+			int received = 0;
+			auto start = bench_clock::now();
+			auto last = start;
+
+			// Drain until nothing has arrived for a while
+			// after the sender has finished.
+			while (received != count && seconds_since(last) < 0.5) {
+				const bool got = before ? !before->receive_binary_async().empty()
+					: c.copy ? !rar->receive_binary_async().empty() : !rar->receive_view_async().empty();
+
+				if (got) {
+					received++;
+					last = bench_clock::now();
+				}
+			}
+
+			sender.join();
+
+			const double elapsed = std::chrono::duration<double>(last - start).count();
+
+			loss[n].push_back(100.0 * (count - received) / count);
+			pps[n].push_back(received / elapsed);
+		}
+	}
+
+	// The receiver's own cost per datagram, without a sender competing
+	// for the CPU: queue a burst on the socket, then time draining it.
+	const int drain_burst = 128;
+	const int drains = 200;
+	std::vector<std::vector<double>> drain_ns(std::size(configs));
+
+	for (int run = 0; run != runs; run++) {
+		for (std::size_t n = 0; n != std::size(configs); n++) {
+			const config& c = configs[n];
+			const int port = 9100 + static_cast<int>(n);
+
+			std::unique_ptr<baseline_async_receiver> before;
+			std::unique_ptr<boost_udp_receive_rar> rar;
+
+			if (c.buffers) {
+				boost_udp_receive_rar_options options;
+				options.async_buffers = c.buffers;
+				rar.reset(new boost_udp_receive_rar("127.0.0.1", port, options));
+				rar->receive_view_async();
+			}
+			else {
+				before.reset(new baseline_async_receiver("127.0.0.1", port));
+				before->receive_binary_async();
+			}
+
+			boost_udp_send_faf sender("127.0.0.1", port);
+			std::vector<unsigned char> payload(size, 'x');
+			double elapsed = 0;
+			long drained = 0;
+
+			for (int d = 0; d != drains; d++) {
+				for (int i = 0; i != drain_burst; i++)
+					sender.send(payload.data(), size);
+
+				int received = 0;
+				const auto start = bench_clock::now();
+				auto last = start;
+
+				while (received != drain_burst && seconds_since(last) < 0.01) {
+					const bool got = before ? !before->receive_binary_async().empty()
+						: c.copy ? !rar->receive_binary_async().empty() : !rar->receive_view_async().empty();
+
+					if (got) {
+						received++;
+						last = bench_clock::now();
+					}
+				}
+
+				elapsed += std::chrono::duration<double>(last - start).count();
+				drained += received;
+			}
+
+			drain_ns[n].push_back(elapsed * 1e9 / drained);
+		}
+	}
+
+	for (std::size_t n = 0; n != std::size(configs); n++) {
+		const auto l = mean_sd(loss[n]);
+		const auto p = mean_sd(pps[n]);
+		const auto d = mean_sd(drain_ns[n]);
+
+		std::cout << "async_burst " << configs[n].name << ": loss " << l.first << "% +/- " << l.second
+			<< ", " << static_cast<long>(p.first) << " pps +/- " << static_cast<long>(p.second)
+			<< ", drain " << d.first << " ns/datagram +/- " << d.second
+			<< " (" << runs << " runs)" << std::endl;
+	}
+}
+
+//
+// Resident memory of this process in MB
+//
+static double resident_mb() {
+	std::ifstream statm("/proc/self/statm");
+	long pages = 0, resident = 0;
+	statm >> pages >> resident;
+
+	return resident * 4096.0 / (1024 * 1024);
+}
+
+//
+// How long it takes to set up lots of receivers, and
+// how much memory they use before any traffic arrives.
+//
+static void bench_startup() {
+	const int ports = 2000;
+	const int first_port = 20000;
+
+	std::vector<std::pair<std::string, int>> addresses;
+
+	for (int i = 0; i != ports; i++)
+		addresses.emplace_back("127.0.0.1", first_port + i);
+
+	struct config {
+		const char* name;
+		bool lazy;
+		bool shared_pool;
+		bool parallel;
+	};
+
+	const config configs[] = {
+		{ "eager                  ", false, false, false },
+		{ "lazy                   ", true, false, false },
+		{ "lazy, shared pool      ", true, true, false },
+		{ "lazy, shared, open_all ", true, true, true },
+	};
+
+	for (const auto& c : configs) {
+		boost_udp_receive_rar_options options;
+		options.lazy_buffers = c.lazy;
+
+		if (c.shared_pool)
+			options.pool = std::make_shared<boost_udp_buffer_pool>();
+
+		const double before = resident_mb();
+		const auto start = bench_clock::now();
+
+		std::vector<std::unique_ptr<boost_udp_receive_rar>> receivers;
+
+		if (c.parallel) {
+			receivers = boost_udp_receive_rar::open_all(addresses, options);
+		}
+		else {
+			for (const auto& a : addresses)
+				receivers.emplace_back(new boost_udp_receive_rar(a.first, a.second, options));
+		}
+
+		const double elapsed = seconds_since(start);
+
+		std::cout << "startup " << c.name << ": " << ports << " receivers in "
+			<< elapsed * 1000 << " ms, " << resident_mb() - before << " MB resident" << std::endl;
+	}
+}
+
+//
+// Nanoseconds on the steady clock, sender and receiver are in
+// the same process so the clocks agree.
+//
+static int64_t now_ns() {
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(bench_clock::now().time_since_epoch()).count();
+}
+
+//
+// Send count datagrams of the given size, each stamped with
+// the time it was sent, a fixed gap apart.
+//
+static void send_stamped(const int port, const int count, const int size, const std::chrono::microseconds gap) {
+	boost_udp_send_faf sender("127.0.0.1", port);
+	std::vector<unsigned char> payload(std::max<int>(size, sizeof(int64_t)), 'x');
+
+	for (int i = 0; i != count; i++) {
+		const int64_t sent = now_ns();
+		std::memcpy(payload.data(), &sent, sizeof(sent));
+		sender.send(payload.data(), static_cast<int>(payload.size()));
+
+		std::this_thread::sleep_for(gap);
+	}
+}
+
+//
+// Print a summary of a set of latencies (in ns)
+//
+static void report_latencies(const std::string& name, std::vector<int64_t> latencies) {
+	if (latencies.empty()) {
+		std::cout << name << ": nothing received" << std::endl;
+		return;
+	}
+
+	std::sort(latencies.begin(), latencies.end());
+
+	auto percentile = [&](const double p) {
+		return latencies[static_cast<size_t>(p * (latencies.size() - 1))] / 1000.0;
+	};
+
+	std::cout << name << ": " << latencies.size() << " datagrams, p50 " << percentile(0.5)
+		<< " us, p99 " << percentile(0.99) << " us, p99.9 " << percentile(0.999)
+		<< " us, max " << percentile(1.0) << " us" << std::endl;
+}
+
+//
+// Latency of the very first datagrams received into freshly
+// allocated buffers, with and without huge pages, pre-faulting
+// and locking. Lots of async buffers are used so that the first
+// thousand datagrams land in memory that hasn't been touched yet.
+//
+static void bench_first_packets() {
+	const int count = 1000;
+	const int size = 1400;
+
+	struct config {
+		const char* name;
+		bool tuned;
+	};
+
+	const config configs[] = {
+		{ "default memory         ", false },
+		{ "huge, prefault, locked ", true },
+	};
+
+	int port = 9200;
+
+	for (const auto& c : configs) {
+		boost_udp_receive_rar_options options;
+		options.async_buffers = count;
+		options.memory.huge_pages = options.memory.prefault = options.memory.lock = c.tuned;
+
+		boost_udp_receive_rar rar("127.0.0.1", port, options);
+
+		std::vector<int64_t> latencies;
+		latencies.reserve(count);
+
+		std::thread sender(send_stamped, port, count, size, std::chrono::microseconds(50));
+
+		const auto start = bench_clock::now();
+
+		while (static_cast<int>(latencies.size()) != count && seconds_since(start) < 5) {
+			const datagram_view view = rar.receive_view_async();
+
+			if (view.size >= sizeof(int64_t)) {
+				int64_t sent;
+				std::memcpy(&sent, view.data, sizeof(sent));
+				latencies.push_back(now_ns() - sent);
+			}
+		}
+
+		sender.join();
+
+		if (!latencies.empty())
+			std::cout << "first_packets " << c.name << ": first datagram " << latencies.front() / 1000.0 << " us" << std::endl;
+
+		report_latencies(std::string("first_packets ") + c.name, latencies);
+
+		port++;
+	}
+}
+
+//
+// Receive latency jitter on a background receive thread, left to
+// the scheduler and then pinned with real-time priority.
+//
+static void bench_thread_jitter() {
+	const int count = 5000;
+
+	struct config {
+		const char* name;
+		bool tuned;
+	};
+
+	const config configs[] = {
+		{ "default           ", false },
+		{ "pinned, SCHED_FIFO", true },
+	};
+
+	int port = 9300;
+
+	for (const auto& c : configs) {
+		boost_udp_receive_rar rar("127.0.0.1", port);
+
+		boost_udp_thread_options options;
+
+		if (c.tuned) {
+			options.cpus = { 0 };
+			options.policy = boost_udp_thread_options::fifo;
+			options.priority = 50;
+			options.lock_memory = true;
+		}
+
+		std::vector<int64_t> latencies;
+		latencies.reserve(count);
+
+		{
+			boost_udp_receive_thread thread(rar, [&](const datagram_view& datagram) {
+				if (datagram.size >= sizeof(int64_t)) {
+					int64_t sent;
+					std::memcpy(&sent, datagram.data, sizeof(sent));
+					latencies.push_back(now_ns() - sent);
+				}
+			}, options);
+
+			if (thread.setup_error())
+				std::cout << "thread_jitter " << c.name << ": couldn't tune thread: " << thread.setup_error().message() << std::endl;
+
+			send_stamped(port, count, 64, std::chrono::microseconds(100));
+
+			// Let the last few arrive
+			std::this_thread::sleep_for(std::chrono::milliseconds(100));
+		}
+
+		report_latencies(std::string("thread_jitter ") + c.name, latencies);
+
+		port++;
+	}
+}
+
+//
+// CPU time used by the calling thread, in seconds
+//
+static double thread_cpu_seconds() {
+	timespec ts;
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+//
+// Mixed traffic where 40% of datagrams are of a type nobody wants,
+// dropped either in user space after receiving them or in the kernel
+// by a socket filter.
+//
+static void bench_socket_filter() {
+	const int count = 100000;
+	const int size = 200;
+
+	struct config {
+		const char* name;
+		bool kernel;
+	};
+
+	const config configs[] = {
+		{ "user space filter", false },
+		{ "kernel BPF filter", true },
+	};
+
+	int port = 9400;
+
+	for (const auto& c : configs) {
+		boost_udp_receive_rar rar("127.0.0.1", port);
+
+		if (c.kernel) {
+			boost_udp_filter_rules rules;
+			rules.payload_matches.push_back({ 0, { { 'A' } } });
+			boost_udp_attach_filter(rar, rules);
+		}
+
+		// The mix, 3 wanted (A) to 2 unwanted (X)
+		std::thread sender([&]() {
+			boost_udp_send_faf faf("127.0.0.1", port);
+			std::vector<unsigned char> payload(size, 'x');
+
+			for (int i = 0; i != count; i++) {
+				payload[0] = i % 5 < 3 ? 'A' : 'X';
+				faf.send(payload.data(), size);
+
+				if (i % 256 == 255)
+					std::this_thread::sleep_for(std::chrono::microseconds(200));
+			}
+		});
+
+		int receives = 0, wanted = 0;
+		boost::system::error_code ec;
+
+		const double cpu_start = thread_cpu_seconds();
+
+		while (rar.wait(200, ec)) {
+			const datagram_view view = rar.try_receive_view(ec);
+
+			if (ec)
+				continue;
+
+			receives++;
+
+			if (view.size && view.data[0] == 'A')
+				wanted++;
+		}
+
+		const double cpu = thread_cpu_seconds() - cpu_start;
+
+		sender.join();
+
+		std::cout << "socket_filter " << c.name << ": " << wanted << " wanted of " << receives
+			<< " received (" << count * 3 / 5 << " wanted sent), receive thread CPU "
+			<< cpu * 1000 << " ms, " << cpu * 1e9 / std::max(wanted, 1) << " ns per wanted datagram" << std::endl;
+
+		port++;
+	}
+}
+
+//
+// Pretend to do some work on a datagram
+//
+static void spin_for_ns(const int64_t ns) {
+	const int64_t until = now_ns() + ns;
+
+	while (now_ns() < until)
+		;
+}
+
+//
+// Processing a skewed mix (80% of datagrams from one flow) on worker
+// threads: a single consumer, the per-flow dispatcher and the
+// work-stealing pool. Datagrams are fed from memory as fast as the
+// workers take them, so this measures processing, not the socket.
+//
+static void bench_processing() {
+	const int count = 200000;
+	const int64_t work_ns = 1000;
+	const unsigned threads = std::max(2u, std::thread::hardware_concurrency());
+
+	struct stamped {
+		int64_t sent;
+		uint32_t flow;
+	};
+
+	// Latencies per worker, so workers don't share
+	std::vector<std::vector<int64_t>> latencies(threads);
+
+	auto process = [&](unsigned worker, const datagram_view& datagram) {
+		stamped s;
+		std::memcpy(&s, datagram.data, sizeof(s));
+		spin_for_ns(work_ns);
+		latencies[worker].push_back(now_ns() - s.sent);
+	};
+
+	// Feed count datagrams to submit, retrying when it's full
+	auto feed = [&](const std::function<bool(const datagram_view&)>& submit) {
+		for (int i = 0; i != count; i++) {
+			stamped s = { now_ns(), i % 5 == 0 ? static_cast<uint32_t>(i) : 0u };
+			const datagram_view datagram(reinterpret_cast<const unsigned char*>(&s), sizeof(s));
+
+			while (!submit(datagram))
+				std::this_thread::yield();
+		}
+	};
+
+	auto report = [&](const std::string& name, const double elapsed) {
+		std::vector<int64_t> all;
+
+		for (auto& l : latencies) {
+			all.insert(all.end(), l.begin(), l.end());
+			l.clear();
+		}
+
+		std::cout << "processing " << name << ": " << static_cast<long>(count / elapsed) << " datagrams/s" << std::endl;
+		report_latencies("processing " + name, all);
+	};
+
+	boost_udp_dispatcher_options dispatcher_options;
+	dispatcher_options.key = [](const datagram_view& datagram) -> uint64_t {
+		stamped s;
+		std::memcpy(&s, datagram.data, sizeof(s));
+		return s.flow;
+	};
+
+	{
+		auto start = bench_clock::now();
+		boost_udp_flow_dispatcher single(1, process, dispatcher_options);
+		feed([&](const datagram_view& d) { return single.dispatch(d); });
+		single.stop();
+		report("single consumer      ", seconds_since(start));
+	}
+
+	{
+		auto start = bench_clock::now();
+		boost_udp_flow_dispatcher dispatcher(threads, process, dispatcher_options);
+		feed([&](const datagram_view& d) { return dispatcher.dispatch(d); });
+		dispatcher.stop();
+		report("per-flow dispatcher  ", seconds_since(start));
+	}
+
+	{
+		auto start = bench_clock::now();
+		boost_udp_work_stealing_pool pool(threads, process);
+		feed([&](const datagram_view& d) { return pool.submit(d); });
+		pool.stop();
+		report("work stealing pool   ", seconds_since(start));
+	}
+}
+
+//
+// Payload deduplication, cost per datagram and how well it does. Every
+// datagram is unique in the first pass, so anything taken for a
+// duplicate is a false positive. In the second each datagram is sent
+// twice, the copy a little later, and every copy should be caught.
+//
+static void bench_dedup() {
+	const int count = 1000000;
+	const int lag = 100;
+
+	for (const int size : { 64, 512, 1400 }) {
+		boost_udp_dedup_options options;
+		options.window = 16384;
+
+		std::vector<unsigned char> payload(size, 'x');
+
+		// Unique payloads, a counter and then padding
+		auto stamp = [&](const uint64_t n) {
+			std::memcpy(payload.data(), &n, sizeof(n));
+			return datagram_view(payload.data(), payload.size());
+		};
+
+		boost_udp_deduplicator unique(options);
+		uint64_t false_positives = 0;
+
+		auto start = bench_clock::now();
+
+		for (int i = 0; i != count; i++)
+			false_positives += !unique.check(stamp(i));
+
+		const double unique_ns = seconds_since(start) * 1e9 / count;
+
+		// Each datagram then its copy lag datagrams later
+		boost_udp_deduplicator copies(options);
+		uint64_t caught = 0;
+
+		start = bench_clock::now();
+
+		for (int i = 0; i != count; i++) {
+			copies.check(stamp(i));
+
+			if (i >= lag)
+				caught += !copies.check(stamp(i - lag));
+		}
+
+		const double copies_ns = seconds_since(start) * 1e9 / (2 * count - lag);
+
+		std::cout << "dedup " << size << " bytes: " << unique_ns << " ns/datagram unique, "
+			<< copies_ns << " ns/datagram with copies, false positives "
+			<< 100.0 * false_positives / count << "%, copies caught "
+			<< 100.0 * caught / (count - lag) << "%, evicted " << copies.stats().evicted << std::endl;
+	}
+}
+
+// The order messages bench_typed_decode() decodes
+struct order {
+	using id = boost_udp_field<0, uint64_t>;
+	using price = boost_udp_field<8, int64_t>;
+	using quantity = boost_udp_field<16, uint32_t>;
+	using side = boost_udp_field<20, uint16_t>;
+
+	static const std::size_t size = 24;
+};
+
+#pragma pack(push, 1)
+struct packed_order {
+	uint64_t id;
+	int64_t price;
+	uint32_t quantity;
+	uint16_t side;
+	uint16_t pad;
+};
+#pragma pack(pop)
+
+//
+// Decoding fixed layout messages: the typed view reading fields in
+// place, against copying into a packed struct and swapping by hand.
+//
+static void bench_typed_decode() {
+	const int count = 20000000;
+	const int messages = 1024;
+
+	// A buffer of big endian orders to decode
+	std::vector<unsigned char> buffer(messages * order::size);
+
+	for (int i = 0; i != messages; i++) {
+		packed_order o = { htobe64(i), static_cast<int64_t>(htobe64(100 + i)), htobe32(i % 7), htobe16(i % 2), 0 };
+		std::memcpy(&buffer[i * order::size], &o, sizeof(o));
+	}
+
+	uint64_t typed_sum = 0, manual_sum = 0;
+
+	auto start = bench_clock::now();
+
+	for (int i = 0; i != count; i++) {
+		const datagram_view datagram(&buffer[(i % messages) * order::size], order::size);
+		const boost_udp_typed_view<order> o(datagram);
+
+		typed_sum += o.get<order::id>() + o.get<order::price>() + o.get<order::quantity>() + o.get<order::side>();
+	}
+
+	const double typed_ns = seconds_since(start) * 1e9 / count;
+
+	start = bench_clock::now();
+
+	for (int i = 0; i != count; i++) {
+		const std::vector<unsigned char> datagram(&buffer[(i % messages) * order::size], &buffer[(i % messages) * order::size] + order::size);
+
+		packed_order o;
+		std::memcpy(&o, datagram.data(), sizeof(o));
+
+		manual_sum += be64toh(o.id) + static_cast<int64_t>(be64toh(o.price)) + be32toh(o.quantity) + be16toh(o.side);
+	}
+
+	const double vector_ns = seconds_since(start) * 1e9 / count;
+
+	start = bench_clock::now();
+
+	for (int i = 0; i != count; i++) {
+		packed_order o;
+		std::memcpy(&o, &buffer[(i % messages) * order::size], sizeof(o));
+
+		manual_sum += be64toh(o.id) + static_cast<int64_t>(be64toh(o.price)) + be32toh(o.quantity) + be16toh(o.side);
+	}
+
+	const double memcpy_ns = seconds_since(start) * 1e9 / count;
+
+	std::cout << "typed_decode typed view              : " << typed_ns << " ns/message" << std::endl;
+	std::cout << "typed_decode vector, memcpy and swap : " << vector_ns << " ns/message" << std::endl;
+	std::cout << "typed_decode memcpy and swap         : " << memcpy_ns << " ns/message"
+		<< (typed_sum * 2 == manual_sum ? "" : " (sums don't match!)") << std::endl;
+}
+
+//
+// Converting payloads of big endian samples to host order, a sample
+// at a time against the SSSE3 and AVX2 shuffles, for payloads from
+// 64 bytes to 64KB. Reports GB/s of payload converted.
+//
+static void bench_byte_order() {
+	const std::size_t total = std::size_t(1) << 30;
+
+	const std::pair<const char*, boost_udp_simd> paths[] = {
+		{ "scalar", boost_udp_simd::scalar },
+		{ "ssse3 ", boost_udp_simd::ssse3 },
+		{ "avx2  ", boost_udp_simd::avx2 },
+	};
+
+	std::vector<unsigned char> src(65536, 0x5a), dst(65536);
+
+	for (const std::size_t width : { 2, 4, 8 }) {
+		for (const std::size_t size : { 64, 512, 1472, 8192, 65536 }) {
+			std::cout << "byte_order " << width * 8 << " bit samples, " << size << " bytes:";
+
+			for (const auto& path : paths) {
+				if (!boost_udp_simd_supported(path.second))
+					continue;
+
+				const std::size_t rounds = total / size;
+				const auto start = bench_clock::now();
+
+				for (std::size_t r = 0; r != rounds; r++) {
+					boost_udp_big_endian_to_host(dst.data(), src.data(), size / width, width, path.second);
+
+					// Don't let the compiler skip the rounds
+					src[r % size] = dst[(r * 7) % size];
+				}
+
+				std::cout << " " << path.first << " " << rounds * size / seconds_since(start) / 1e9 << " GB/s";
+			}
+
+			std::cout << std::endl;
+		}
+	}
+}
+
+//
+// Checksum validation of a batch of datagrams, as a receive thread
+// would hand them over, for the hardware and table CRC32C and for
+// Adler-32. Reports GB/s of payload checked.
+//
+static void bench_checksum() {
+	const std::size_t total = std::size_t(1) << 31;
+	const std::size_t batch_size = 64;
+
+	struct config {
+		const char* name;
+		std::function<uint32_t(const void*, std::size_t)> checksum;
+
+		// Timed over less data
+		bool slow;
+	};
+
+	const config configs[] = {
+		{ "crc32c        ", [](const void* d, std::size_t n) { return boost_udp_crc32c(d, n); }, false },
+		{ "crc32c (table)", [](const void* d, std::size_t n) { return boost_udp_crc32c_software(d, n); }, true },
+		{ "adler32       ", [](const void* d, std::size_t n) { return boost_udp_adler32(d, n); }, false },
+	};
+
+	for (const std::size_t size : { 64, 512, 1472, 8192 }) {
+		// A batch of datagrams, each with its checksum on the end
+		std::vector<unsigned char> memory(batch_size * size);
+
+		for (std::size_t i = 0; i != memory.size(); i++)
+			memory[i] = static_cast<unsigned char>(i * 7);
+
+		for (const auto& c : configs) {
+			const std::size_t rounds = (c.slow ? total / 8 : total) / memory.size();
+
+			for (std::size_t i = 0; i != batch_size; i++) {
+				unsigned char* d = &memory[i * size];
+				const uint32_t sum = c.checksum(d, size - 4);
+				d[size - 4] = sum >> 24, d[size - 3] = sum >> 16, d[size - 2] = sum >> 8, d[size - 1] = sum;
+			}
+
+			std::size_t valid = 0;
+
+			const auto start = bench_clock::now();
+
+			for (std::size_t r = 0; r != rounds; r++) {
+				for (std::size_t i = 0; i != batch_size; i++) {
+					const unsigned char* d = &memory[i * size];
+					const uint32_t expected = (d[size - 4] << 24) | (d[size - 3] << 16) | (d[size - 2] << 8) | d[size - 1];
+					valid += c.checksum(d, size - 4) == expected;
+				}
+			}
+
+			const double elapsed = seconds_since(start);
+
+			std::cout << "checksum " << c.name << " " << size << " byte datagrams: "
+				<< rounds * memory.size() / elapsed / 1e9 << " GB/s, "
+				<< elapsed * 1e9 / (rounds * batch_size) << " ns/datagram"
+				<< (valid == rounds * batch_size ? "" : " (some didn't match!)") << std::endl;
+		}
+
+		// The validator over the batch, with the hardware CRC
+		boost_udp_checksum_validator validator{ boost_udp_checksum_options() };
+
+		for (std::size_t i = 0; i != batch_size; i++) {
+			unsigned char* d = &memory[i * size];
+			const uint32_t sum = boost_udp_crc32c(d, size - 4);
+			d[size - 4] = sum >> 24, d[size - 3] = sum >> 16, d[size - 2] = sum >> 8, d[size - 1] = sum;
+		}
+
+		const std::size_t rounds = total / memory.size();
+		std::vector<datagram_view> batch(batch_size);
+		std::size_t valid = 0;
+
+		const auto start = bench_clock::now();
+
+		for (std::size_t r = 0; r != rounds; r++) {
+			for (std::size_t i = 0; i != batch_size; i++)
+				batch[i] = datagram_view(&memory[i * size], size);
+
+			valid += validator.validate(batch.data(), batch_size);
+		}
+
+		const double elapsed = seconds_since(start);
+
+		std::cout << "checksum validate batch  " << size << " byte datagrams: "
+			<< rounds * memory.size() / elapsed / 1e9 << " GB/s, "
+			<< elapsed * 1e9 / (rounds * batch_size) << " ns/datagram"
+			<< (valid == rounds * batch_size ? "" : " (some didn't match!)") << std::endl;
+	}
+}
+
+//
+// Authenticating (HMAC-SHA256) and decrypting (AES-256-GCM) batches
+// of datagrams of typical market data sizes, with the contexts set up
+// once against setting them up for every datagram. Each round copies
+// the sealed datagrams into a receive buffer first, as GCM decrypts
+// them in place, the copy is included in the times.
+//
+static void bench_authenticator() {
+	const int batch_size = 64;
+	const int rounds = 2000;
+
+	struct config {
+		const char* name;
+		boost_udp_auth_options::mode_type mode;
+	};
+
+	const config configs[] = {
+		{ "hmac-sha256", boost_udp_auth_options::hmac_sha256 },
+		{ "aes-256-gcm", boost_udp_auth_options::aes_gcm },
+	};
+
+	for (const auto& c : configs) {
+		boost_udp_auth_options options;
+		options.mode = c.mode;
+		options.key.assign(32, 0x42);
+
+		for (const std::size_t size : { 64, 256, 1200 }) {
+			boost_udp_authenticator authenticator(options);
+
+			// A batch of sealed datagrams back to back
+			std::vector<std::vector<unsigned char>> sealed;
+			std::vector<unsigned char> payload(size, 'p');
+			unsigned char iv[12] = {};
+
+			for (int i = 0; i != batch_size; i++) {
+				std::memcpy(iv, &i, sizeof(i));
+				sealed.push_back(authenticator.seal(payload.data(), payload.size(), iv));
+			}
+
+			const std::size_t stride = sealed[0].size();
+			std::vector<unsigned char> buffer(batch_size * stride);
+			std::vector<datagram_view> batch(batch_size);
+
+			auto fill = [&]() {
+				for (int i = 0; i != batch_size; i++) {
+					std::memcpy(&buffer[i * stride], sealed[i].data(), stride);
+					batch[i] = datagram_view(&buffer[i * stride], stride);
+				}
+			};
+
+			std::size_t authentic = 0;
+			auto start = bench_clock::now();
+
+			for (int r = 0; r != rounds; r++) {
+				fill();
+				authentic += authenticator.validate(batch.data(), batch_size);
+			}
+
+			const double reused = seconds_since(start);
+
+			// A new authenticator (contexts & key schedule) per datagram
+			start = bench_clock::now();
+
+			for (int r = 0; r != rounds / 10; r++) {
+				fill();
+
+				for (int i = 0; i != batch_size; i++)
+					authentic += boost_udp_authenticator(options).push(batch[i]);
+			}
+
+			const double fresh = seconds_since(start) * 10;
+			const double datagrams = double(rounds) * batch_size;
+
+			std::cout << "authenticator " << c.name << " " << size << " bytes: " << reused * 1e9 / datagrams << " ns/datagram, "
+				<< datagrams * size / reused / 1e9 << " GB/s, set up per datagram " << fresh * 1e9 / datagrams << " ns/datagram"
+				<< (authentic == datagrams + datagrams / 10 ? "" : " (some weren't authentic!)") << std::endl;
+		}
+	}
+}
+
+//
+// Decompressing market data style datagrams (~1200 bytes of JSON quotes)
+// with each codec that's built in, with and without a dictionary (raw
+// content, a few sample datagrams). Prints the compression ratio, the
+// throughput (of decompressed bytes) and the latency decompressing adds
+// per datagram over just copying it, then the same with a decompressor
+// (contexts, dictionary and buffer) made for every datagram.
+//
+static void bench_decompress() {
+#if !BOOST_UDP_HAVE_ZSTD && !BOOST_UDP_HAVE_LZ4
+	std::cout << "decompress: no codecs built in, needs zstd.h and/or lz4frame.h" << std::endl;
+#else
+	const int count = 256;
+	const int rounds = 2000;
+
+	const char* symbols[] = { "AAPL", "MSFT", "AMZN", "GOOG", "META", "NVDA", "TSLA", "JPM" };
+	uint32_t random = 12345;
+
+	auto next = [&]() {
+		random = random * 1103515245 + 12345;
+		return random >> 8;
+	};
+
+	auto quotes = [&]() {
+		std::string payload;
+
+		while (payload.size() < 1150) {
+			const uint32_t bid = 10000 + next() % 90000;
+
+			payload += "{\"type\":\"quote\",\"symbol\":\"" + std::string(symbols[next() % 8]) + "\",\"bid\":" + std::to_string(bid)
+				+ ",\"ask\":" + std::to_string(bid + 1 + next() % 20) + ",\"bid_size\":" + std::to_string(next() % 5000)
+				+ ",\"ask_size\":" + std::to_string(next() % 5000) + ",\"ts\":" + std::to_string(1700000000000000ull + next()) + "}\n";
+		}
+
+		return payload;
+	};
+
+	std::string dictionary;
+
+	for (int i = 0; i != 4; i++)
+		dictionary += quotes();
+
+	std::vector<std::string> payloads;
+
+	for (int i = 0; i != count; i++)
+		payloads.push_back(quotes());
+
+	using compressor = std::function<std::vector<unsigned char>(const std::string&, const std::string&)>;
+
+	struct config {
+		const char* name;
+		boost_udp_decompress_options::codec_type codec;
+		bool dictionary;
+		compressor compress;
+	};
+
+	std::vector<config> configs;
+
+#if BOOST_UDP_HAVE_ZSTD
+	const compressor zstd = [](const std::string& payload, const std::string& dict) {
+		std::vector<unsigned char> frame(ZSTD_compressBound(payload.size()));
+		ZSTD_CCtx* cctx = ZSTD_createCCtx();
+		frame.resize(ZSTD_compress_usingDict(cctx, frame.data(), frame.size(), payload.data(), payload.size(), dict.data(), dict.size(), 3));
+		ZSTD_freeCCtx(cctx);
+		return frame;
+	};
+
+	configs.push_back({ "zstd      ", boost_udp_decompress_options::zstd, false, zstd });
+	configs.push_back({ "zstd, dict", boost_udp_decompress_options::zstd, true, zstd });
+#endif
+
+#if BOOST_UDP_HAVE_LZ4
+	const compressor lz4 = [](const std::string& payload, const std::string& dict) {
+		std::vector<unsigned char> frame(LZ4F_compressFrameBound(payload.size(), nullptr));
+		LZ4F_cctx* cctx = nullptr;
+		LZ4F_createCompressionContext(&cctx, LZ4F_VERSION);
+		LZ4F_CDict* cdict = LZ4F_createCDict(dict.data(), dict.size());
+		frame.resize(LZ4F_compressFrame_usingCDict(cctx, frame.data(), frame.size(), payload.data(), payload.size(), dict.empty() ? nullptr : cdict, nullptr));
+		LZ4F_freeCDict(cdict);
+		LZ4F_freeCompressionContext(cctx);
+		return frame;
+	};
+
+	configs.push_back({ "lz4       ", boost_udp_decompress_options::lz4, false, lz4 });
+	configs.push_back({ "lz4, dict ", boost_udp_decompress_options::lz4, true, lz4 });
+#endif
+
+	std::vector<unsigned char> copy(boost_udp_buffer_pool::max_datagram_size);
+	std::vector<int64_t> latencies;
+
+	// Copying each payload, the least a receiver would do with it
+	for (int r = 0; r != rounds / 10; r++) {
+		for (const auto& payload : payloads) {
+			const int64_t start = now_ns();
+			std::memcpy(copy.data(), payload.data(), payload.size());
+			asm volatile("" : : "r"(copy.data()) : "memory");
+			latencies.push_back(now_ns() - start);
+		}
+	}
+
+	report_latencies("decompress memcpy baseline      ", latencies);
+
+	for (const auto& c : configs) {
+		const std::string dict = c.dictionary ? dictionary : std::string();
+
+		std::vector<std::vector<unsigned char>> frames;
+		std::size_t in = 0, out = 0;
+
+		for (const auto& payload : payloads) {
+			frames.push_back(c.compress(payload, dict));
+			in += frames.back().size();
+			out += payload.size();
+		}
+
+		boost_udp_decompress_options options;
+		options.codec = c.codec;
+		options.dictionary.assign(dict.begin(), dict.end());
+		options.max_output_size = 4096;
+
+		boost_udp_decompressor decompressor(options);
+		boost::system::error_code ec;
+		std::size_t bytes = 0;
+
+		auto start = bench_clock::now();
+
+		for (int r = 0; r != rounds; r++) {
+			for (const auto& frame : frames)
+				bytes += decompressor.decompress(datagram_view(frame.data(), frame.size()), ec).size;
+		}
+
+		const double reused = seconds_since(start);
+
+		latencies.clear();
+
+		for (int r = 0; r != rounds / 10; r++) {
+			for (const auto& frame : frames) {
+				const int64_t sent = now_ns();
+				decompressor.decompress(datagram_view(frame.data(), frame.size()), ec);
+				latencies.push_back(now_ns() - sent);
+			}
+		}
+
+		report_latencies("decompress " + std::string(c.name) + " latency    ", latencies);
+
+		// A new decompressor for every datagram
+		start = bench_clock::now();
+
+		for (int r = 0; r != rounds / 10; r++) {
+			for (const auto& frame : frames)
+				bytes += boost_udp_decompressor(options).decompress(datagram_view(frame.data(), frame.size()), ec).size;
+		}
+
+		const double fresh = seconds_since(start) * 10;
+		const double datagrams = double(rounds) * count;
+
+		std::cout << "decompress " << c.name << ": ratio " << double(out) / in << ", " << reused * 1e9 / datagrams << " ns/datagram, "
+			<< datagrams * out / count / reused / 1e9 << " GB/s, set up per datagram " << fresh * 1e9 / datagrams << " ns/datagram"
+			<< (bytes == out * rounds + out * rounds / 10 ? "" : " (some didn't decompress!)") << std::endl;
+	}
+#endif
+}
+
+//
+// Bursts of datagrams drained without journaling, received straight
+// into a journal, and received and then copied in with record(), all
+// with 64MB segments in /tmp. Then record() on its own into a single
+// segment, which is what journaling adds to the receive path.
+//
+static void bench_journal() {
+	const int count = 200000;
+	const int size = 256;
+	const int burst = 128;
+
+	const std::string prefix = "/tmp/bench_boost_udp_journal_" + std::to_string(::getpid());
+
+	enum mode { plain, receive, record };
+
+	struct config {
+		const char* name;
+		mode how;
+	};
+
+	const config configs[] = {
+		{ "no journal       ", plain },
+		{ "journal receive()", receive },
+		{ "journal record() ", record },
+	};
+
+	boost_udp_journal_options options;
+	options.segment_size = std::size_t(64) << 20;
+	options.overwrite = true;
+
+	int port = 9180;
+
+	for (const auto& c : configs) {
+		boost::system::error_code ec;
+		boost_udp_receive_rar rar("127.0.0.1", port);
+		boost_udp_journal journal(prefix, options, ec);
+
+		std::thread sender(send_bursts, port, count, size, burst);
+
+		int received = 0;
+		auto start = bench_clock::now();
+		auto last = start;
+
+		while (received != count && seconds_since(last) < 0.5) {
+			const datagram_view datagram = c.how == receive ? journal.receive(rar, ec) : rar.try_receive_view(ec);
+
+			if (ec)
+				continue;
+
+			if (c.how == record)
+				journal.record(datagram);
+
+			received++;
+			last = bench_clock::now();
+		}
+
+		sender.join();
+
+		const double elapsed = std::chrono::duration<double>(last - start).count();
+
+		std::cout << "journal " << c.name << ": received " << received << "/" << count
+			<< ", loss " << 100.0 * (count - received) / count << "%"
+			<< ", " << static_cast<long>(received / elapsed) << " pps" << std::endl;
+
+		port++;
+	}
+
+	{
+		boost::system::error_code ec;
+		boost_udp_journal journal(prefix, options, ec);
+
+		std::vector<unsigned char> payload(size, 'x');
+		const datagram_view datagram(payload.data(), payload.size());
+		const int records = 200000;
+
+		const auto start = bench_clock::now();
+
+		for (int i = 0; i != records; i++)
+			journal.record(datagram, i);
+
+		const double elapsed = seconds_since(start);
+
+		std::cout << "journal record() alone, " << size << " bytes: " << elapsed * 1e9 / records << " ns/datagram, "
+			<< journal.stats().segments << " segments" << std::endl;
+	}
+
+	for (uint64_t index = 0; ::unlink(boost_udp_journal_layout::segment_path(prefix, index).c_str()) == 0; index++)
+		;
+}
+
+//
+// Replaying a journal of a million 256 byte datagrams (10us apart) as
+// fast as possible, then the first 20000 of them paced to their time
+// stamps, reporting how late each was handed out.
+//
+static void bench_replay() {
+	const int count = 1000000;
+	const int paced_count = 20000;
+	const int size = 256;
+
+	const std::string prefix = "/tmp/bench_boost_udp_replay_" + std::to_string(::getpid());
+
+	{
+		boost_udp_journal_options options;
+		options.segment_size = std::size_t(64) << 20;
+		options.overwrite = true;
+
+		boost_udp_journal journal(prefix, options);
+		std::vector<unsigned char> payload(size, 'x');
+
+		for (int i = 0; i != count; i++) {
+			std::memcpy(payload.data(), &i, sizeof(i));
+			journal.record(datagram_view(payload.data(), payload.size()), 1700000000000000000ll + i * 10000ll);
+		}
+	}
+
+	{
+		boost_udp_replay replay(prefix);
+		boost::system::error_code ec;
+		uint64_t sum = 0;
+
+		const auto start = bench_clock::now();
+
+		for (;;) {
+			const datagram_view datagram = replay.try_receive_view(ec);
+
+			if (ec)
+				break;
+
+			sum += datagram.data[0];
+		}
+
+		const double elapsed = seconds_since(start);
+		const auto stats = replay.stats();
+
+		std::cout << "replay journal, as fast as possible: " << stats.datagrams << " datagrams, "
+			<< static_cast<long>(stats.datagrams / elapsed) << " datagrams/s, " << stats.bytes / elapsed / 1e9 << " GB/s, "
+			<< elapsed * 1e9 / stats.datagrams << " ns/datagram" << (sum ? "" : " (nothing read!)") << std::endl;
+	}
+
+	{
+		boost_udp_replay_options options;
+		options.paced = true;
+
+		boost_udp_replay replay(prefix, options);
+		boost::system::error_code ec;
+
+		std::vector<int64_t> lateness;
+		int64_t start = 0;
+
+		for (int i = 0; i != paced_count; i++) {
+			replay.receive_view_sync(ec);
+
+			const int64_t now = now_ns();
+
+			if (i == 0)
+				start = now;
+
+			lateness.push_back(now - start - i * 10000ll);
+		}
+
+		report_latencies("replay journal, paced 10us apart, lateness", lateness);
+	}
+
+	for (uint64_t index = 0; ::unlink(boost_udp_journal_layout::segment_path(prefix, index).c_str()) == 0; index++)
+		;
+}
+
+int main(int argc, char* argv[]) {
+	const std::map<std::string, std::function<void()>> benchmarks = {
+		{ "async_burst", bench_async_burst },
+		{ "authenticator", bench_authenticator },
+		{ "byte_order", bench_byte_order },
+		{ "checksum", bench_checksum },
+		{ "decompress", bench_decompress },
+		{ "dedup", bench_dedup },
+		{ "first_packets", bench_first_packets },
+		{ "journal", bench_journal },
+		{ "processing", bench_processing },
+		{ "replay", bench_replay },
+		{ "socket_filter", bench_socket_filter },
+		{ "startup", bench_startup },
+		{ "thread_jitter", bench_thread_jitter },
+		{ "typed_decode", bench_typed_decode },
+	};
+
+	for (const auto& b : benchmarks) {
+		if (argc < 2 || b.first == argv[1])
+			b.second();
+	}
+
+	return 0;
+}
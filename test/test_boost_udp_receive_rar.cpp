@@ -1,10 +1,48 @@
 
 #include "../boost_udp_receive_rar.h"
+#include "../boost_udp_receive_thread.h"
+#include "../boost_udp_authenticator.h"
+#include "../boost_udp_sequencer.h"
+#include "../boost_udp_broadcast_ring.h"
+#include "../boost_udp_byte_order.h"
+#include "../boost_udp_checksum.h"
+#include "../boost_udp_conflation_cache.h"
+#include "../boost_udp_decompressor.h"
+#include "../boost_udp_deduplicator.h"
+#include "../boost_udp_feed_arbitrator.h"
+#include "../boost_udp_flow_dispatcher.h"
+#include "../boost_udp_journal.h"
+#include "../boost_udp_message_splitter.h"
+#include "../boost_udp_replay.h"
+#include "../boost_udp_shm_ring.h"
+#include "../boost_udp_socket_filter.h"
+#include "../boost_udp_typed_view.h"
+#include "../boost_udp_work_stealing_pool.h"
 #include "boost_udp_send_faf.h"
 
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
 #include <iostream>
+#include <mutex>
 #include <thread>
 
+#ifdef BOOST_NO_EXCEPTIONS
+// Built with -fno-exceptions, boost wants us to say what
+// happens when it would have thrown.
+namespace boost {
+	void throw_exception(const std::exception& e) {
+		std::cout << "FAIL: boost::throw_exception(): " << e.what() << std::endl;
+		std::abort();
+	}
+
+	void throw_exception(const std::exception& e, const boost::source_location&) {
+		throw_exception(e);
+	}
+}
+#endif
+
 static void fail(const std::string& message, const std::string& received, const std::string& expected) {
 	std::cout << "FAIL: " << message << ", received: " << received << ", expected: " << expected << std::endl;
 	exit(1);
@@ -27,6 +65,7 @@ static void test_equals(const std::string& message, const std::string& received,
 	}
 }
 
+#ifndef BOOST_UDP_RECEIVE_RAR_NO_EXCEPTIONS
 static void test_equals(const std::string& message, const std::vector<unsigned char>& received, const std::vector<unsigned char>& expected) {
 	if (received != expected) {
 
@@ -124,8 +163,2011 @@ void test_boost_udp_receive_rar() {
 
 	test_equals("async binary", data, { m4.begin(), m4.end() });
 }
+#endif
+
+void test_error_codes() {
+	boost::system::error_code ec;
+
+	// A bad address should be reported, not thrown
+	boost_udp_receive_rar bad("not an address", 8863, ec);
+
+	test_equals("bad address reported", std::to_string(!!ec), "1");
+	test_equals("bad address open_error()", std::to_string(bad.open_error() == ec), "1");
+
+	// And every receive on it fails with the same error
+	boost::system::error_code receive_ec;
+	bad.receive_view_async(receive_ec);
+
+	test_equals("receive on bad receiver", std::to_string(receive_ec == ec), "1");
+
+	// Binding the same port twice fails
+	boost_udp_receive_rar rar("127.0.0.1", 8863, ec);
+
+	test_equals("bind ok", ec.message(), boost::system::error_code().message());
+
+	boost_udp_receive_rar again("127.0.0.1", 8863, ec);
+
+	test_equals("bind twice", std::to_string(ec == boost::asio::error::address_in_use), "1");
+
+	// The error code overloads on a good receiver
+	std::string m1("ec message1");
+	boost_udp_send_faf("127.0.0.1", 8863).send(m1);
+
+	test_equals("ec sync string", rar.receive_sync(ec), m1);
+	test_equals("ec sync ok", ec.message(), boost::system::error_code().message());
+
+	std::string m2("ec message2");
+	boost_udp_send_faf("127.0.0.1", 8863).send(m2);
+
+	std::string datagram;
+	int i = 0;
+
+	do {
+		datagram = rar.receive_async(ec);
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+	} while (datagram.empty() && !ec && ++i < 100);
+
+	test_equals("ec async string", datagram, m2);
+	test_equals("ec async ok", ec.message(), boost::system::error_code().message());
+
+	// An async receive that fails is reported, not dropped. Connect
+	// the socket to a port nobody's on and send, the ICMP port
+	// unreachable fails the armed receive with connection_refused.
+	const uint64_t errors = rar.stats().errors;
+
+	sockaddr_in nobody = {};
+	nobody.sin_family = AF_INET;
+	nobody.sin_port = htons(8899);
+	nobody.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	::connect(rar.native_handle(), reinterpret_cast<const sockaddr*>(&nobody), sizeof(nobody));
+	::send(rar.native_handle(), "x", 1, 0);
+
+	i = 0;
+
+	do {
+		rar.receive_view_async(ec);
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+	} while (!ec && ++i < 100);
+
+	test_equals("ec async error", std::to_string(ec == boost::asio::error::connection_refused), "1");
+	test_equals("ec async error counted", std::to_string(rar.stats().errors - errors), "1");
+
+	// Disconnect, and the next call arms a receive again
+	sockaddr unspecified = {};
+	unspecified.sa_family = AF_UNSPEC;
+	::connect(rar.native_handle(), &unspecified, sizeof(unspecified));
+
+	std::string m3("ec message3");
+	boost_udp_send_faf("127.0.0.1", 8863).send(m3);
+
+	i = 0;
+
+	do {
+		datagram = rar.receive_async(ec);
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+	} while (datagram.empty() && !ec && ++i < 100);
+
+	test_equals("ec async after error", datagram, m3);
+	test_equals("ec async after error ok", ec.message(), boost::system::error_code().message());
+}
+
+void test_receive_view_async() {
+	// Use more buffers than the default so that a burst
+	// is spread across several of them.
+	boost_udp_receive_rar_options options;
+	options.async_buffers = 3;
+
+	boost_udp_receive_rar rar("127.0.0.1", 8862, options);
+
+	// Arm the persistent receive
+	boost::system::error_code ec;
+	datagram_view view = rar.receive_view_async(ec);
+
+	// Send a burst, more datagrams than there are buffers
+	const std::vector<std::string> burst = { "burst1", "burst2", "burst3", "burst4", "burst5" };
+
+	boost_udp_send_faf sender("127.0.0.1", 8862);
+
+	for (const auto& m : burst)
+		sender.send(m);
+
+	// They should all come back, in order
+	std::vector<std::string> received;
+
+	int i = 0;
+
+	while (received.size() != burst.size() && ++i < 100) {
+		view = rar.receive_view_async(ec);
+
+		if (view.empty())
+			std::this_thread::sleep_for(std::chrono::milliseconds(10));
+		else
+			received.emplace_back(view.begin(), view.end());
+	}
+
+	test_equals("view async burst count", std::to_string(received.size()), std::to_string(burst.size()));
+
+	for (size_t n = 0; n != received.size(); n++)
+		test_equals("view async burst", received[n], burst[n]);
+}
+
+void test_lazy_pool() {
+	auto pool = std::make_shared<boost_udp_buffer_pool>(2048, 4);
+
+	boost_udp_receive_rar_options options;
+	options.pool = pool;
+	options.lazy_buffers = true;
+
+	std::vector<boost::system::error_code> errors;
+
+	auto receivers = boost_udp_receive_rar::open_all({ { "127.0.0.1", 8864 }, { "127.0.0.1", 8865 }, { "127.0.0.1", 8866 } }, options, errors, 2);
+
+	test_equals("open_all count", std::to_string(receivers.size()), "3");
+
+	for (const auto& ec : errors)
+		test_equals("open_all ok", ec.message(), boost::system::error_code().message());
+
+	// Nothing is taken from the pool until
+	// the first receive.
+	test_equals("lazy pool untouched", std::to_string(pool->in_use()), "0");
+
+	std::string m1("lazy message1");
+	boost_udp_send_faf("127.0.0.1", 8865).send(m1);
+
+	boost::system::error_code ec;
+	const datagram_view view = receivers[1]->receive_view_sync(ec);
+
+	test_equals("lazy sync receive", std::string(view.begin(), view.end()), m1);
+	test_equals("lazy sync buffer taken", std::to_string(pool->in_use()), "1");
+
+	// The async receive takes the two async buffers
+	receivers[1]->receive_view_async(ec);
+
+	test_equals("lazy async buffers taken", std::to_string(pool->in_use()), "3");
+
+	// Everything goes back when the receivers go
+	receivers.clear();
+
+	test_equals("pool released", std::to_string(pool->in_use()), "0");
+}
+
+void test_pool_memory() {
+	boost_udp_buffer_memory memory;
+	memory.huge_pages = memory.prefault = memory.lock = true;
+
+	auto pool = std::make_shared<boost_udp_buffer_pool>(65536, 4, memory);
+
+	test_equals("memory pool reserve", std::to_string(pool->reserve()), "1");
+
+	// The chunk is rounded up to a 2MB huge page
+	test_equals("memory pool huge page chunk", std::to_string(pool->allocated()), "32");
+
+	const boost_udp_buffer_placement placement = pool->placement();
+
+	test_equals("memory pool huge pages", std::to_string(placement.huge_pages || placement.transparent_huge_pages), "1");
+	test_equals("memory pool prefaulted", std::to_string(placement.prefaulted), "1");
+
+	// mlock() needs a big enough RLIMIT_MEMLOCK, so
+	// just report whether it happened.
+	std::cout << "INFO: memory pool locked: " << placement.locked << std::endl;
+
+	// And receive through it
+	boost_udp_receive_rar_options options;
+	options.pool = pool;
+
+	boost_udp_receive_rar rar("127.0.0.1", 8867, options);
+
+	std::string m1("huge message1");
+	boost_udp_send_faf("127.0.0.1", 8867).send(m1);
+
+	boost::system::error_code ec;
+	const datagram_view view = rar.receive_view_sync(ec);
+
+	test_equals("memory pool receive", std::string(view.begin(), view.end()), m1);
+}
+
+void test_numa_stats() {
+	// Put the buffers on the node of whichever
+	// CPU does the first receive.
+	boost_udp_receive_rar_options options;
+	options.lazy_buffers = true;
+	options.memory.numa_node = boost_udp_buffer_memory::local_numa_node;
+
+	// Loopback has no NUMA node, so this falls
+	// back to the local node.
+	options.memory.numa_interface = "lo";
+
+	boost_udp_receive_rar rar("127.0.0.1", 8868, options);
+
+	test_equals("numa not placed yet", std::to_string(rar.stats().placement.numa_node), "-1");
+
+	std::string m1("numa message1");
+	boost_udp_send_faf("127.0.0.1", 8868).send(m1);
+
+	boost::system::error_code ec;
+	const datagram_view view = rar.receive_view_sync(ec);
+
+	test_equals("numa receive", std::string(view.begin(), view.end()), m1);
+	test_equals("view sender", view.sender.address().to_string(), "127.0.0.1");
+
+	const boost_udp_receive_rar_stats stats = rar.stats();
+
+	test_equals("numa local node", std::to_string(stats.placement.numa_node), std::to_string(boost_udp_current_numa_node()));
+	test_equals("stats datagrams", std::to_string(stats.datagrams), "1");
+	test_equals("stats bytes", std::to_string(stats.bytes), std::to_string(m1.size()));
+}
+
+void test_receive_thread() {
+	boost_udp_receive_rar rar("127.0.0.1", 8869);
+
+	std::mutex mutex;
+	std::vector<std::string> received;
+
+	boost_udp_thread_options options;
+	options.cpus = { 0 };
+
+	boost_udp_receive_thread thread(rar, [&](const datagram_view& datagram) {
+		std::lock_guard<std::mutex> lock(mutex);
+		received.emplace_back(datagram.begin(), datagram.end());
+	}, options);
+
+	test_equals("thread pinned", thread.setup_error().message(), boost::system::error_code().message());
+
+	const std::vector<std::string> messages = { "thread1", "thread2", "thread3" };
+
+	boost_udp_send_faf sender("127.0.0.1", 8869);
+
+	for (const auto& m : messages)
+		sender.send(m);
+
+	for (int i = 0; i != 100; i++) {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+
+			if (received.size() == messages.size())
+				break;
+		}
+
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+	}
+
+	thread.stop();
+
+	test_equals("thread received count", std::to_string(received.size()), std::to_string(messages.size()));
+
+	for (size_t n = 0; n != received.size(); n++)
+		test_equals("thread received", received[n], messages[n]);
+
+	test_equals("thread stopped cleanly", thread.receive_error().message(), boost::system::error_code().message());
+
+	// Real-time scheduling depends on privileges,
+	// so just report how it went.
+	boost_udp_thread_options rt;
+	rt.policy = boost_udp_thread_options::fifo;
+	rt.priority = 10;
+
+	boost_udp_receive_thread rt_thread(rar, [](const datagram_view&) {}, rt);
+
+	std::cout << "INFO: SCHED_FIFO receive thread: " << rt_thread.setup_error().message() << std::endl;
+}
+
+// Send each message, then return what made it to the receiver
+static std::vector<std::string> send_and_drain(boost_udp_receive_rar& rar, const int port, const std::vector<std::string>& messages) {
+	boost_udp_send_faf sender("127.0.0.1", port);
+
+	for (const auto& m : messages)
+		sender.send(m);
+
+	std::vector<std::string> received;
+	boost::system::error_code ec;
+
+	while (rar.wait(100, ec)) {
+		const datagram_view view = rar.try_receive_view(ec);
+
+		if (!ec)
+			received.emplace_back(view.begin(), view.end());
+	}
+
+	return received;
+}
+
+void test_socket_filter() {
+	boost_udp_receive_rar rar("127.0.0.1", 8870);
+
+	// Message types A and D, at least 4 bytes and
+	// with a version of "v1" at offset 2
+	boost_udp_filter_rules rules;
+	rules.source_addresses = { "10.1.2.3", "127.0.0.1" };
+	rules.min_length = 4;
+	rules.max_length = 16;
+	rules.payload_matches.push_back({ 0, { { 'A' }, { 'D' } } });
+	rules.payload_matches.push_back({ 2, { { 'v', '1' } } });
+
+	test_equals("filter attach", boost_udp_attach_filter(rar, rules).message(), boost::system::error_code().message());
+
+	const auto received = send_and_drain(rar, 8870, { "A-v1 wanted", "B-v1 unwanted", "D-v1", "A-v2 old", "Av1", "D-v1 far too long to pass" });
+
+	test_equals("filter count", std::to_string(received.size()), "2");
+
+	if (received.size() == 2) {
+		test_equals("filter first", received[0], "A-v1 wanted");
+		test_equals("filter second", received[1], "D-v1");
+	}
+
+	// From the wrong address, nothing gets through
+	rules = boost_udp_filter_rules();
+	rules.source_addresses = { "10.1.2.3" };
+
+	boost_udp_attach_filter(rar, rules);
+
+	test_equals("filter source", std::to_string(send_and_drain(rar, 8870, { "m1", "m2" }).size()), "0");
+
+	// And everything does once it's gone
+	boost_udp_detach_filter(rar);
+
+	test_equals("filter detached", std::to_string(send_and_drain(rar, 8870, { "m1", "m2" }).size()), "2");
+}
+
+void test_reuseport_shards() {
+	// Steer on the first payload byte
+	boost_udp_reuseport_selector selector;
+	selector.key = boost_udp_reuseport_selector::payload;
+	selector.offset = 0;
+	selector.size = 1;
+
+	boost::system::error_code ec;
+	auto shards = boost_udp_open_shards("127.0.0.1", 8871, 3, selector, boost_udp_receive_rar_options(), ec);
+
+	test_equals("shards open", ec.message(), boost::system::error_code().message());
+	test_equals("shards count", std::to_string(shards.size()), "3");
+
+	if (shards.size() != 3)
+		return;
+
+	boost_udp_send_faf sender("127.0.0.1", 8871);
+
+	for (unsigned char channel = 0; channel != 9; channel++) {
+		const unsigned char payload[] = { channel, 'x' };
+		sender.send(payload, sizeof(payload));
+	}
+
+	// Each shard gets exactly the channels equal to
+	// its index, modulo the number of shards.
+	for (size_t i = 0; i != shards.size(); i++) {
+		std::string channels;
+
+		while (shards[i]->wait(100, ec)) {
+			const datagram_view view = shards[i]->try_receive_view(ec);
+
+			if (!ec && !view.empty())
+				channels += std::to_string(view.data[0]);
+		}
+
+		const std::string expected = std::to_string(i) + std::to_string(i + 3) + std::to_string(i + 6);
+
+		test_equals("shard channels", channels, expected);
+	}
+
+	// Source port steering, everything from one
+	// sender lands on the same shard.
+	selector.key = boost_udp_reuseport_selector::source_port;
+	test_equals("steer on source port", boost_udp_attach_reuseport_selector(*shards[0], selector, 3).message(), boost::system::error_code().message());
+
+	for (int n = 0; n != 6; n++)
+		sender.send("same sender");
+
+	int busy_shards = 0;
+
+	for (auto& shard : shards) {
+		int received = 0;
+
+		while (shard->wait(100, ec)) {
+			shard->try_receive_view(ec);
+			received++;
+		}
+
+		busy_shards += received > 0;
+	}
+
+	test_equals("source port to one shard", std::to_string(busy_shards), "1");
+}
+
+void test_flow_dispatcher() {
+	const unsigned flows = 8;
+	const unsigned per_flow = 200;
+
+	// Per flow: the sequence numbers seen, in order,
+	// and the workers that saw them. Each flow is only
+	// touched by one worker so no locking is needed.
+	std::vector<std::vector<unsigned>> sequences(flows);
+	std::vector<std::vector<unsigned>> flow_workers(flows);
+
+	boost_udp_dispatcher_options options;
+	options.queue_capacity = 64;
+
+	// Flow id in the first byte, sequence in the second
+	options.key = [](const datagram_view& datagram) -> uint64_t {
+		return datagram.data[0];
+	};
+
+	boost_udp_flow_dispatcher dispatcher(3, [&](unsigned worker, const datagram_view& datagram) {
+		sequences[datagram.data[0]].push_back(datagram.data[1]);
+		flow_workers[datagram.data[0]].push_back(worker);
+	}, options);
+
+	// Interleave the flows, retrying when a queue is full
+	for (unsigned n = 0; n != per_flow; n++) {
+		for (unsigned flow = 0; flow != flows; flow++) {
+			const unsigned char payload[] = { static_cast<unsigned char>(flow), static_cast<unsigned char>(n) };
+
+			while (!dispatcher.dispatch(datagram_view(payload, sizeof(payload))))
+				std::this_thread::yield();
+		}
+	}
+
+	dispatcher.stop();
+
+	bool in_order = true, one_worker = true;
+
+	for (unsigned flow = 0; flow != flows; flow++) {
+		in_order = in_order && sequences[flow].size() == per_flow;
+
+		for (unsigned n = 0; n != sequences[flow].size(); n++)
+			in_order = in_order && sequences[flow][n] == n;
+
+		for (const auto w : flow_workers[flow])
+			one_worker = one_worker && w == flow_workers[flow].front();
+	}
+
+	test_equals("dispatcher flows in order", std::to_string(in_order), "1");
+	test_equals("dispatcher flow stays on one worker", std::to_string(one_worker), "1");
+
+	const boost_udp_dispatcher_stats stats = dispatcher.stats();
+	uint64_t processed = 0;
+
+	for (const auto& w : stats.workers) {
+		processed += w.processed;
+		std::cout << "INFO: dispatcher worker pushed " << w.queue.pushed << ", dropped " << w.queue.dropped
+			<< ", max depth " << w.queue.max_depth << std::endl;
+	}
+
+	test_equals("dispatcher processed", std::to_string(processed), std::to_string(flows * per_flow));
+	test_equals("dispatcher imbalance sane", std::to_string(stats.imbalance >= 1.0 && stats.imbalance <= 3.0), "1");
+}
+
+void test_work_stealing_pool() {
+	const unsigned count = 5000;
+
+	// Count each datagram as it's processed
+	std::vector<std::atomic<int>> seen(count);
+
+	boost_udp_work_stealing_options options;
+	options.batch_datagrams = 16;
+	options.max_batches = 8;
+
+	boost_udp_work_stealing_pool pool(3, [&](unsigned, const datagram_view& datagram) {
+		uint32_t n;
+		std::memcpy(&n, datagram.data, sizeof(n));
+		seen[n]++;
+
+		// Make the odd datagram slow so that
+		// there's something to steal.
+		if (n % 500 == 0)
+			std::this_thread::sleep_for(std::chrono::milliseconds(2));
+	}, options);
+
+	for (uint32_t n = 0; n != count; n++) {
+		const datagram_view datagram(reinterpret_cast<const unsigned char*>(&n), sizeof(n));
+
+		// Retry if all the batches are in use
+		while (!pool.submit(datagram))
+			std::this_thread::yield();
+	}
+
+	pool.stop();
+
+	bool once = true;
+
+	for (const auto& s : seen)
+		once = once && s == 1;
+
+	test_equals("work stealing each datagram once", std::to_string(once), "1");
+
+	const boost_udp_work_stealing_stats stats = pool.stats();
+	uint64_t processed = 0, stolen = 0;
+
+	for (const auto& w : stats.workers) {
+		processed += w.processed;
+		stolen += w.stolen;
+	}
+
+	test_equals("work stealing processed", std::to_string(processed), std::to_string(count));
+	test_equals("work stealing submitted", std::to_string(stats.submitted), std::to_string(count));
+
+	std::cout << "INFO: work stealing batches stolen: " << stolen << ", dropped (retried) " << stats.dropped << std::endl;
+}
+
+// Everything a consumer can read now
+static std::vector<std::string> drain_consumer(boost_udp_broadcast_ring::consumer& consumer) {
+	std::vector<std::string> received;
+	datagram_view datagram;
+
+	while (consumer.next(datagram)) {
+		received.emplace_back(datagram.begin(), datagram.end());
+		consumer.release();
+	}
+
+	return received;
+}
+
+void test_broadcast_ring() {
+	// Two consumers on their own threads, both
+	// see everything in order.
+	{
+		const unsigned count = 2000;
+
+		boost_udp_broadcast_options options;
+		options.capacity = 8;
+
+		boost_udp_broadcast_ring ring(options);
+		std::vector<boost_udp_broadcast_ring::consumer> consumers;
+		consumers.push_back(ring.join());
+		consumers.push_back(ring.join());
+
+		std::vector<int> in_order(consumers.size(), 0);
+		std::vector<std::thread> threads;
+
+		for (size_t c = 0; c != consumers.size(); c++) {
+			threads.emplace_back([&, c]() {
+				uint32_t expected = 0;
+				datagram_view datagram;
+
+				while (expected != count) {
+					if (!consumers[c].next(datagram)) {
+						std::this_thread::yield();
+						continue;
+					}
+
+					uint32_t n;
+					std::memcpy(&n, datagram.data, sizeof(n));
+
+					if (n != expected++)
+						break;
+
+					consumers[c].release();
+				}
+
+				in_order[c] = expected == count;
+			});
+		}
+
+		for (uint32_t n = 0; n != count; n++)
+			ring.publish(datagram_view(reinterpret_cast<const unsigned char*>(&n), sizeof(n)));
+
+		for (auto& t : threads)
+			t.join();
+
+		const boost_udp_broadcast_stats stats = ring.stats();
+
+		test_equals("broadcast consumer 1 in order", std::to_string(in_order[0]), "1");
+		test_equals("broadcast consumer 2 in order", std::to_string(in_order[1]), "1");
+		test_equals("broadcast published", std::to_string(stats.published), std::to_string(count));
+		test_equals("broadcast nothing lost", std::to_string(stats.consumers[0].lost + stats.consumers[1].lost), "0");
+
+		std::cout << "INFO: broadcast producer blocked " << stats.blocked << " times" << std::endl;
+	}
+
+	const std::vector<std::string> messages = { "b0", "b1", "b2", "b3", "b4", "b5" };
+
+	// A consumer that falls behind loses the oldest
+	// with drop_oldest, and the newest with drop_newest.
+	{
+		boost_udp_broadcast_options options;
+		options.capacity = 4;
+		options.overflow.policy = boost_udp_overflow_options::drop_oldest;
+
+		boost_udp_broadcast_ring ring(options);
+		auto slow = ring.join();
+
+		for (const auto& m : messages)
+			ring.publish(datagram_view(reinterpret_cast<const unsigned char*>(m.data()), m.size()));
+
+		const auto received = drain_consumer(slow);
+
+		test_equals("broadcast drop oldest count", std::to_string(received.size()), "4");
+		test_equals("broadcast drop oldest oldest", received.empty() ? "" : received.front(), "b2");
+		test_equals("broadcast drop oldest lost", std::to_string(slow.lost()), "2");
+	}
+
+	{
+		boost_udp_broadcast_options options;
+		options.capacity = 4;
+		options.overflow.policy = boost_udp_overflow_options::drop_newest;
+
+		boost_udp_broadcast_ring ring(options);
+		auto slow = ring.join();
+
+		for (const auto& m : messages)
+			ring.publish(datagram_view(reinterpret_cast<const unsigned char*>(m.data()), m.size()));
+
+		const auto received = drain_consumer(slow);
+
+		test_equals("broadcast drop newest count", std::to_string(received.size()), "4");
+		test_equals("broadcast drop newest last", received.empty() ? "" : received.back(), "b3");
+		test_equals("broadcast drop newest dropped", std::to_string(ring.stats().dropped), "2");
+	}
+
+	// Straight from the socket into the ring
+	{
+		boost::system::error_code ec;
+		boost_udp_receive_rar rar("127.0.0.1", 8872, ec);
+		test_equals("broadcast receiver opened", ec.message(), boost::system::error_code().message());
+
+		boost_udp_broadcast_ring ring;
+		auto first = ring.join();
+		auto second = ring.join();
+
+		boost_udp_send_faf sender("127.0.0.1", 8872);
+
+		for (const auto& m : messages)
+			sender.send(m);
+
+		while (rar.wait(100, ec)) {
+			do
+				ring.receive(rar, ec);
+			while (!ec);
+		}
+
+		const auto received_first = drain_consumer(first);
+		const auto received_second = drain_consumer(second);
+
+		test_equals("broadcast socket count", std::to_string(received_first.size()), std::to_string(messages.size()));
+		test_equals("broadcast socket both the same", std::to_string(received_first == received_second), "1");
+
+		for (size_t n = 0; n != received_first.size(); n++)
+			test_equals("broadcast socket received", received_first[n], messages[n]);
+
+		// Too big for a slot, dropped rather than cut short
+		boost_udp_broadcast_options small;
+		small.slot_size = 64;
+
+		boost_udp_broadcast_ring small_ring(small);
+		auto third = small_ring.join();
+
+		sender.send(messages[0]);
+		sender.send(std::string(1000, 'x'));
+		sender.send(messages[1]);
+
+		while (rar.wait(100, ec)) {
+			do
+				small_ring.receive(rar, ec);
+			while (!ec);
+		}
+
+		const auto received_third = drain_consumer(third);
+
+		test_equals("broadcast socket oversize count", std::to_string(received_third.size()), "2");
+		test_equals("broadcast socket oversize last", received_third.empty() ? "" : received_third.back(), messages[1]);
+		test_equals("broadcast socket oversize counted", std::to_string(small_ring.stats().oversize), "1");
+	}
+}
+
+void test_shm_ring() {
+	const std::string name = "/boost_udp_receive_rar_test";
+	boost::system::error_code ec;
+
+	boost_udp_shm_reader missing("/boost_udp_receive_rar_missing", ec);
+	test_equals("shm reader of nothing fails", std::to_string(!!ec), "1");
+
+	boost_udp_shm_options options;
+	options.capacity = 4;
+
+	boost_udp_shm_publisher publisher(name, options, ec);
+	test_equals("shm publisher created", ec.message(), boost::system::error_code().message());
+
+	boost_udp_shm_reader reader(name, ec);
+	test_equals("shm reader opened", ec.message(), boost::system::error_code().message());
+
+	const std::vector<std::string> messages = { "shm0", "shm1", "shm2", "shm3", "shm4", "shm5" };
+
+	publisher.publish(datagram_view(reinterpret_cast<const unsigned char*>(messages[0].data()), messages[0].size()));
+
+	test_equals("shm reader async", reader.receive_async(ec), messages[0]);
+	test_equals("shm reader async nothing", reader.receive_async(ec), "");
+	test_equals("shm reader async no error", ec.message(), boost::system::error_code().message());
+
+	// Fall behind, the oldest are lost
+	for (const auto& m : messages)
+		publisher.publish(datagram_view(reinterpret_cast<const unsigned char*>(m.data()), m.size()));
+
+	std::vector<std::string> received;
+
+	while (reader.wait(0, ec))
+		received.push_back(reader.receive_sync(ec));
+
+	test_equals("shm reader lapped count", std::to_string(received.size()), "4");
+	test_equals("shm reader lapped oldest", received.empty() ? "" : received.front(), "shm2");
+	test_equals("shm reader lost", std::to_string(reader.lost()), "2");
+
+	// Straight from the socket into shared memory
+	boost_udp_receive_rar rar("127.0.0.1", 8873, ec);
+	boost_udp_send_faf sender("127.0.0.1", 8873);
+
+	for (size_t n = 0; n != 3; n++)
+		sender.send(messages[n]);
+
+	while (rar.wait(100, ec)) {
+		do
+			publisher.receive(rar, ec);
+		while (!ec);
+	}
+
+	for (size_t n = 0; n != 3; n++) {
+		const datagram_view datagram = reader.receive_view_sync(ec);
+
+		test_equals("shm reader from socket", std::string(datagram.begin(), datagram.end()), messages[n]);
+		test_equals("shm reader from socket sender", datagram.sender.address().to_string(), "127.0.0.1");
+	}
+
+	// Too big for a slot, dropped rather than cut short
+	sender.send(std::string(options.slot_size + 1, 'x'));
+	sender.send(messages[3]);
+
+	while (rar.wait(100, ec)) {
+		do
+			publisher.receive(rar, ec);
+		while (!ec);
+	}
+
+	test_equals("shm reader oversize skipped", reader.receive_sync(ec), messages[3]);
+	test_equals("shm publisher oversize", std::to_string(publisher.oversized()), "1");
+
+	// Readers refuse a header whose slots they'd read past
+	const int fd = ::shm_open(name.c_str(), O_RDWR, 0);
+	void* mapped = ::mmap(nullptr, sizeof(boost_udp_shm_layout::header), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	::close(fd);
+
+	boost_udp_shm_layout::header* header = static_cast<boost_udp_shm_layout::header*>(mapped);
+	const uint32_t capacity = header->capacity;
+	const uint32_t slot_stride = header->slot_stride;
+
+	header->capacity = 0;
+	boost_udp_shm_reader no_slots(name, ec);
+	test_equals("shm reader no slots", std::to_string(ec == boost::system::errc::invalid_argument), "1");
+
+	header->capacity = 3;
+	boost_udp_shm_reader odd_slots(name, ec);
+	test_equals("shm reader capacity not a power of two", std::to_string(ec == boost::system::errc::invalid_argument), "1");
+
+	header->capacity = capacity;
+	header->slot_stride = 64;
+	boost_udp_shm_reader short_slots(name, ec);
+	test_equals("shm reader slots too small", std::to_string(ec == boost::system::errc::invalid_argument), "1");
+
+	header->slot_stride = slot_stride;
+	boost_udp_shm_reader fixed(name, ec);
+	test_equals("shm reader header put back", ec.message(), boost::system::error_code().message());
+
+	::munmap(mapped, sizeof(boost_udp_shm_layout::header));
+}
+
+// Push each message, then pop everything
+static std::vector<std::string> push_and_pop(boost_udp_datagram_ring& ring, const std::vector<std::string>& messages) {
+	for (const auto& m : messages)
+		ring.push(datagram_view(reinterpret_cast<const unsigned char*>(m.data()), m.size()));
+
+	std::vector<std::string> received;
+	datagram_view datagram;
+
+	for (;;) {
+		ring.flush();
+
+		if (!ring.peek(datagram))
+			break;
+
+		received.emplace_back(datagram.begin(), datagram.end());
+		ring.pop();
+	}
+
+	return received;
+}
+
+static std::string joined(const std::vector<std::string>& strings) {
+	std::string out;
+
+	for (const auto& s : strings)
+		out += s + " ";
+
+	return out;
+}
+
+void test_overflow_policies() {
+	const std::vector<std::string> messages = { "a1", "b1", "a2", "c1", "a3", "b2" };
+
+	boost_udp_overflow_options overflow;
+
+	{
+		boost_udp_datagram_ring ring(4, 64, boost_udp_buffer_memory(), overflow);
+		test_equals("overflow drop newest", joined(push_and_pop(ring, messages)), "a1 b1 a2 c1 ");
+		test_equals("overflow drop newest dropped", std::to_string(ring.stats().dropped), "2");
+	}
+
+	{
+		overflow.policy = boost_udp_overflow_options::drop_oldest;
+		boost_udp_datagram_ring ring(4, 64, boost_udp_buffer_memory(), overflow);
+		test_equals("overflow drop oldest", joined(push_and_pop(ring, messages)), "a2 c1 a3 b2 ");
+		test_equals("overflow drop oldest evicted", std::to_string(ring.stats().evicted), "2");
+	}
+
+	{
+		// While the consumer holds the oldest nothing is evicted,
+		// new datagrams are dropped and the queue stays full.
+		boost_udp_datagram_ring ring(4, 64, boost_udp_buffer_memory(), overflow);
+
+		for (unsigned n = 0; n != 4; n++)
+			ring.push(datagram_view(reinterpret_cast<const unsigned char*>(messages[n].data()), messages[n].size()));
+
+		datagram_view held;
+		ring.peek(held);
+
+		unsigned pushed = 0;
+
+		for (unsigned n = 4; n != 10; n++)
+			pushed += ring.push(datagram_view(reinterpret_cast<const unsigned char*>(messages[n % 6].data()), messages[n % 6].size()));
+
+		test_equals("overflow drop oldest held", std::string(reinterpret_cast<const char*>(held.data), held.size), "a1");
+		test_equals("overflow drop oldest held pushed", std::to_string(pushed), "0");
+		test_equals("overflow drop oldest held depth", std::to_string(ring.depth()), "4");
+		test_equals("overflow drop oldest held evicted", std::to_string(ring.stats().evicted), "0");
+
+		ring.pop();
+
+		// Once released the oldest goes again
+		test_equals("overflow drop oldest released", joined(push_and_pop(ring, { "a3", "b2" })), "a2 c1 a3 b2 ");
+		test_equals("overflow drop oldest released evicted", std::to_string(ring.stats().evicted), "1");
+	}
+
+	{
+		// Keyed on the first byte, only the newest 'a' and 'b'
+		// wait once the queue is full.
+		overflow.policy = boost_udp_overflow_options::conflate;
+		overflow.key = [](const datagram_view& datagram) -> uint64_t { return datagram.data[0]; };
+
+		boost_udp_datagram_ring ring(2, 64, boost_udp_buffer_memory(), overflow);
+		test_equals("overflow conflate", joined(push_and_pop(ring, messages)), "a1 b1 a3 c1 b2 ");
+
+		const boost_udp_queue_stats stats = ring.stats();
+		test_equals("overflow conflate conflated", std::to_string(stats.conflated), "1");
+		test_equals("overflow conflate none held", std::to_string(stats.held), "0");
+	}
+
+	{
+		// The producer waits for a slow consumer
+		overflow.policy = boost_udp_overflow_options::block;
+		boost_udp_datagram_ring ring(2, 64, boost_udp_buffer_memory(), overflow);
+
+		const unsigned count = 1000;
+		uint32_t expected = 0;
+
+		std::thread consumer([&]() {
+			datagram_view datagram;
+
+			while (expected != count) {
+				if (!ring.peek(datagram)) {
+					std::this_thread::yield();
+					continue;
+				}
+
+				uint32_t n;
+				std::memcpy(&n, datagram.data, sizeof(n));
+
+				if (n != expected)
+					break;
+
+				expected++;
+				ring.pop();
+			}
+		});
+
+		for (uint32_t n = 0; n != count; n++)
+			ring.push(datagram_view(reinterpret_cast<const unsigned char*>(&n), sizeof(n)));
+
+		consumer.join();
+
+		test_equals("overflow block nothing lost", std::to_string(expected), std::to_string(count));
+		test_equals("overflow block nothing dropped", std::to_string(ring.stats().dropped), "0");
+	}
+
+	{
+		// The work stealing pool drops the oldest batches
+		// while its one worker is stuck.
+		std::atomic<bool> stuck{ true };
+		std::atomic<unsigned> processed{ 0 };
+
+		boost_udp_work_stealing_options options;
+		options.batch_datagrams = 1;
+		options.max_batches = 2;
+		options.overflow.policy = boost_udp_overflow_options::drop_oldest;
+
+		boost_udp_work_stealing_pool pool(1, [&](unsigned, const datagram_view&) {
+			while (stuck)
+				std::this_thread::yield();
+
+			processed++;
+		}, options);
+
+		for (const auto& m : messages)
+			pool.submit(datagram_view(reinterpret_cast<const unsigned char*>(m.data()), m.size()));
+
+		stuck = false;
+		pool.stop();
+
+		const boost_udp_work_stealing_stats stats = pool.stats();
+		test_equals("overflow work stealing all accounted for", std::to_string(processed + stats.evicted + stats.dropped), std::to_string(messages.size()));
+		test_equals("overflow work stealing evicted some", std::to_string(stats.evicted > 0), "1");
+	}
+}
+
+void test_conflation_cache() {
+	boost_udp_conflation_options options;
+	options.max_keys = 3;
+	options.key_offset = 0;
+	options.key_size = 2;
+
+	boost_udp_conflation_cache cache(options);
+
+	// Two byte key then the price
+	const std::vector<std::string> updates = { "AA100", "BB200", "AA101", "CC300", "AA102", "DD400", "B", "BB201" };
+
+	for (const auto& u : updates)
+		cache.update(datagram_view(reinterpret_cast<const unsigned char*>(u.data()), u.size()));
+
+	std::vector<std::string> drained;
+
+	cache.drain([&](uint64_t key, const datagram_view& latest) {
+		drained.push_back(std::to_string(key) + ":" + std::string(latest.begin(), latest.end()));
+	});
+
+	// In the order the keys first changed, newest for each
+	const uint64_t aa = ('A' << 8) | 'A', bb = ('B' << 8) | 'B', cc = ('C' << 8) | 'C';
+	test_equals("conflation drained", joined(drained),
+		std::to_string(aa) + ":AA102 " + std::to_string(bb) + ":BB201 " + std::to_string(cc) + ":CC300 ");
+
+	boost_udp_conflation_stats stats = cache.stats();
+	test_equals("conflation conflated", std::to_string(stats.conflated), "3");
+	test_equals("conflation rejected (full & short)", std::to_string(stats.rejected), "2");
+	test_equals("conflation keys", std::to_string(stats.keys), "3");
+
+	// Only what's changed since
+	const std::string update = "CC301";
+	cache.update(datagram_view(reinterpret_cast<const unsigned char*>(update.data()), update.size()));
+
+	drained.clear();
+	cache.drain([&](uint64_t, const datagram_view& latest) { drained.emplace_back(latest.begin(), latest.end()); });
+
+	test_equals("conflation drained again", joined(drained), "CC301 ");
+
+	std::vector<unsigned char> latest;
+	const bool found = cache.latest(aa, latest);
+	test_equals("conflation latest", std::to_string(found) + std::string(latest.begin(), latest.end()), "1AA102");
+
+	stats = cache.stats();
+	test_equals("conflation nothing dirty", std::to_string(stats.dirty), "0");
+	test_equals("conflation drained count", std::to_string(stats.drained), "4");
+}
+
+void test_sequencer() {
+	boost_udp_sequencer_options options;
+	options.sequence_offset = 1;
+	options.sequence_size = 2;
+	options.window = 8;
+	options.hold_time = std::chrono::milliseconds(5);
+
+	std::vector<std::string> delivered;
+	std::vector<std::string> gaps;
+
+	boost_udp_sequencer sequencer(options,
+		[&](uint64_t sequence, const datagram_view&) { delivered.push_back(std::to_string(sequence)); },
+		[&](uint64_t first, uint64_t count) { gaps.push_back(std::to_string(first) + "+" + std::to_string(count)); });
+
+	// A byte, then a 16 bit big endian sequence number
+	auto push = [&](const unsigned sequence) {
+		const unsigned char datagram[] = { 'x', static_cast<unsigned char>(sequence >> 8), static_cast<unsigned char>(sequence) };
+		sequencer.push(datagram_view(datagram, sizeof(datagram)));
+	};
+
+	// Out of order and a duplicate
+	for (const unsigned n : { 1, 2, 4, 3, 2 })
+		push(n);
+
+	test_equals("sequencer reordered", joined(delivered), "1 2 3 4 ");
+
+	// A gap that's given up on after hold_time
+	delivered.clear();
+
+	for (const unsigned n : { 5, 7, 8 })
+		push(n);
+
+	sequencer.poll();
+	test_equals("sequencer holds for a while", joined(delivered), "5 ");
+
+	sequencer.poll(std::chrono::steady_clock::now() + std::chrono::milliseconds(10));
+	test_equals("sequencer gives up", joined(delivered), "5 7 8 ");
+	test_equals("sequencer gap reported", joined(gaps), "6+1 ");
+
+	// Too far ahead for the window, then well behind
+	delivered.clear();
+	gaps.clear();
+
+	for (const unsigned n : { 20, 0xfffe, 0xffff, 0, 1 })
+		push(n);
+
+	test_equals("sequencer window overflow", joined(gaps), "9+11 ");
+	test_equals("sequencer well behind is dropped", joined(delivered), "20 ");
+
+	const boost_udp_sequencer_stats stats = sequencer.stats();
+	test_equals("sequencer duplicates", std::to_string(stats.duplicates), "5");
+	test_equals("sequencer reordered count", std::to_string(stats.reordered), "3");
+	test_equals("sequencer missing", std::to_string(stats.missing), "12");
+	test_equals("sequencer nothing held", std::to_string(stats.held), "0");
+
+	// Wrapping in order
+	boost_udp_sequencer wrapping(options, [&](uint64_t sequence, const datagram_view&) { delivered.push_back(std::to_string(sequence)); });
+	delivered.clear();
+
+	for (const unsigned n : { 0xfffe, 0, 0xffff, 1 }) {
+		const unsigned char datagram[] = { 'x', static_cast<unsigned char>(n >> 8), static_cast<unsigned char>(n) };
+		wrapping.push(datagram_view(datagram, sizeof(datagram)));
+	}
+
+	test_equals("sequencer across the wrap", joined(delivered), "65534 65535 0 1 ");
+}
+
+void test_feed_arbitrator() {
+	boost_udp_receive_rar line_a("127.0.0.1", 8874);
+	boost_udp_receive_rar line_b("127.0.0.1", 8875);
+
+	boost_udp_arbitrator_options options;
+	options.sequence_offset = 1;
+	options.sequence_size = 2;
+	options.window = 64;
+
+	std::vector<std::string> delivered;
+
+	boost_udp_feed_arbitrator arbitrator({ &line_a, &line_b },
+		[&](unsigned line, uint64_t sequence, const datagram_view&) {
+			delivered.push_back(std::string(1, static_cast<char>('A' + line)) + std::to_string(sequence));
+		}, options);
+
+	// A byte, then a 16 bit big endian sequence number
+	auto datagram = [](const unsigned sequence) {
+		return std::string{ 'x', static_cast<char>(sequence >> 8), static_cast<char>(sequence) };
+	};
+
+	auto push = [&](const unsigned line, const unsigned sequence) {
+		const std::string d = datagram(sequence);
+		arbitrator.push(line, datagram_view(reinterpret_cast<const unsigned char*>(d.data()), d.size()));
+	};
+
+	// B is ahead for 3, A loses 2 and B loses 4
+	push(0, 1);
+	push(1, 1);
+	push(1, 3);
+	push(0, 3);
+	push(1, 2);
+	push(0, 4);
+	push(0, 2);
+	push(1, 4);
+
+	test_equals("arbitrator first copy wins", joined(delivered), "A1 B3 B2 A4 ");
+
+	// Far enough ahead that 4 is no longer remembered, then
+	// across the wrap
+	push(0, 100);
+	push(1, 4);
+
+	for (const unsigned n : { 0x7000, 0xe000, 0xffff, 0 }) {
+		push(1, n);
+		push(0, n);
+	}
+
+	boost_udp_arbitrator_stats stats = arbitrator.stats();
+	test_equals("arbitrator stale", std::to_string(stats.stale), "1");
+	test_equals("arbitrator duplicates", std::to_string(stats.duplicates), "8");
+	test_equals("arbitrator highest", std::to_string(arbitrator.highest_seen()), "0");
+
+	// Over the sockets, the same feed on both lines
+	delivered.clear();
+
+	boost_udp_send_faf sender_a("127.0.0.1", 8874);
+	boost_udp_send_faf sender_b("127.0.0.1", 8875);
+
+	for (const unsigned n : { 10, 11, 12 }) {
+		sender_a.send(datagram(n));
+		sender_b.send(datagram(n));
+	}
+
+	boost::system::error_code ec;
+	std::size_t total = 0;
+
+	while (total < 3) {
+		const std::size_t n = arbitrator.poll(1000, ec);
+
+		if (ec || !n)
+			break;
+
+		total += n;
+	}
+
+	// Let the last copies arrive
+	arbitrator.poll(100, ec);
+
+	stats = arbitrator.stats();
+	test_equals("arbitrator over sockets", std::to_string(total), "3");
+	test_equals("arbitrator socket duplicates", std::to_string(stats.duplicates), "11");
+	test_equals("arbitrator wins add up", std::to_string(stats.wins[0] + stats.wins[1]), std::to_string(stats.delivered));
+}
+
+void test_deduplicator() {
+	boost_udp_dedup_options options;
+	options.window = 4;
+	options.hash_offset = 1;
+
+	std::vector<std::string> delivered;
+
+	boost_udp_deduplicator dedup(options, [&](const datagram_view& datagram) {
+		delivered.emplace_back(datagram.begin(), datagram.end());
+	});
+
+	auto push = [&](const std::string& d) {
+		return dedup.push(datagram_view(reinterpret_cast<const unsigned char*>(d.data()), d.size()));
+	};
+
+	// The first byte differs by path and isn't hashed
+	for (const std::string d : { "a1", "b1", "a2", "a3", "b2", "a4", "a5", "a6" })
+		push(d);
+
+	// 1 is forgotten once four more have come along
+	push("b1");
+
+	test_equals("dedup delivered", joined(delivered), "a1 a2 a3 a4 a5 a6 b1 ");
+
+	const boost_udp_dedup_stats stats = dedup.stats();
+	test_equals("dedup duplicates", std::to_string(stats.duplicates), "2");
+	test_equals("dedup unique", std::to_string(stats.unique), "7");
+
+	// Forgotten with age too
+	options.window = 100;
+	options.max_age = std::chrono::milliseconds(20);
+
+	boost_udp_deduplicator aging(options);
+
+	const std::string d = "x1";
+	const datagram_view view(reinterpret_cast<const unsigned char*>(d.data()), d.size());
+
+	const bool first = aging.push(view);
+	const bool again = aging.push(view);
+
+	std::this_thread::sleep_for(std::chrono::milliseconds(30));
+
+	test_equals("dedup max age", std::to_string(first) + std::to_string(again) + std::to_string(aging.push(view)), "101");
+
+	// Hashes of different sizes and contents differ
+	std::vector<unsigned char> bytes(200, 'x');
+	test_equals("dedup hash sizes differ", std::to_string(boost_udp_hash(bytes.data(), 100) != boost_udp_hash(bytes.data(), 101)), "1");
+	test_equals("dedup hash is stable", std::to_string(boost_udp_hash(bytes.data(), 200) == boost_udp_hash(bytes.data(), 200)), "1");
+	const uint64_t before = boost_udp_hash(bytes.data(), 200);
+	bytes[150] = 'y';
+	test_equals("dedup hash sees every byte", std::to_string(boost_udp_hash(bytes.data(), 200) != before), "1");
+}
+
+void test_message_splitter() {
+	// A MoldUDP64 packet: session, sequence number, a count
+	// of 3 and then the messages, each with its length.
+	std::string packet = "SESSION001";
+	packet += std::string(7, '\0') + '\x2a';
+	packet += std::string{ 0, 3 };
+	packet += std::string{ 0, 5 } + "hello";
+	packet += std::string{ 0, 0 };
+	packet += std::string{ 0, 3 } + "abc";
+
+	auto view = [](const std::string& s) {
+		return datagram_view(reinterpret_cast<const unsigned char*>(s.data()), s.size());
+	};
+
+	std::vector<std::string> messages;
+
+	const auto split = boost_udp_split<boost_udp_moldudp64_layout>(view(packet));
+
+	for (const datagram_view& message : split)
+		messages.emplace_back(message.begin(), message.end());
+
+	test_equals("splitter messages", joined(messages), "hello  abc ");
+	test_equals("splitter count", std::to_string(split.count()), "3");
+	test_equals("splitter complete", std::to_string(split.complete()), "1");
+	test_equals("splitter in place", std::to_string(split.begin()->data == view(packet).data + 22), "1");
+	test_equals("splitter header", std::to_string(split.header().size) + " " + std::to_string(boost_udp_read_uint<8, true>(split.header().data + 10)), "20 42");
+
+	// The last message cut short
+	const std::string truncated = packet.substr(0, packet.size() - 1);
+	messages.clear();
+
+	for (const datagram_view& message : boost_udp_split<boost_udp_moldudp64_layout>(view(truncated)))
+		messages.emplace_back(message.begin(), message.end());
+
+	test_equals("splitter truncated", joined(messages), "hello  ");
+	test_equals("splitter truncated not complete", std::to_string(boost_udp_split<boost_udp_moldudp64_layout>(view(truncated)).complete()), "0");
+	test_equals("splitter too short for header", std::to_string(std::distance(
+		boost_udp_split<boost_udp_moldudp64_layout>(view("SESSION")).begin(), boost_udp_split<boost_udp_moldudp64_layout>(view("SESSION")).end())), "0");
+
+	// No count, a one byte header and little endian 16 bit lengths
+	const std::string uncounted = std::string{ 'H', 2, 0, 'h', 'i', 1, 0, '!' };
+	messages.clear();
+
+	const auto split_uncounted = boost_udp_split<boost_udp_message_layout<1, 0, 0, 2, false>>(view(uncounted));
+
+	for (const datagram_view& message : split_uncounted)
+		messages.emplace_back(message.begin(), message.end());
+
+	test_equals("splitter uncounted", joined(messages), "hi ! ");
+	test_equals("splitter uncounted complete", std::to_string(split_uncounted.complete()), "1");
+}
+
+// A fixed layout message for the typed view tests
+struct test_trade {
+	using price = boost_udp_field<0, uint64_t>;
+	using quantity = boost_udp_field<8, uint32_t, false>;
+	using side = boost_udp_field<12, char>;
+	using offset = boost_udp_field<13, int32_t, true, 3>;
+	using rate = boost_udp_field<16, double>;
+
+	static const std::size_t size = 24;
+};
+
+void test_typed_view() {
+	boost_udp_receive_rar rar("127.0.0.1", 8876);
+
+	// 1000000 big endian, 7 little endian, 'B', -2 in three
+	// big endian bytes and 1.5 as a big endian double.
+	const std::vector<unsigned char> trade = {
+		0, 0, 0, 0, 0, 0x0f, 0x42, 0x40,
+		7, 0, 0, 0,
+		'B',
+		0xff, 0xff, 0xfe,
+		0x3f, 0xf8, 0, 0, 0, 0, 0, 0 };
+
+	boost_udp_send_faf sender("127.0.0.1", 8876);
+	sender.send(trade.data(), static_cast<int>(trade.size()));
+
+	boost::system::error_code ec;
+	const boost_udp_typed_view<test_trade> t = boost_udp_receive_as<test_trade>(rar, ec);
+
+	test_equals("typed receive", ec.message() + " " + std::to_string(t.valid()), boost::system::error_code().message() + " 1");
+	test_equals("typed fields", std::to_string(t.get<test_trade::price>()) + " " + std::to_string(t.get<test_trade::quantity>()) + " "
+		+ t.get<test_trade::side>() + " " + std::to_string(t.get<test_trade::offset>()) + " " + std::to_string(t.get<test_trade::rate>()),
+		"1000000 7 B -2 1.500000");
+	test_equals("typed in place", std::to_string(t.raw().data != nullptr && t.raw().size == trade.size()), "1");
+
+	// Too short for a trade
+	sender.send(trade.data(), 10);
+
+	const auto short_trade = boost_udp_receive_as<test_trade>(rar, ec);
+	test_equals("typed too short", std::to_string(ec == boost::asio::error::message_size) + std::to_string(short_trade.valid()), "10");
+}
+
+void test_byte_order() {
+	// Big endian 16, 32 and 64 bit counting samples, an odd number
+	// so that the vector loops leave some over.
+	const std::size_t count = 37;
+
+	for (const std::size_t width : { 2, 4, 8 }) {
+		std::vector<unsigned char> big(count * width);
+
+		for (std::size_t i = 0; i != count; i++)
+			big[i * width + width - 1] = static_cast<unsigned char>(i);
+
+		for (const auto simd : { boost_udp_simd::scalar, boost_udp_simd::ssse3, boost_udp_simd::avx2, boost_udp_simd::best }) {
+			if (!boost_udp_simd_supported(simd))
+				continue;
+
+			std::vector<unsigned char> host(big.size());
+			boost_udp_big_endian_to_host(host.data(), big.data(), count, width, simd);
+
+			bool ok = true;
+
+			for (std::size_t i = 0; i != count; i++) {
+				uint64_t value = 0;
+				std::memcpy(&value, &host[i * width], width);
+				ok = ok && value == i;
+			}
+
+			test_equals("byte order " + std::to_string(width) + " byte samples, path " + std::to_string(static_cast<int>(simd)), std::to_string(ok), "1");
+		}
+	}
+
+	// Straight out of the receive buffer
+	boost_udp_receive_rar rar("127.0.0.1", 8877);
+
+	const std::vector<unsigned char> datagram = { 0, 1, 0, 2, 0x80, 0, 0xff, 0xff, 0x12 };
+	boost_udp_send_faf("127.0.0.1", 8877).send(datagram.data(), static_cast<int>(datagram.size()));
+
+	uint16_t samples[3];
+	boost::system::error_code ec;
+	const std::size_t n = boost_udp_receive_samples(rar, samples, 3, ec);
+
+	test_equals("byte order received samples", std::to_string(n) + ": " + std::to_string(samples[0]) + " " + std::to_string(samples[1]) + " " + std::to_string(samples[2]),
+		"3: 1 2 32768");
+	test_equals("byte order too many samples", std::to_string(ec == boost::asio::error::message_size), "1");
+}
+
+void test_checksum() {
+	const std::string check = "123456789";
+
+	auto hex = [](const uint32_t v) {
+		char text[9];
+		snprintf(text, sizeof(text), "%08x", v);
+		return std::string(text);
+	};
+
+	test_equals("crc32c check value", hex(boost_udp_crc32c(check.data(), check.size())), "e3069283");
+	test_equals("crc32c software check value", hex(boost_udp_crc32c_software(check.data(), check.size())), "e3069283");
+	test_equals("adler32 check value", hex(boost_udp_adler32("Wikipedia", 9)), "11e60398");
+
+	// Long enough for the hardware's three streams, and odd sizes,
+	// against the table a byte at a time and in two goes.
+	std::vector<unsigned char> data(9000);
+
+	for (std::size_t i = 0; i != data.size(); i++)
+		data[i] = static_cast<unsigned char>(i * 131 + (i >> 7));
+
+	bool same = true;
+
+	for (const std::size_t size : { 0, 7, 100, 767, 768, 1500, 2311, 9000 }) {
+		const uint32_t crc = boost_udp_crc32c(data.data(), size);
+		same = same && crc == boost_udp_crc32c_software(data.data(), size);
+		same = same && crc == boost_udp_crc32c(data.data() + size / 2, size - size / 2, boost_udp_crc32c(data.data(), size / 2));
+	}
+
+	test_equals("crc32c hardware matches software", std::to_string(same), "1");
+
+	// Adler-32 a byte at a time
+	uint32_t a = 1, b = 0;
+
+	for (const unsigned char c : data) {
+		a = (a + c) % 65521;
+		b = (b + a) % 65521;
+	}
+
+	test_equals("adler32 long", hex(boost_udp_adler32(data.data(), data.size())), hex((b << 16) | a));
+
+	// Checked and stripped, one corrupted
+	boost_udp_checksum_options options;
+	std::vector<std::string> delivered;
+
+	boost_udp_checksum_validator validator(options, [&](const datagram_view& datagram) {
+		delivered.emplace_back(datagram.begin(), datagram.end());
+	});
+
+	auto with_checksum = [&](const std::string& payload) {
+		const uint32_t crc = validator.checksum(payload.data(), payload.size());
+		return payload + std::string{ static_cast<char>(crc >> 24), static_cast<char>(crc >> 16), static_cast<char>(crc >> 8), static_cast<char>(crc) };
+	};
+
+	std::vector<std::string> datagrams = { with_checksum("good1"), with_checksum("bad"), with_checksum("good2"), "abc" };
+	datagrams[1][0] = 'B';
+
+	for (const auto& d : datagrams)
+		validator.push(datagram_view(reinterpret_cast<const unsigned char*>(d.data()), d.size()));
+
+	test_equals("checksum delivered", joined(delivered), "good1 good2 ");
+
+	// As a batch
+	std::vector<datagram_view> batch;
+
+	for (const auto& d : datagrams)
+		batch.emplace_back(reinterpret_cast<const unsigned char*>(d.data()), d.size());
+
+	batch.resize(validator.validate(batch.data(), batch.size()));
+
+	test_equals("checksum batch", std::to_string(batch.size()) + " " + std::string(batch.back().begin(), batch.back().end()), "2 good2");
+
+	const boost_udp_checksum_stats stats = validator.stats();
+	test_equals("checksum counts", std::to_string(stats.valid) + " " + std::to_string(stats.corrupt) + " " + std::to_string(stats.malformed), "4 2 2");
+}
+
+void test_authenticator() {
+	const std::string payload = "HDR:price=100";
+
+	// HMAC-SHA256, truncated to 16 bytes
+	boost_udp_auth_options options;
+	options.key.assign(20, 0x0b);
+	options.tag_size = 16;
+
+	std::vector<std::string> delivered;
+
+	boost_udp_authenticator signer(options, [&](const datagram_view& datagram) {
+		delivered.emplace_back(datagram.begin(), datagram.end());
+	});
+
+	test_equals("hmac setup", signer.setup_error().message(), boost::system::error_code().message());
+
+	std::vector<unsigned char> signed_datagram = signer.seal(payload.data(), payload.size());
+	test_equals("hmac size", std::to_string(signed_datagram.size()), std::to_string(payload.size() + 16));
+
+	signer.push(datagram_view(signed_datagram.data(), signed_datagram.size()));
+
+	signed_datagram[3] ^= 1;
+	signer.push(datagram_view(signed_datagram.data(), signed_datagram.size()));
+
+	test_equals("hmac verified", joined(delivered), payload + " ");
+
+	// RFC 4231 test case 2, the full HMAC
+	boost_udp_auth_options rfc;
+	rfc.key = { 'J', 'e', 'f', 'e' };
+
+	boost_udp_authenticator rfc_signer(rfc);
+	const std::string what = "what do ya want for nothing?";
+	const std::vector<unsigned char> sealed = rfc_signer.seal(what.data(), what.size());
+
+	std::string tag;
+
+	for (std::size_t i = what.size(); i != sealed.size(); i++) {
+		char hex[3];
+		snprintf(hex, sizeof(hex), "%02x", sealed[i]);
+		tag += hex;
+	}
+
+	test_equals("hmac rfc 4231", tag, "5bdcc146bf60754e6a042426089575c75a003f089d2739839dec58b964ec3843");
+
+	// AES-256-GCM, a 4 byte header in the clear, over a socket
+	// and decrypted in the receive buffer.
+	boost_udp_auth_options gcm;
+	gcm.mode = boost_udp_auth_options::aes_gcm;
+	gcm.key.assign(32, 0x42);
+	gcm.aad_size = 4;
+
+	delivered.clear();
+
+	boost_udp_authenticator decrypter(gcm, [&](const datagram_view& plain) {
+		delivered.emplace_back(plain.begin(), plain.end());
+	});
+
+	const unsigned char iv[12] = { 1, 2, 3 };
+	std::vector<unsigned char> encrypted = decrypter.seal(payload.data(), payload.size(), iv);
+
+	test_equals("gcm encrypted", std::to_string(encrypted.size() == 4 + 12 + payload.size() - 4 + 16) + std::to_string(
+		std::search(encrypted.begin(), encrypted.end(), payload.begin() + 4, payload.end()) == encrypted.end()), "11");
+
+	boost_udp_receive_rar rar("127.0.0.1", 8878);
+	boost_udp_send_faf sender("127.0.0.1", 8878);
+
+	sender.send(encrypted.data(), static_cast<int>(encrypted.size()));
+
+	// Same again with the header tampered with
+	encrypted[0] ^= 1;
+	sender.send(encrypted.data(), static_cast<int>(encrypted.size()));
+
+	boost::system::error_code ec;
+
+	for (int i = 0; i != 2; i++)
+		decrypter.push(rar.receive_view_sync(ec));
+
+	test_equals("gcm decrypted", joined(delivered), "price=100 ");
+
+	const boost_udp_auth_stats stats = decrypter.stats();
+	test_equals("gcm counts", std::to_string(stats.authentic) + " " + std::to_string(stats.rejected), "1 1");
+
+	encrypted[0] ^= 1;
+
+	// Views of memory that mustn't be written, every consumer of a
+	// broadcast ring decrypts the same slot, a shm reader's view is
+	// of a read only mapping.
+	delivered.clear();
+
+	boost_udp_broadcast_ring ring;
+	auto first = ring.join();
+	auto second = ring.join();
+
+	ring.publish(datagram_view(encrypted.data(), encrypted.size()));
+
+	datagram_view datagram;
+
+	for (auto* consumer : { &first, &second }) {
+		if (consumer->next(datagram)) {
+			decrypter.push(datagram);
+			consumer->release();
+		}
+	}
+
+	test_equals("gcm broadcast ring", joined(delivered), "price=100 price=100 ");
+
+	const std::string name = "/boost_udp_receive_rar_auth_test";
+	boost_udp_shm_options shm;
+	shm.capacity = 4;
+
+	boost_udp_shm_publisher publisher(name, shm, ec);
+	boost_udp_shm_reader reader(name, ec);
+
+	publisher.publish(datagram_view(encrypted.data(), encrypted.size()));
+	decrypter.push(reader.receive_view_async(ec));
+
+	test_equals("gcm shm reader", joined(delivered), "price=100 price=100 price=100 ");
+
+	// A buffer of our own is decrypted in place
+	std::vector<unsigned char> own(encrypted);
+	decrypter.push(own.data(), own.size());
+
+	test_equals("gcm in place", joined(delivered) + std::string(own.begin() + 4 + 12, own.begin() + 4 + 12 + 9), "price=100 price=100 price=100 price=100 price=100");
+
+	gcm.key.resize(20);
+	test_equals("gcm bad key", std::to_string(boost_udp_authenticator(gcm).setup_error() == boost::asio::error::invalid_argument), "1");
+}
+
+void test_decompressor() {
+	std::vector<std::string> delivered;
+
+	auto collect = [&](const datagram_view& plain) {
+		delivered.emplace_back(plain.begin(), plain.end());
+	};
+
+	// Whatever's built in, datagrams that aren't frames are
+	// passed through or dropped.
+	boost_udp_decompress_options options;
+	options.pass_through = true;
+
+	boost_udp_decompressor passer(options, collect);
+	const std::string plain = "not compressed";
+
+	passer.push(datagram_view(reinterpret_cast<const unsigned char*>(plain.data()), plain.size()));
+	test_equals("decompress pass through", joined(delivered), plain + " ");
+
+	options.pass_through = false;
+	boost_udp_decompressor dropper(options, collect);
+
+	const bool dropped = !dropper.push(datagram_view(reinterpret_cast<const unsigned char*>(plain.data()), plain.size()));
+	test_equals("decompress drop", std::to_string(dropped) + " " + std::to_string(dropper.stats().unsupported), "1 1");
+
+	options.buffers = 0;
+	test_equals("decompress no buffers", std::to_string(boost_udp_decompressor(options).setup_error() == boost::asio::error::invalid_argument), "1");
+
+	std::string payload;
+
+	for (int i = 0; i != 20; i++)
+		payload += "{\"symbol\":\"ABC\",\"bid\":" + std::to_string(100 + i) + ",\"ask\":" + std::to_string(101 + i) + "}";
+
+	const std::string dictionary = "{\"symbol\":\"ABC\",\"bid\":100,\"ask\":101}";
+
+#if BOOST_UDP_HAVE_ZSTD
+	{
+		// With a dictionary, over a socket, and two output
+		// buffers so the first view outlives the second.
+		boost_udp_decompress_options zstd;
+		zstd.codec = boost_udp_decompress_options::zstd;
+		zstd.dictionary.assign(dictionary.begin(), dictionary.end());
+		zstd.buffers = 2;
+		zstd.max_output_size = 4096;
+
+		boost_udp_decompressor decompressor(zstd);
+		test_equals("zstd setup", decompressor.setup_error().message(), boost::system::error_code().message());
+
+		std::vector<unsigned char> frame(ZSTD_compressBound(payload.size()));
+		ZSTD_CCtx* cctx = ZSTD_createCCtx();
+		frame.resize(ZSTD_compress_usingDict(cctx, frame.data(), frame.size(), payload.data(), payload.size(), dictionary.data(), dictionary.size(), 3));
+		ZSTD_freeCCtx(cctx);
+
+		boost_udp_receive_rar rar("127.0.0.1", 8879);
+		boost_udp_send_faf sender("127.0.0.1", 8879);
+
+		sender.send(frame.data(), static_cast<int>(frame.size()));
+		sender.send(frame.data(), static_cast<int>(frame.size() - 3));
+
+		boost::system::error_code ec;
+		const datagram_view first = decompressor.decompress(rar.receive_view_sync(ec), ec);
+		test_equals("zstd decompressed", std::string(first.begin(), first.end()), payload);
+
+		decompressor.decompress(rar.receive_view_sync(ec), ec);
+		test_equals("zstd truncated", std::to_string(ec == boost::asio::error::invalid_argument) + std::string(first.begin(), first.begin() + 10), "1" + payload.substr(0, 10));
+
+		// Too big for a 64 byte buffer
+		zstd.max_output_size = 64;
+		zstd.dictionary.clear();
+		boost_udp_decompressor small(zstd);
+
+		frame.resize(ZSTD_compressBound(payload.size()));
+		frame.resize(ZSTD_compress(frame.data(), frame.size(), payload.data(), payload.size(), 1));
+		small.decompress(datagram_view(frame.data(), frame.size()), ec);
+
+		test_equals("zstd oversized", std::to_string(ec == boost::asio::error::message_size) + std::to_string(small.stats().oversized), "11");
+
+		// Two frames that fit one at a time but not together,
+		// only found out part way through.
+		frame.resize(ZSTD_compressBound(40));
+		frame.resize(ZSTD_compress(frame.data(), frame.size(), payload.data(), 40, 1));
+		const std::vector<unsigned char> one(frame);
+		frame.insert(frame.end(), one.begin(), one.end());
+		small.decompress(datagram_view(frame.data(), frame.size()), ec);
+
+		test_equals("zstd oversized frames", std::to_string(ec == boost::asio::error::message_size) + std::to_string(small.stats().oversized) + std::to_string(small.stats().corrupt), "120");
+	}
+#endif
+
+#if BOOST_UDP_HAVE_LZ4
+	{
+		// Two frames in one datagram, codec from the magic number
+		delivered.clear();
+		boost_udp_decompressor decompressor(boost_udp_decompress_options(), collect);
+
+		std::vector<unsigned char> frames(2 * LZ4F_compressFrameBound(payload.size(), nullptr));
+		std::size_t n = LZ4F_compressFrame(frames.data(), frames.size(), payload.data(), payload.size(), nullptr);
+		n += LZ4F_compressFrame(frames.data() + n, frames.size() - n, plain.data(), plain.size(), nullptr);
+
+		decompressor.push(datagram_view(frames.data(), n));
+		test_equals("lz4 decompressed", joined(delivered), payload + plain + " ");
+
+		// The second frame cut short
+		decompressor.push(datagram_view(frames.data(), n - 5));
+
+		const boost_udp_decompress_stats stats = decompressor.stats();
+		test_equals("lz4 counts", std::to_string(stats.decompressed) + " " + std::to_string(stats.corrupt) + " " + std::to_string(stats.bytes),
+			"1 1 " + std::to_string(payload.size() + plain.size()));
+	}
+#endif
+}
+
+void test_journal() {
+	const std::string prefix = "/tmp/test_boost_udp_journal_" + std::to_string(::getpid());
+
+	// Small segments so that it rolls over
+	boost_udp_journal_options options;
+	options.segment_size = 2048;
+	options.max_datagram_size = 1024;
+
+	std::vector<std::string> expected;
+
+	{
+		boost::system::error_code ec;
+		boost_udp_journal journal(prefix, options, ec);
+		test_equals("journal open", ec.message(), boost::system::error_code().message());
+
+		boost_udp_receive_rar rar("127.0.0.1", 8880);
+		boost_udp_send_faf sender("127.0.0.1", 8880);
+
+		const std::string big(1500, 'b');
+		std::string sent;
+
+		for (int i = 0; i != 20; i++) {
+			expected.push_back("datagram " + std::to_string(i % 10));
+			sender.send(expected.back());
+			sent += expected.back() + " ";
+		}
+
+		sender.send(big);
+		expected.push_back(big.substr(0, 1024));
+
+		std::string received;
+
+		while (rar.wait(1000, ec)) {
+			const datagram_view datagram = journal.receive(rar, ec);
+
+			if (ec)
+				continue;
+
+			received += std::string(datagram.begin(), datagram.end()).substr(0, 12) + " ";
+
+			if (datagram.size == 1024)
+				break;
+		}
+
+		test_equals("journal receive", received, sent + "bbbbbbbbbbbb ");
+
+		const std::string extra = "recorded";
+		expected.push_back(extra);
+		journal.record(datagram_view(reinterpret_cast<const unsigned char*>(extra.data()), extra.size()));
+
+		const std::string huge(4096, 'h');
+		test_equals("journal too big", std::to_string(journal.record(datagram_view(reinterpret_cast<const unsigned char*>(huge.data()), huge.size()))), "0");
+
+		const boost_udp_journal_stats stats = journal.stats();
+		test_equals("journal counts", std::to_string(stats.records) + " " + std::to_string(stats.truncated) + " "
+			+ std::to_string(stats.oversized) + " " + std::to_string(stats.segments > 1), "22 1 1 1");
+
+		// The segments are there, so don't get written over
+		boost::system::error_code again;
+		boost_udp_journal second(prefix, options, again);
+		test_equals("journal exists", std::to_string(again == boost::system::errc::file_exists), "1");
+		test_equals("journal exists no segment", std::to_string(second.segment() == boost_udp_journal::no_segment) + " '" + second.path() + "'", "1 ''");
+		test_equals("journal segment", journal.path(), boost_udp_journal_layout::segment_path(prefix, journal.segment()));
+	}
+
+	// Read it back
+	std::vector<std::string> read;
+	std::string senders;
+	int64_t last = 0;
+	bool ordered = true;
+
+	for (uint64_t index = 0;; index++) {
+		const std::string path = boost_udp_journal_layout::segment_path(prefix, index);
+		std::ifstream in(path, std::ios::binary);
+
+		if (!in)
+			break;
+
+		const std::string segment((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+		const unsigned char* base = reinterpret_cast<const unsigned char*>(segment.data());
+		std::size_t offset = boost_udp_journal_layout::records_offset();
+
+		while (const boost_udp_journal_layout::record* r = boost_udp_journal_layout::next(base, segment.size(), offset)) {
+			const unsigned char* payload = boost_udp_journal_layout::payload(r);
+			read.emplace_back(payload, payload + r->size);
+
+			ordered = ordered && r->timestamp >= last;
+			last = r->timestamp;
+
+			if (read.size() == 1)
+				senders = boost_udp_journal_layout::load_sender(r).address().to_string();
+		}
+
+		::unlink(path.c_str());
+	}
+
+	test_equals("journal read back", std::to_string(read == expected) + " " + senders + " " + std::to_string(ordered), "1 127.0.0.1 1");
+
+	// A reader following a live segment, with a record that ends on
+	// a page boundary, still finds the end once it's truncated.
+	const long page = ::sysconf(_SC_PAGESIZE);
+	const std::string live_prefix = prefix + "_live";
+	const std::string live_path = boost_udp_journal_layout::segment_path(live_prefix, 0);
+
+	boost_udp_journal_options live;
+	live.segment_size = 4 * page;
+
+	unsigned char* mapped = nullptr;
+	std::size_t records = 0;
+
+	{
+		boost_udp_journal journal(live_prefix, live);
+
+		const int fd = ::open(live_path.c_str(), O_RDONLY);
+		mapped = static_cast<unsigned char*>(::mmap(nullptr, live.segment_size, PROT_READ, MAP_SHARED, fd, 0));
+		::close(fd);
+
+		const std::string whole_page(page - boost_udp_journal_layout::records_offset() - sizeof(boost_udp_journal_layout::record), 'p');
+		journal.record(datagram_view(reinterpret_cast<const unsigned char*>(whole_page.data()), whole_page.size()));
+	}
+
+	std::size_t offset = boost_udp_journal_layout::records_offset();
+
+	while (boost_udp_journal_layout::next(mapped, live.segment_size, offset))
+		records++;
+
+	struct stat st;
+	::stat(live_path.c_str(), &st);
+
+	test_equals("journal live reader", std::to_string(records) + " " + std::to_string(offset) + " " + std::to_string(st.st_size),
+		"1 " + std::to_string(page) + " " + std::to_string(2 * page));
+
+	::munmap(mapped, live.segment_size);
+	::unlink(live_path.c_str());
+}
+
+// An Ethernet frame holding a UDP datagram (or with protocol
+// 6, a TCP segment) as it would be in a pcap file.
+static std::string captured_packet(const bool v6, const bool vlan, const int protocol, const uint16_t port, const std::string& payload) {
+	auto be16 = [](std::string& s, const std::size_t n) {
+		s += static_cast<char>(n >> 8);
+		s += static_cast<char>(n & 0xff);
+	};
+
+	std::string frame(12, '\0');
+
+	if (vlan) {
+		be16(frame, 0x8100);
+		be16(frame, 7);
+	}
+
+	be16(frame, v6 ? 0x86dd : 0x0800);
+
+	std::string udp;
+	be16(udp, 1234);
+	be16(udp, port);
+	be16(udp, 8 + payload.size());
+	be16(udp, 0);
+	udp += payload;
+
+	if (v6) {
+		frame += std::string("\x60\0\0\0", 4);
+		be16(frame, udp.size());
+		frame += static_cast<char>(protocol);
+		frame += '\x40';
+		frame += std::string(15, '\0') + '\x01';
+		frame += std::string(15, '\0') + '\x02';
+	}
+	else {
+		frame += '\x45';
+		frame += '\0';
+		be16(frame, 20 + udp.size());
+		frame += std::string(4, '\0');
+		frame += '\x40';
+		frame += static_cast<char>(protocol);
+		frame += std::string(2, '\0');
+		frame += std::string("\x0a\0\0\x01\x0a\0\0\x02", 8);
+	}
+
+	return frame + udp;
+}
+
+void test_replay() {
+	const std::string prefix = "/tmp/test_boost_udp_replay_" + std::to_string(::getpid());
+	const int64_t epoch = 1700000000000000000ll;
+
+	std::vector<std::string> recorded;
+
+	{
+		boost_udp_journal_options options;
+		options.segment_size = 2048;
+
+		boost_udp_journal journal(prefix, options);
+
+		// 10ms apart, from different ports
+		for (int i = 0; i != 60; i++) {
+			recorded.push_back("replay " + std::to_string(i));
+
+			const boost::asio::ip::udp::endpoint from(boost::asio::ip::address::from_string("127.0.0.2"), static_cast<unsigned short>(5000 + i));
+			journal.record(datagram_view(reinterpret_cast<const unsigned char*>(recorded.back().data()), recorded.back().size(), from), epoch + i * 10000000ll);
+		}
+
+		test_equals("replay segments", std::to_string(journal.stats().segments > 1), "1");
+	}
+
+	boost::system::error_code ec;
+
+	{
+		// As fast as possible
+		boost_udp_replay replay(prefix, boost_udp_replay_options(), ec);
+		test_equals("replay open", ec.message(), boost::system::error_code().message());
+
+		std::vector<std::string> played;
+		std::string fifth;
+
+		for (;;) {
+			const std::string datagram = replay.receive_sync(ec);
+
+			if (ec)
+				break;
+
+			played.push_back(datagram);
+
+			if (played.size() == 5)
+				fifth = std::to_string(replay.timestamp() - epoch);
+		}
+
+		test_equals("replay journal", std::to_string(played == recorded) + " " + fifth + " " + std::to_string(ec == boost::asio::error::eof), "1 40000000 1");
+
+		replay.rewind();
+		const datagram_view first = replay.receive_view_sync(ec);
+		test_equals("replay rewind", std::string(first.begin(), first.end()) + " " + first.sender.address().to_string() + ":"
+			+ std::to_string(first.sender.port()), "replay 0 127.0.0.2:5000");
+
+		// wait() reads ahead into the next segment, the view
+		// from the last receive still has to be there.
+		replay.rewind();
+		std::size_t intact = 0;
+
+		for (;;) {
+			const datagram_view datagram = replay.try_receive_view(ec);
+
+			if (ec)
+				break;
+
+			replay.wait(0, ec);
+			intact += std::string(datagram.begin(), datagram.end()) == recorded[intact];
+		}
+
+		test_equals("replay view outlives wait", std::to_string(intact), std::to_string(recorded.size()));
+	}
+
+	{
+		// Paced, 10 times faster, so 1ms apart
+		boost_udp_replay_options options;
+		options.paced = true;
+		options.speed = 10.0;
+
+		boost_udp_replay replay(prefix, options, ec);
+
+		const auto start = std::chrono::steady_clock::now();
+		replay.receive_view_sync(ec);
+
+		// The second isn't due yet
+		const bool early = replay.receive_view_async(ec).empty() && !ec;
+
+		int played = 1;
+
+		while (!replay.receive_view_sync(ec).empty())
+			played++;
+
+		const double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+		test_equals("replay paced", std::to_string(early) + " " + std::to_string(played) + " " + std::to_string(elapsed >= 0.059 && elapsed < 1.0), "1 60 1");
+	}
+
+	for (uint64_t index = 0; ::unlink(boost_udp_journal_layout::segment_path(prefix, index).c_str()) == 0; index++)
+		;
+
+	// A pcap file, microsecond time stamps on Ethernet
+	const std::string pcap = prefix + ".pcap";
+
+	{
+		std::ofstream out(pcap, std::ios::binary);
+
+		const uint32_t header[] = { 0xa1b2c3d4, 0x00040002, 0, 0, 65535, 1 };
+		out.write(reinterpret_cast<const char*>(header), sizeof(header));
+
+		const std::string packets[] = {
+			captured_packet(false, false, 17, 5555, "hello"),
+			captured_packet(false, false, 6, 5555, "tcp"),
+			captured_packet(false, true, 17, 6666, "other port"),
+			captured_packet(true, true, 17, 5555, "six"),
+		};
+
+		uint32_t seconds = 1;
+
+		for (const auto& packet : packets) {
+			const uint32_t record[] = { seconds++, 5, static_cast<uint32_t>(packet.size()), static_cast<uint32_t>(packet.size()) };
+			out.write(reinterpret_cast<const char*>(record), sizeof(record));
+			out.write(packet.data(), packet.size());
+		}
+	}
+
+	boost_udp_replay_options options;
+	options.port = 5555;
+
+	boost_udp_replay replay(pcap, options, ec);
+	std::string played;
+
+	for (;;) {
+		const datagram_view datagram = replay.receive_view_sync(ec);
+
+		if (ec)
+			break;
+
+		played += std::string(datagram.begin(), datagram.end()) + "@" + datagram.sender.address().to_string() + ":"
+			+ std::to_string(datagram.sender.port()) + "@" + std::to_string(replay.timestamp()) + " ";
+	}
+
+	test_equals("replay pcap", played + std::to_string(replay.skipped()), "hello@10.0.0.1:1234@1000005000 six@::1:1234@4000005000 2");
+
+	::unlink(pcap.c_str());
+}
 
 int main() {
+#ifndef BOOST_UDP_RECEIVE_RAR_NO_EXCEPTIONS
 	test_boost_udp_receive_rar();
+#endif
+	test_error_codes();
+	test_receive_view_async();
+	test_lazy_pool();
+	test_pool_memory();
+	test_numa_stats();
+	test_receive_thread();
+	test_socket_filter();
+	test_reuseport_shards();
+	test_flow_dispatcher();
+	test_work_stealing_pool();
+	test_broadcast_ring();
+	test_shm_ring();
+	test_overflow_policies();
+	test_conflation_cache();
+	test_sequencer();
+	test_feed_arbitrator();
+	test_deduplicator();
+	test_message_splitter();
+	test_typed_view();
+	test_byte_order();
+	test_checksum();
+	test_authenticator();
+	test_decompressor();
+	test_journal();
+	test_replay();
 	return 0;
 }